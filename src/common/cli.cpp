@@ -26,6 +26,7 @@ const char* BATTLE_CONF_FILENAME;
 const char* ATCOMMAND_CONF_FILENAME;
 const char* SCRIPT_CONF_NAME;
 const char* GRF_PATH_FILENAME;
+const char* BATTLE_SIM_FILENAME;
 //char confs
 const char* CHAR_CONF_NAME;
 const char* SQL_CONF_NAME;
@@ -168,6 +169,12 @@ int cli_get_options(int argc, char ** argv) {
 					if (opt_has_next_value(arg, i, argc))
 						LOG_CONF_NAME = argv[++i];
 				}
+				else if (strcmp(arg, "battle-sim") == 0) { // runs the battle simulator and closes the map-server
+					if (opt_has_next_value(arg, i, argc)) {
+						BATTLE_SIM_FILENAME = argv[++i];
+						runflag = CORE_ST_STOP;
+					}
+				}
 				else {
 					ShowError("Unknown option '%s'.\n", argv[i]);
 					exit(EXIT_FAILURE);
@@ -17,6 +17,7 @@
  extern const char* ATCOMMAND_CONF_FILENAME;
  extern const char* SCRIPT_CONF_NAME;
  extern const char* GRF_PATH_FILENAME;
+ extern const char* BATTLE_SIM_FILENAME;
 //char
  extern const char* CHAR_CONF_NAME;
  extern const char* SQL_CONF_NAME;
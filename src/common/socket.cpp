@@ -5,6 +5,11 @@
 
 #include <stdlib.h>
 
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
 #ifdef WIN32
 	#include "winapi.hpp"
 #else
@@ -15,6 +20,7 @@
 	#include <sys/ioctl.h>
 	#include <sys/socket.h>
 	#include <sys/time.h>
+	#include <sys/uio.h>
 	#include <unistd.h>
 
 	#if defined(__linux__) || defined(__linux)
@@ -22,6 +28,15 @@
 
 		#ifdef SOCKET_EPOLL
 			#include <sys/epoll.h>
+			#include <sys/eventfd.h>
+		#endif
+
+		#ifdef SOCKET_IO_URING
+			#include <linux/io_uring.h>
+			#include <poll.h>
+			#include <signal.h>
+			#include <sys/mman.h>
+			#include <sys/syscall.h>
 		#endif
 	#else 
 		#include <netinet/in.h>
@@ -40,7 +55,13 @@
 	#endif
 #endif
 
+#ifdef SOCKET_EPOLL
+	#include <atomic>
+	#include <thread>
+#endif
+
 #include "cbasetypes.hpp"
+#include "core.hpp"
 #include "malloc.hpp"
 #include "mmo.hpp"
 #include "showmsg.hpp"
@@ -224,6 +245,16 @@ char* sErr(int code)
 	static int epfd = SOCKET_ERROR;
 	static struct epoll_event epevent;
 	static struct epoll_event *epevents = nullptr;
+
+	// Dedicated network I/O threads (requires the epoll event dispatcher)
+	#define SOCKET_IO_THREADS
+
+	// io_uring based Event Dispatcher, replaces epoll when active
+	static bool uring_active = false;
+#endif
+
+#if defined(SOCKET_IO_URING) && !defined(SOCKET_EPOLL)
+	#error io_uring event dispatcher requires SOCKET_EPOLL as fallback
 #endif
 
 int fd_max;
@@ -364,76 +395,1817 @@ void set_eof(int fd)
 	}
 }
 
-int recv_to_fifo(int fd)
-{
-	int len;
+/*======================================
+ *	CORE : FIFO buffer pools
+ *--------------------------------------
+ * RFIFO and WFIFO buffers come from power-of-two size classes.
+ * The small classes are carved from larger slabs. Released buffers go
+ * to the free list of their class and are reused by the next session
+ * or fifo growth, instead of reallocating and fragmenting the heap.
+ *--------------------------------------*/
 
-	if( !session_isActive(fd) )
-		return -1;
+/// Smallest and largest size class (log2), bigger buffers are allocated directly
+#define FIFO_CLASS_MIN 11 // 2 KB
+#define FIFO_CLASS_MAX 21 // 2 MB
+#define FIFO_CLASS_COUNT (FIFO_CLASS_MAX - FIFO_CLASS_MIN + 1)
+/// Classes up to this one are carved from slabs of FIFO_SLAB_SIZE bytes
+#define FIFO_SLAB_CLASS_MAX 14 // 16 KB
+#define FIFO_SLAB_SIZE (256*1024)
+/// Maximum number of bytes kept on the free list of a class that does not use slabs
+#define FIFO_POOL_KEEP (4*1024*1024)
+
+struct s_fifo_pool {
+	void* free; // released buffers, linked through their first bytes
+	unsigned int used; // buffers in use
+	unsigned int unused; // buffers on the free list
+};
 
-	len = sRecv(fd, (char *) session[fd]->rdata + session[fd]->rdata_size, (int)RFIFOSPACE(fd), 0);
+static struct s_fifo_pool fifo_pools[FIFO_CLASS_COUNT];
+static std::vector<uint8*> fifo_slabs;
+static size_t fifo_direct_used = 0; // bytes of buffers above the largest class
 
-	if( len == SOCKET_ERROR )
-	{//An exception has occured
-		if( sErrno != S_EWOULDBLOCK ) {
-			//ShowDebug("recv_to_fifo: %s, closing connection #%d\n", error_msg(), fd);
-			set_eof(fd);
+/// Returns the size class (log2) of a fifo size.
+static int fifo_class( size_t size ){
+	int c = FIFO_CLASS_MIN;
+
+	while( c <= FIFO_CLASS_MAX && ( (size_t)1 << c ) < size )
+		c++;
+
+	return c;
+}
+
+/// Returns the number of bytes reserved for a fifo of the given size.
+static size_t fifo_capacity( size_t size ){
+	int c = fifo_class( size );
+
+	return ( c > FIFO_CLASS_MAX ) ? size : (size_t)1 << c;
+}
+
+static uint8* fifo_alloc( size_t size ){
+	int c = fifo_class( size );
+	struct s_fifo_pool* pool;
+	uint8* buf;
+
+	if( c > FIFO_CLASS_MAX ){
+		fifo_direct_used += size;
+		return (uint8*)aMalloc( size );
+	}
+
+	pool = &fifo_pools[c - FIFO_CLASS_MIN];
+
+	if( pool->free == nullptr && c <= FIFO_SLAB_CLASS_MAX ){
+		// Carve a new slab into buffers of this class
+		size_t n = (size_t)1 << c;
+		uint8* slab = (uint8*)aMalloc( FIFO_SLAB_SIZE );
+
+		fifo_slabs.push_back( slab );
+
+		for( size_t off = 0; off < FIFO_SLAB_SIZE; off += n ){
+			*(void**)( slab + off ) = pool->free;
+			pool->free = slab + off;
+			pool->unused++;
 		}
-		return 0;
 	}
 
-	if( len == 0 )
-	{//Normal connection end.
-		set_eof(fd);
+	if( pool->free != nullptr ){
+		buf = (uint8*)pool->free;
+		pool->free = *(void**)buf;
+		pool->unused--;
+	}else{
+		buf = (uint8*)aMalloc( (size_t)1 << c );
+	}
+
+	pool->used++;
+
+	return buf;
+}
+
+static void fifo_free( uint8* buf, size_t size ){
+	int c = fifo_class( size );
+	struct s_fifo_pool* pool;
+
+	if( buf == nullptr )
+		return;
+
+	if( c > FIFO_CLASS_MAX ){
+		fifo_direct_used -= size;
+		aFree( buf );
+		return;
+	}
+
+	pool = &fifo_pools[c - FIFO_CLASS_MIN];
+	pool->used--;
+
+	if( c > FIFO_SLAB_CLASS_MAX && ( (size_t)pool->unused + 1 ) << c > FIFO_POOL_KEEP ){
+		aFree( buf );
+		return;
+	}
+
+	*(void**)buf = pool->free;
+	pool->free = buf;
+	pool->unused++;
+}
+
+/// Moves a fifo to a buffer for the new size, keeping the first used bytes.
+/// Nothing is moved if both sizes share the same size class.
+static uint8* fifo_resize( uint8* buf, size_t size, size_t used, size_t newsize ){
+	uint8* newbuf;
+
+	if( fifo_capacity( size ) == fifo_capacity( newsize ) && fifo_class( size ) <= FIFO_CLASS_MAX )
+		return buf;
+
+	newbuf = fifo_alloc( newsize );
+	memcpy( newbuf, buf, used );
+	fifo_free( buf, size );
+
+	return newbuf;
+}
+
+/// Releases all pooled fifo buffers.
+static void fifo_pool_final( void ){
+	for( int c = FIFO_SLAB_CLASS_MAX + 1; c <= FIFO_CLASS_MAX; c++ ){
+		struct s_fifo_pool* pool = &fifo_pools[c - FIFO_CLASS_MIN];
+
+		while( pool->free != nullptr ){
+			void* next = *(void**)pool->free;
+
+			aFree( pool->free );
+			pool->free = next;
+		}
+
+		pool->unused = 0;
+	}
+
+	for( uint8* slab : fifo_slabs )
+		aFree( slab );
+
+	fifo_slabs.clear();
+
+	for( int c = FIFO_CLASS_MIN; c <= FIFO_SLAB_CLASS_MAX; c++ ){
+		fifo_pools[c - FIFO_CLASS_MIN].free = nullptr;
+		fifo_pools[c - FIFO_CLASS_MIN].unused = 0;
+	}
+}
+
+/*======================================
+ *	CORE : Packet statistics
+ *--------------------------------------
+ * Counts the packets and bytes per packet id and direction and the
+ * traffic of each session. Received packets are counted when they are
+ * skipped (RFIFOSKIP), sent packets when they are queued (WFIFOSET,
+ * WFIFOSHARE). When disabled, the only cost is a pointer check.
+ *--------------------------------------*/
+
+enum e_packet_stats_dir {
+	PACKET_STATS_RECV = 0,
+	PACKET_STATS_SEND,
+	PACKET_STATS_MAX
+};
+
+static bool packet_stats_enabled = false;
+static int packet_stats_interval = 0; // seconds between two snapshots, 0 disables them
+static char packet_stats_file[256] = "log/packet_stats.csv";
+static struct s_packet_stats* packet_stats = nullptr; // one table of 0x10000 packet ids per direction
+static time_t packet_stats_start = 0;
+
+static inline void packet_stats_add( int fd, int dir, uint16 cmd, size_t len ){
+	struct s_packet_stats* entry = &packet_stats[dir * 0x10000 + cmd];
+
+	entry->count++;
+	entry->bytes += len;
+	session[fd]->traffic[dir].count++;
+	session[fd]->traffic[dir].bytes += len;
+}
+
+/// Writes the current counters to packet_stats_file.
+/// CSV files get one line per packet id and direction appended, so they keep the history.
+/// JSON files are overwritten with the latest snapshot.
+static void packet_stats_write( void ){
+	static const char* dir_names[PACKET_STATS_MAX] = { "recv", "send" };
+	const char* ext = strrchr( packet_stats_file, '.' );
+	bool json = ( ext != nullptr && strcmpi( ext, ".json" ) == 0 );
+	long long now = (long long)time( nullptr );
+	FILE* fp;
+
+	if( packet_stats == nullptr )
+		return;
+
+	if( ( fp = fopen( packet_stats_file, json ? "w" : "a" ) ) == nullptr ){
+		ShowError( "packet_stats_write: Could not open '%s' for writing.\n", packet_stats_file );
+		return;
+	}
+
+	if( json ){
+		fprintf( fp, "{\n\t\"time\": %lld,\n\t\"uptime\": %lld", now, now - (long long)packet_stats_start );
+	}else{
+		fseek( fp, 0, SEEK_END );
+
+		if( ftell( fp ) == 0 )
+			fprintf( fp, "time,direction,packet,count,bytes\n" );
+	}
+
+	for( int dir = PACKET_STATS_RECV; dir < PACKET_STATS_MAX; dir++ ){
+		bool first = true;
+
+		if( json )
+			fprintf( fp, ",\n\t\"%s\": [", dir_names[dir] );
+
+		for( int cmd = 0; cmd < 0x10000; cmd++ ){
+			struct s_packet_stats* entry = &packet_stats[dir * 0x10000 + cmd];
+
+			if( entry->count == 0 )
+				continue;
+
+			if( json )
+				fprintf( fp, "%s\n\t\t{ \"packet\": \"0x%04x\", \"count\": %" PRIu64 ", \"bytes\": %" PRIu64 " }", first ? "" : ",", cmd, entry->count, entry->bytes );
+			else
+				fprintf( fp, "%lld,%s,0x%04x,%" PRIu64 ",%" PRIu64 "\n", now, dir_names[dir], cmd, entry->count, entry->bytes );
+
+			first = false;
+		}
+
+		if( json )
+			fprintf( fp, "\n\t]" );
+	}
+
+	if( json )
+		fprintf( fp, "\n}\n" );
+
+	fclose( fp );
+}
+
+static TIMER_FUNC(packet_stats_timer){
+	packet_stats_write();
+	return 0;
+}
+
+static void packet_stats_init( void ){
+	if( !packet_stats_enabled )
+		return;
+
+	packet_stats = (struct s_packet_stats*)aCalloc( PACKET_STATS_MAX * 0x10000, sizeof( struct s_packet_stats ) );
+	packet_stats_start = time( nullptr );
+
+	if( packet_stats_interval > 0 ){
+		add_timer_func_list( packet_stats_timer, "packet_stats_timer" );
+		add_timer_interval( gettick() + packet_stats_interval * 1000, packet_stats_timer, 0, 0, packet_stats_interval * 1000 );
+		ShowInfo( "Packet statistics are written to '" CL_WHITE "%s" CL_RESET "' every " CL_WHITE "%d" CL_RESET " seconds.\n", packet_stats_file, packet_stats_interval );
+	}
+}
+
+static void packet_stats_final( void ){
+	if( packet_stats == nullptr )
+		return;
+
+	if( packet_stats_interval > 0 )
+		packet_stats_write();
+
+	aFree( packet_stats );
+	packet_stats = nullptr;
+}
+
+/*======================================
+ *	CORE : Shared packet buffers
+ *--------------------------------------
+ * Broadcasts create one immutable packet buffer and queue it for every
+ * recipient (WFIFOSHARE) instead of copying it into each WFIFO.
+ * The queue of a session remembers at which WFIFO position each packet
+ * was queued, the sends gather the WFIFO parts and packets in this order
+ * into one vectored write.
+ *--------------------------------------*/
+
+/// Maximum number of iovecs gathered for one send
+#define SHARED_IOV_MAX 64
+
+struct s_shared_entry {
+	size_t offset; // position in the WFIFO at which the packet was queued
+	struct s_shared_packet* packet;
+};
+
+struct s_shared_queue {
+	std::deque<struct s_shared_entry> entries;
+	size_t sent; // bytes of the first packet that were sent already
+	size_t size; // bytes of all queued packets that were not sent yet
+};
+
+struct s_shared_packet* shared_packet_create( const uint8* buf, size_t len ){
+	struct s_shared_packet* packet = (struct s_shared_packet*)aMalloc( sizeof( struct s_shared_packet ) + len );
+
+	packet->refcount = 1;
+	packet->len = len;
+	memcpy( packet->data, buf, len );
+
+	return packet;
+}
+
+void shared_packet_release( struct s_shared_packet* packet ){
+	if( packet != nullptr && --packet->refcount == 0 ){
+		aFree( packet );
+	}
+}
+
+/// Returns the number of queued shared packet bytes of a session.
+static inline size_t shared_size( int fd ){
+	return ( session[fd]->wshared != nullptr ) ? session[fd]->wshared->size : 0;
+}
+
+/// Whether a session has any data to send.
+static inline bool session_wpending( int fd ){
+	return session[fd]->wdata_size > 0 || shared_size( fd ) > 0;
+}
+
+/// Releases all queued shared packets of a session.
+static void shared_clear( int fd, bool free_queue ){
+	struct s_shared_queue* queue = session[fd]->wshared;
+
+	if( queue == nullptr ){
+		return;
+	}
+
+#ifdef SHOW_SERVER_STATS
+	socket_data_qo -= queue->size;
+#endif
+
+	for( struct s_shared_entry& entry : queue->entries ){
+		shared_packet_release( entry.packet );
+	}
+
+	queue->entries.clear();
+	queue->sent = 0;
+	queue->size = 0;
+
+	if( free_queue ){
+		delete queue;
+		session[fd]->wshared = nullptr;
+	}
+}
+
+#ifndef WIN32
+/// Gathers the data to send in order, WFIFO parts and shared packets.
+/// @param iov: iovecs to fill
+/// @param max: maximum number of iovecs
+/// @param total: number of gathered bytes
+/// @return number of filled iovecs
+static int shared_gather( int fd, struct iovec* iov, int max, size_t* total ){
+	struct socket_data* s = session[fd];
+	size_t pos = 0;
+	int count = 0;
+
+	*total = 0;
+
+	for( auto it = s->wshared->entries.begin(); it != s->wshared->entries.end() && count < max; ++it ){
+		size_t skip = ( it == s->wshared->entries.begin() ) ? s->wshared->sent : 0;
+
+		if( it->offset > pos ){
+			iov[count].iov_base = s->wdata + pos;
+			iov[count].iov_len = it->offset - pos;
+			*total += iov[count].iov_len;
+			pos = it->offset;
+
+			if( ++count == max ){
+				return count;
+			}
+		}
+
+		iov[count].iov_base = it->packet->data + skip;
+		iov[count].iov_len = it->packet->len - skip;
+		*total += iov[count].iov_len;
+		count++;
+	}
+
+	// WFIFO data behind the last packet
+	if( count < max && s->wdata_size > pos ){
+		iov[count].iov_base = s->wdata + pos;
+		iov[count].iov_len = s->wdata_size - pos;
+		*total += iov[count].iov_len;
+		count++;
+	}
+
+	return count;
+}
+#endif
+
+/// Removes sent data from the WFIFO and the queue of shared packets.
+static void shared_consume( int fd, size_t len ){
+	struct socket_data* s = session[fd];
+	struct s_shared_queue* queue = s->wshared;
+	size_t pos = 0; // consumed bytes of the WFIFO
+
+	if( queue != nullptr ){
+		while( len > 0 && !queue->entries.empty() ){
+			struct s_shared_entry& entry = queue->entries.front();
+			size_t n;
+
+			if( entry.offset > pos ){
+				// WFIFO data in front of the packet
+				n = std::min( len, entry.offset - pos );
+				pos += n;
+				len -= n;
+				continue;
+			}
+
+			n = std::min( len, entry.packet->len - queue->sent );
+			queue->sent += n;
+			queue->size -= n;
+			len -= n;
+
+			if( queue->sent == entry.packet->len ){
+				shared_packet_release( entry.packet );
+				queue->entries.pop_front();
+				queue->sent = 0;
+			}
+		}
+	}
+
+	pos += len;
+
+	if( pos == 0 ){
+		return;
+	}
+
+	// shift unsent data to the beginning of the queue
+	if( pos < s->wdata_size )
+		memmove( s->wdata, s->wdata + pos, s->wdata_size - pos );
+
+	s->wdata_size -= pos;
+
+	if( queue != nullptr ){
+		for( struct s_shared_entry& entry : queue->entries ){
+			entry.offset -= pos;
+		}
+	}
+}
+
+#ifdef SOCKET_IO_URING
+/*======================================
+ *	CORE : io_uring event dispatcher
+ *--------------------------------------
+ * Used instead of epoll when enabled in packet_athena.conf and supported
+ * by the kernel (Linux 6.0 or newer), falls back to epoll otherwise.
+ * Every connection has a multishot recv posted, which receives into a
+ * ring of provided buffers, so no recv syscall or epoll_ctl is needed.
+ * Sends are queued from the WFIFO and submitted in one batch, together
+ * with the wait for new completions. Nothing waits for a send, its
+ * buffers are kept until the completion arrives.
+ *--------------------------------------*/
+
+/// Number of submission queue entries
+#define URING_ENTRIES 4096
+/// Number and size of the provided receive buffers (count must be a power of two)
+#define URING_BUF_COUNT 1024
+#define URING_BUF_SIZE (2*1024)
+/// Buffer group id of the receive buffers
+#define URING_BUF_GROUP 0
+
+/// Types of requests, stored in the lowest byte of the user data
+enum e_uring_op : uint8 {
+	URING_OP_RECV = 1,
+	URING_OP_POLL,
+	URING_OP_SEND,
+	URING_OP_CANCEL,
+};
+
+/// Whether io_uring should be used (packet_athena.conf)
+static bool uring_enabled = false;
+
+static struct {
+	int fd;
+	// submission queue
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned sq_entries;
+	unsigned sq_local_tail; // tail of queued, not yet published entries
+	struct io_uring_sqe* sqes;
+	// completion queue
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe* cqes;
+	// mappings
+	void* ring_ptr;
+	size_t ring_len;
+	size_t sqes_len;
+	// provided receive buffers
+	// io_uring_buf_ring is not used directly, in C++ its flexible array member does not start at offset 0
+	struct io_uring_buf* buf_ring;
+	size_t buf_ring_len;
+	uint8* bufs;
+	uint16 buf_tail;
+} uring;
+
+/// Send request in flight, its buffers stay valid until the completion arrived
+struct s_uring_send {
+	uint64 user_data;
+	uint8* wdata; // WFIFO the data is sent from
+	size_t max_wdata;
+	bool owns_wdata; // the WFIFO was replaced or the session deleted, the buffer is freed with the send
+	std::vector<struct s_shared_packet*> packets; // references to the shared packets that are sent
+	struct msghdr msg;
+	struct iovec iov[SHARED_IOV_MAX];
+};
+
+/// io_uring state of a session
+struct s_uring_session {
+	uint32 generation; // incremented when the socket is closed, completions of older requests are ignored
+	bool armed; // a recv or poll request is active
+	bool paused; // receiving was stopped until the spill buffer is moved into the RFIFO
+	struct s_uring_send* send; // send in flight, the session sends again after its completion
+	std::vector<uint8> spill; // received data that did not fit into the RFIFO
+};
+
+static struct s_uring_session uring_sessions[MAXCONN];
+static std::vector<int> uring_spilled; // sessions with a non-empty spill buffer
+static std::unordered_map<uint64, struct s_uring_send*> uring_orphans; // sends in flight of deleted sessions, by user data
+
+int recv_to_fifo(int fd);
+void send_shortlist_add_fd(int fd);
+
+static inline uint64 uring_user_data( int fd, enum e_uring_op op ){
+	return ( (uint64)uring_sessions[fd].generation << 32 ) | ( (uint64)fd << 8 ) | op;
+}
+
+/// Releases the buffers of a send after its completion.
+static void uring_send_free( struct s_uring_send* send ){
+	if( send->owns_wdata ){
+		fifo_free( send->wdata, send->max_wdata );
+	}
+
+	for( struct s_shared_packet* packet : send->packets ){
+		shared_packet_release( packet );
+	}
+
+	delete send;
+}
+
+/// Submits the queued requests and optionally waits for completions.
+/// @param min_complete: number of completions to wait for
+/// @param timeout: maximum time to wait in milliseconds, -1 for no limit
+/// @return number of submitted requests or SOCKET_ERROR
+static int uring_enter( unsigned int min_complete, t_tick timeout ){
+	struct io_uring_getevents_arg arg = {};
+	struct __kernel_timespec ts;
+	unsigned int flags = 0;
+	unsigned int submit;
+	int ret;
+
+	__atomic_store_n( uring.sq_tail, uring.sq_local_tail, __ATOMIC_RELEASE );
+	submit = uring.sq_local_tail - __atomic_load_n( uring.sq_head, __ATOMIC_ACQUIRE );
+
+	if( min_complete > 0 ){
+		flags |= IORING_ENTER_GETEVENTS;
+	}
+
+	if( timeout >= 0 ){
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = ( timeout % 1000 ) * 1000000;
+		arg.sigmask_sz = _NSIG / 8;
+		arg.ts = (uint64)&ts;
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+
+	ret = (int)syscall( __NR_io_uring_enter, uring.fd, submit, min_complete, flags, ( timeout >= 0 ) ? (void*)&arg : nullptr, ( timeout >= 0 ) ? sizeof( arg ) : _NSIG / 8 );
+
+	if( ret < 0 && ( errno == ETIME || errno == EBUSY ) ){
+		// Timed out or completion queue is busy, both are no errors
 		return 0;
 	}
 
-	session[fd]->rdata_size += len;
-	session[fd]->rdata_tick = last_tick;
+	return ret;
+}
+
+/// Returns a cleared submission queue entry, submitting queued entries if the queue is full.
+static struct io_uring_sqe* uring_get_sqe( void ){
+	struct io_uring_sqe* sqe;
+	unsigned index;
+
+	while( uring.sq_local_tail - __atomic_load_n( uring.sq_head, __ATOMIC_ACQUIRE ) >= uring.sq_entries ){
+		if( uring_enter( 0, -1 ) < 0 && errno != EINTR ){
+			ShowFatalError( "uring_get_sqe: io_uring_enter() failed, %s!\n", error_msg() );
+			exit( EXIT_FAILURE );
+		}
+	}
+
+	index = uring.sq_local_tail & *uring.sq_mask;
+	sqe = &uring.sqes[index];
+	memset( sqe, 0, sizeof( *sqe ) );
+	uring.sq_array[index] = index;
+	uring.sq_local_tail++;
+
+	return sqe;
+}
+
+/// Gives a receive buffer back to the kernel.
+static void uring_recycle_buffer( uint16 bid ){
+	struct io_uring_buf* buf = &uring.buf_ring[uring.buf_tail & ( URING_BUF_COUNT - 1 )];
+
+	buf->addr = (uint64)( uring.bufs + (size_t)bid * URING_BUF_SIZE );
+	buf->len = URING_BUF_SIZE;
+	buf->bid = bid;
+	uring.buf_tail++;
+	// The ring tail overlays the reserved field of the first entry
+	__atomic_store_n( &uring.buf_ring[0].resv, uring.buf_tail, __ATOMIC_RELEASE );
+}
+
+/// Starts receiving on a socket.
+/// Sessions that receive with recv_to_fifo get a multishot recv, others (listeners) a poll
+/// for readability that calls their func_recv.
+static void uring_watch( int fd ){
+	struct io_uring_sqe* sqe = uring_get_sqe();
+
+	if( session[fd]->func_recv == recv_to_fifo ){
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = fd;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = URING_BUF_GROUP;
+		sqe->user_data = uring_user_data( fd, URING_OP_RECV );
+	}else{
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fd;
+		sqe->poll32_events = POLLIN;
+		sqe->user_data = uring_user_data( fd, URING_OP_POLL );
+	}
+
+	uring_sessions[fd].armed = true;
+}
+
+/// Cancels the active recv or poll request of a socket.
+static void uring_cancel( int fd, enum e_uring_op op ){
+	struct io_uring_sqe* sqe = uring_get_sqe();
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = uring_user_data( fd, op );
+	sqe->user_data = uring_user_data( fd, URING_OP_CANCEL );
+}
+
+/// Stops handling a socket that is about to be closed.
+static void uring_unwatch( int fd ){
+	struct s_uring_session* us = &uring_sessions[fd];
+
+	if( us->armed ){
+		uring_cancel( fd, ( session[fd] != nullptr && session[fd]->func_recv != recv_to_fifo ) ? URING_OP_POLL : URING_OP_RECV );
+	}
+
+	// Completions of requests for the old socket are ignored from now on
+	us->generation++;
+	us->armed = false;
+	us->paused = false;
+	us->spill.clear();
+	us->spill.shrink_to_fit();
+}
+
+/// Appends received data to the RFIFO, data that does not fit is kept in the spill buffer.
+static void uring_recv_data( int fd, const uint8* data, size_t len ){
+	struct socket_data* s = session[fd];
+	struct s_uring_session* us = &uring_sessions[fd];
+	size_t n = 0;
+
+	if( us->spill.empty() ){
+		n = std::min( len, RFIFOSPACE( fd ) );
+		memcpy( s->rdata + s->rdata_size, data, n );
+		s->rdata_size += n;
+	}
+
+	if( n < len ){
+		if( us->spill.empty() ){
+			uring_spilled.push_back( fd );
+		}
+
+		us->spill.insert( us->spill.end(), data + n, data + len );
+
+		// Stop receiving until the game caught up, the kernel buffers the rest
+		if( us->armed && !us->paused ){
+			us->paused = true;
+			uring_cancel( fd, URING_OP_RECV );
+		}
+	}
+
+	s->rdata_tick = last_tick;
 #ifdef SHOW_SERVER_STATS
 	socket_data_i += len;
 	socket_data_qi += len;
-	if (!session[fd]->flag.server)
+	if (!s->flag.server)
 	{
 		socket_data_ci += len;
 	}
-#endif
+#endif
+}
+
+/// Moves spilled data into the RFIFO and resumes receiving when everything was moved.
+static void uring_unspill( void ){
+	std::vector<int> spilled;
+
+	spilled.swap( uring_spilled );
+
+	for( int fd : spilled ){
+		struct s_uring_session* us = &uring_sessions[fd];
+		size_t n;
+
+		if( !session_isActive( fd ) || us->spill.empty() ){
+			continue;
+		}
+
+		n = std::min( us->spill.size(), RFIFOSPACE( fd ) );
+		memcpy( session[fd]->rdata + session[fd]->rdata_size, us->spill.data(), n );
+		session[fd]->rdata_size += n;
+		us->spill.erase( us->spill.begin(), us->spill.begin() + n );
+
+		if( !us->spill.empty() ){
+			uring_spilled.push_back( fd );
+		}else if( us->paused ){
+			us->paused = false;
+
+			if( !us->armed ){
+				uring_watch( fd );
+			}
+		}
+	}
+}
+
+/// Handles the completion of a send request.
+static void uring_send_complete( int fd, int res ){
+	struct socket_data* s = session[fd];
+
+	if( uring_sessions[fd].send != nullptr ){
+		uring_send_free( uring_sessions[fd].send );
+		uring_sessions[fd].send = nullptr;
+	}
+
+	if( s == nullptr ){
+		return;
+	}
+
+	if( res < 0 ){
+		if( res != -EAGAIN && res != -EINTR ){
+#ifdef SHOW_SERVER_STATS
+			socket_data_qo -= s->wdata_size;
+#endif
+			s->wdata_size = 0; //Clear the send queue as we can't send anymore. [Skotlex]
+			shared_clear( fd, false );
+			set_eof( fd );
+		}else{
+			send_shortlist_add_fd( fd );
+		}
+		return;
+	}
+
+	shared_consume( fd, res );
+#ifdef SHOW_SERVER_STATS
+	socket_data_o += res;
+	socket_data_qo -= res;
+	if (!s->flag.server)
+	{
+		socket_data_co += res;
+	}
+#endif
+
+	// Kernel buffer was full, try the rest later
+	if( session_wpending( fd ) )
+		send_shortlist_add_fd( fd );
+}
+
+/// Handles a completion.
+static void uring_complete( struct io_uring_cqe* cqe ){
+	int fd = (int)( ( cqe->user_data >> 8 ) & 0xFFFFFF );
+	enum e_uring_op op = (enum e_uring_op)( cqe->user_data & 0xFF );
+	bool more = ( cqe->flags & IORING_CQE_F_MORE ) != 0;
+	struct s_uring_session* us;
+
+	if( op == URING_OP_CANCEL || fd <= 0 || fd >= MAXCONN ){
+		return;
+	}
+
+	us = &uring_sessions[fd];
+
+	if( ( cqe->user_data >> 32 ) != us->generation ){
+		// Request of a socket that was closed already
+		if( op == URING_OP_SEND ){
+			auto it = uring_orphans.find( cqe->user_data );
+
+			if( it != uring_orphans.end() ){
+				uring_send_free( it->second );
+				uring_orphans.erase( it );
+			}
+		}
+
+		if( cqe->flags & IORING_CQE_F_BUFFER ){
+			uring_recycle_buffer( cqe->flags >> IORING_CQE_BUFFER_SHIFT );
+		}
+		return;
+	}
+
+	switch( op ){
+		case URING_OP_SEND:
+			uring_send_complete( fd, cqe->res );
+			return;
+
+		case URING_OP_POLL:
+			us->armed = false;
+
+			if( session[fd] != nullptr ){
+				session[fd]->func_recv( fd );
+
+				if( session[fd] != nullptr && !us->armed ){
+					uring_watch( fd );
+				}
+			}
+			return;
+
+		case URING_OP_RECV:
+			if( !more ){
+				us->armed = false;
+			}
+
+			if( cqe->flags & IORING_CQE_F_BUFFER ){
+				uint16 bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+				if( cqe->res > 0 && session_isActive( fd ) ){
+					uring_recv_data( fd, uring.bufs + (size_t)bid * URING_BUF_SIZE, cqe->res );
+				}
+
+				uring_recycle_buffer( bid );
+			}
+
+			if( cqe->res == 0 ){
+				// Normal connection end
+				set_eof( fd );
+				return;
+			}
+
+			if( cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED ){
+				set_eof( fd );
+				return;
+			}
+
+			// Multishot ended (out of buffers, canceled or overflow), post a new one unless paused
+			if( !us->armed && !us->paused && session_isActive( fd ) ){
+				uring_watch( fd );
+			}
+			return;
+
+		default:
+			return;
+	}
+}
+
+/// Collects all available completions, without waiting.
+static void uring_reap( void ){
+	unsigned head = *uring.cq_head;
+	unsigned tail = __atomic_load_n( uring.cq_tail, __ATOMIC_ACQUIRE );
+
+	while( head != tail ){
+		struct io_uring_cqe cqe = uring.cqes[head & *uring.cq_mask];
+
+		head++;
+		__atomic_store_n( uring.cq_head, head, __ATOMIC_RELEASE );
+
+		uring_complete( &cqe );
+
+		tail = __atomic_load_n( uring.cq_tail, __ATOMIC_ACQUIRE );
+	}
+}
+
+/// Submits the queued requests without waiting for their completion.
+static void uring_submit( void ){
+	while( uring_enter( 0, -1 ) < 0 && errno == EINTR );
+}
+
+/// Lets the send in flight of a session keep the current WFIFO buffer, before it is moved or freed.
+/// @return true if the buffer belongs to the send now
+static bool uring_send_keep_wdata( int fd ){
+	struct s_uring_send* send = uring_sessions[fd].send;
+
+	if( !uring_active || send == nullptr || send->owns_wdata || send->wdata != session[fd]->wdata ){
+		return false;
+	}
+
+	send->owns_wdata = true;
+	return true;
+}
+
+/// Hands the send in flight of a deleted session over to the orphans, which are freed on completion.
+/// @return true if the send keeps the WFIFO buffer
+static bool uring_send_orphan( int fd ){
+	struct s_uring_session* us = &uring_sessions[fd];
+	bool kept;
+
+	if( !uring_active || us->send == nullptr ){
+		return false;
+	}
+
+	kept = uring_send_keep_wdata( fd );
+	uring_orphans[us->send->user_data] = us->send;
+	us->send = nullptr;
+
+	return kept;
+}
+
+/// Queues a send of the WFIFO. (send_from_fifo)
+static int uring_send( int fd ){
+	struct s_uring_session* us = &uring_sessions[fd];
+	struct io_uring_sqe* sqe;
+	struct s_uring_send* send;
+
+	// One send per session, the completion of the send in flight sends the rest
+	if( us->send != nullptr || session[fd] == nullptr || !session_wpending( fd ) )
+		return 0;
+
+	sqe = uring_get_sqe();
+	send = new s_uring_send();
+	send->user_data = uring_user_data( fd, URING_OP_SEND );
+	send->wdata = session[fd]->wdata;
+	send->max_wdata = session[fd]->max_wdata;
+	send->owns_wdata = false;
+
+	if( shared_size( fd ) > 0 ){
+		// Shared packets are queued, send them together with the WFIFO data
+		size_t total;
+
+		send->msg.msg_iov = send->iov;
+		send->msg.msg_iovlen = shared_gather( fd, send->iov, SHARED_IOV_MAX, &total );
+
+		// The packets stay referenced even if the session is deleted before the completion
+		for( struct s_shared_entry& entry : session[fd]->wshared->entries ){
+			entry.packet->refcount++;
+			send->packets.push_back( entry.packet );
+		}
+
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->addr = (uint64)&send->msg;
+		sqe->len = 1;
+	}else{
+		sqe->opcode = IORING_OP_SEND;
+		sqe->addr = (uint64)session[fd]->wdata;
+		sqe->len = (uint32)session[fd]->wdata_size;
+	}
+
+	sqe->fd = fd;
+	sqe->msg_flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+	sqe->user_data = send->user_data;
+
+	us->send = send;
+
+	return 0;
+}
+
+/// Submits queued requests and waits for completions.
+static int uring_wait( t_tick next ){
+	uring_unspill();
+
+	return uring_enter( 1, next );
+}
+
+/// Handles all completions.
+static void uring_dispatch( void ){
+	uring_reap();
+}
+
+/// Checks that the kernel supports all requests that are used.
+static bool uring_probe_ops( void ){
+	static const uint8 ops[] = { IORING_OP_RECV, IORING_OP_POLL_ADD, IORING_OP_SEND, IORING_OP_SENDMSG, IORING_OP_ASYNC_CANCEL };
+	size_t len = sizeof( struct io_uring_probe ) + 256 * sizeof( struct io_uring_probe_op );
+	struct io_uring_probe* probe = (struct io_uring_probe*)aCalloc( 1, len );
+	bool supported = true;
+
+	if( syscall( __NR_io_uring_register, uring.fd, IORING_REGISTER_PROBE, probe, 256 ) < 0 ){
+		supported = false;
+	}else{
+		for( uint8 op : ops ){
+			if( op > probe->last_op || !( probe->ops[op].flags & IO_URING_OP_SUPPORTED ) ){
+				supported = false;
+				break;
+			}
+		}
+	}
+
+	aFree( probe );
+	return supported;
+}
+
+/// Checks that the kernel supports multishot receives into the provided buffers,
+/// by receiving a byte on a socket pair.
+static bool uring_probe_multishot( void ){
+	struct io_uring_sqe* sqe;
+	bool supported = false;
+	int sv[2];
+
+	if( socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv ) != 0 ){
+		return false;
+	}
+
+	// User data 0 belongs to no session, the final completion after the sockets are closed is ignored
+	sqe = uring_get_sqe();
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = sv[0];
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUF_GROUP;
+	sqe->user_data = 0;
+
+	if( write( sv[1], "", 1 ) == 1 && uring_enter( 1, 1000 ) >= 0 ){
+		unsigned head = *uring.cq_head;
+
+		while( head != __atomic_load_n( uring.cq_tail, __ATOMIC_ACQUIRE ) ){
+			struct io_uring_cqe cqe = uring.cqes[head & *uring.cq_mask];
+
+			head++;
+			__atomic_store_n( uring.cq_head, head, __ATOMIC_RELEASE );
+
+			if( cqe.flags & IORING_CQE_F_BUFFER ){
+				uring_recycle_buffer( cqe.flags >> IORING_CQE_BUFFER_SHIFT );
+			}
+
+			if( cqe.user_data == 0 && cqe.res == 1 && ( cqe.flags & IORING_CQE_F_MORE ) ){
+				supported = true;
+			}
+		}
+	}
+
+	close( sv[0] );
+	close( sv[1] );
+
+	return supported;
+}
+
+static void uring_final( void );
+
+/// Sets up the io_uring instance, returns false if the kernel does not support it.
+static bool uring_init( void ){
+	struct io_uring_params p = {};
+	struct io_uring_buf_reg reg = {};
+	int fd;
+
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+	p.cq_entries = URING_ENTRIES * 4;
+
+	fd = (int)syscall( __NR_io_uring_setup, URING_ENTRIES, &p );
+
+	if( fd < 0 ){
+		ShowWarning( "uring_init: io_uring_setup() failed (%s), falling back to epoll.\n", error_msg() );
+		return false;
+	}
+
+	uring.fd = fd;
+
+	if( !( p.features & IORING_FEAT_SINGLE_MMAP ) || !( p.features & IORING_FEAT_NODROP ) || !( p.features & IORING_FEAT_EXT_ARG ) ){
+		ShowWarning( "uring_init: io_uring of the kernel lacks required features, falling back to epoll.\n" );
+		uring_final();
+		return false;
+	}
+
+	uring.ring_len = std::max( p.sq_off.array + p.sq_entries * sizeof( unsigned ), p.cq_off.cqes + p.cq_entries * sizeof( struct io_uring_cqe ) );
+	uring.ring_ptr = mmap( nullptr, uring.ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+	uring.sqes_len = p.sq_entries * sizeof( struct io_uring_sqe );
+	uring.sqes = (struct io_uring_sqe*)mmap( nullptr, uring.sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES );
+
+	if( uring.ring_ptr == MAP_FAILED || uring.sqes == MAP_FAILED ){
+		ShowWarning( "uring_init: Failed to map the io_uring queues (%s), falling back to epoll.\n", error_msg() );
+		uring_final();
+		return false;
+	}
+
+	uint8* ring = (uint8*)uring.ring_ptr;
+
+	uring.sq_head = (unsigned*)( ring + p.sq_off.head );
+	uring.sq_tail = (unsigned*)( ring + p.sq_off.tail );
+	uring.sq_mask = (unsigned*)( ring + p.sq_off.ring_mask );
+	uring.sq_array = (unsigned*)( ring + p.sq_off.array );
+	uring.sq_entries = p.sq_entries;
+	uring.sq_local_tail = *uring.sq_tail;
+	uring.cq_head = (unsigned*)( ring + p.cq_off.head );
+	uring.cq_tail = (unsigned*)( ring + p.cq_off.tail );
+	uring.cq_mask = (unsigned*)( ring + p.cq_off.ring_mask );
+	uring.cqes = (struct io_uring_cqe*)( ring + p.cq_off.cqes );
+
+	// Provided buffers for the multishot receives
+	uring.buf_ring_len = URING_BUF_COUNT * sizeof( struct io_uring_buf );
+	uring.buf_ring = (struct io_uring_buf*)mmap( nullptr, uring.buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+	if( uring.buf_ring == MAP_FAILED ){
+		uring.buf_ring = nullptr;
+		ShowWarning( "uring_init: Failed to allocate the receive buffer ring (%s), falling back to epoll.\n", error_msg() );
+		uring_final();
+		return false;
+	}
+
+	reg.ring_addr = (uint64)uring.buf_ring;
+	reg.ring_entries = URING_BUF_COUNT;
+	reg.bgid = URING_BUF_GROUP;
+
+	if( syscall( __NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1 ) < 0 ){
+		ShowWarning( "uring_init: Failed to register the receive buffers (%s), falling back to epoll.\n", error_msg() );
+		uring_final();
+		return false;
+	}
+
+	uring.bufs = (uint8*)aMalloc( (size_t)URING_BUF_COUNT * URING_BUF_SIZE );
+	uring.buf_tail = 0;
+
+	for( uint16 bid = 0; bid < URING_BUF_COUNT; bid++ ){
+		uring_recycle_buffer( bid );
+	}
+
+	if( !uring_probe_ops() || !uring_probe_multishot() ){
+		ShowWarning( "uring_init: io_uring of the kernel does not support the used requests (multishot receives need Linux 6.0 or newer), falling back to epoll.\n" );
+		uring_final();
+		return false;
+	}
+
+	return true;
+}
+
+static void uring_final( void ){
+	if( uring.sq_tail != nullptr ){
+		// The sends completed during their submission, collect what is left
+		uring_submit();
+		uring_reap();
+	}
+
+	for( auto& orphan : uring_orphans ){
+		uring_send_free( orphan.second );
+	}
+	uring_orphans.clear();
+
+	if( uring.bufs != nullptr ){
+		aFree( uring.bufs );
+		uring.bufs = nullptr;
+	}
+
+	if( uring.buf_ring != nullptr ){
+		munmap( uring.buf_ring, uring.buf_ring_len );
+		uring.buf_ring = nullptr;
+	}
+
+	if( uring.sqes != nullptr && uring.sqes != MAP_FAILED ){
+		munmap( uring.sqes, uring.sqes_len );
+	}
+	uring.sqes = nullptr;
+
+	if( uring.ring_ptr != nullptr && uring.ring_ptr != MAP_FAILED ){
+		munmap( uring.ring_ptr, uring.ring_len );
+	}
+	uring.ring_ptr = nullptr;
+
+	if( uring.fd > 0 ){
+		sClose( uring.fd );
+	}
+	uring.fd = -1;
+
+	uring_active = false;
+}
+#endif
+
+int recv_to_fifo(int fd)
+{
+	int len;
+
+	if( !session_isActive(fd) )
+		return -1;
+
+	len = sRecv(fd, (char *) session[fd]->rdata + session[fd]->rdata_size, (int)RFIFOSPACE(fd), 0);
+
+	if( len == SOCKET_ERROR )
+	{//An exception has occured
+		if( sErrno != S_EWOULDBLOCK ) {
+			//ShowDebug("recv_to_fifo: %s, closing connection #%d\n", error_msg(), fd);
+			set_eof(fd);
+		}
+		return 0;
+	}
+
+	if( len == 0 )
+	{//Normal connection end.
+		set_eof(fd);
+		return 0;
+	}
+
+	session[fd]->rdata_size += len;
+	session[fd]->rdata_tick = last_tick;
+#ifdef SHOW_SERVER_STATS
+	socket_data_i += len;
+	socket_data_qi += len;
+	if (!session[fd]->flag.server)
+	{
+		socket_data_ci += len;
+	}
+#endif
+	return 0;
+}
+
+int send_from_fifo(int fd)
+{
+	int len;
+
+	if( !session_isValid(fd) )
+		return -1;
+
+#ifdef SOCKET_IO_URING
+	if( uring_active )
+		return uring_send(fd);
+#endif
+
+	if( !session_wpending(fd) )
+		return 0; // nothing to send
+
+#ifndef WIN32
+	if( shared_size(fd) > 0 )
+	{// shared packets are queued, send them together with the WFIFO data
+		struct iovec iov[SHARED_IOV_MAX];
+		struct msghdr msg = {};
+		size_t total;
+
+		msg.msg_iov = iov;
+		msg.msg_iovlen = shared_gather(fd, iov, SHARED_IOV_MAX, &total);
+		len = (int)sendmsg(fd, &msg, MSG_NOSIGNAL);
+	}
+	else
+#endif
+	len = sSend(fd, (const char *) session[fd]->wdata, (int)session[fd]->wdata_size, MSG_NOSIGNAL);
+
+	if( len == SOCKET_ERROR )
+	{//An exception has occured
+		if( sErrno != S_EWOULDBLOCK ) {
+			//ShowDebug("send_from_fifo: %s, ending connection #%d\n", error_msg(), fd);
+#ifdef SHOW_SERVER_STATS
+			socket_data_qo -= session[fd]->wdata_size;
+#endif
+			session[fd]->wdata_size = 0; //Clear the send queue as we can't send anymore. [Skotlex]
+			shared_clear(fd, false);
+			set_eof(fd);
+		}
+		return 0;
+	}
+
+	if( len > 0 )
+	{
+		// some data could not be transferred?
+		shared_consume(fd, len);
+#ifdef SHOW_SERVER_STATS
+		socket_data_o += len;
+		socket_data_qo -= len;
+		if (!session[fd]->flag.server)
+		{
+			socket_data_co += len;
+		}
+#endif
+	}
+
+	return 0;
+}
+
+/// Best effort - there's no warranty that the data will be sent.
+void flush_fifo(int fd)
+{
+	if(session[fd] != NULL)
+		session[fd]->func_send(fd);
+}
+
+void flush_fifos(void)
+{
+	int i;
+	for(i = 1; i < fd_max; i++)
+		flush_fifo(i);
+}
+
+#ifdef SOCKET_IO_THREADS
+/*======================================
+ *	CORE : Network I/O threads
+ *--------------------------------------
+ * When io_threads is set in packet_athena.conf, client connections are
+ * handed to a pool of I/O threads that do the recv/send syscalls.
+ * Each session exchanges its data with the game thread through two
+ * single-producer/single-consumer rings, so func_parse, RFIFO* and WFIFO*
+ * keep working on session[fd]->rdata/wdata exactly as before.
+ * Server links and listening sockets stay on the game thread.
+ *--------------------------------------*/
+
+/// Maximum number of I/O threads
+#define IO_THREADS_MAX 16
+/// Size of each per-session ring buffer (must be a power of two)
+#define IO_RING_SIZE (64*1024)
+
+/// Number of I/O threads (0 = the game thread does all socket I/O)
+static int io_threads = 0;
+
+/// Single-producer/single-consumer byte ring.
+/// The positions only ever grow, the buffer index is position & (IO_RING_SIZE - 1).
+struct s_io_ring {
+	uint8 data[IO_RING_SIZE];
+	std::atomic<size_t> head; // written by the producer
+	std::atomic<size_t> tail; // written by the consumer
+};
+
+/// Single-producer/single-consumer queue of fixed capacity.
+template <typename T> class spsc_queue {
+private:
+	std::vector<T> items;
+	size_t mask;
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+
+public:
+	spsc_queue( size_t capacity ) : head( 0 ), tail( 0 ){
+		size_t size = 1;
+
+		while( size < capacity ){
+			size <<= 1;
+		}
+
+		this->items.resize( size );
+		this->mask = size - 1;
+	}
+
+	bool push( const T& item ){
+		size_t h = this->head.load( std::memory_order_relaxed );
+
+		if( h - this->tail.load( std::memory_order_acquire ) > this->mask ){
+			return false;
+		}
+
+		this->items[h & this->mask] = item;
+		this->head.store( h + 1, std::memory_order_release );
+		return true;
+	}
+
+	bool pop( T& item ){
+		size_t t = this->tail.load( std::memory_order_relaxed );
+
+		if( t == this->head.load( std::memory_order_acquire ) ){
+			return false;
+		}
+
+		item = this->items[t & this->mask];
+		this->tail.store( t + 1, std::memory_order_release );
+		return true;
+	}
+};
+
+struct s_io_worker;
+
+/// Per-session state shared between the game thread and an I/O thread
+struct s_io_session {
+	int fd;
+	struct s_io_worker* worker;
+	struct s_io_ring in; // I/O thread -> game thread
+	struct s_io_ring out; // game thread -> I/O thread
+	std::atomic<bool> eof; // connection ended or failed (set by the I/O thread)
+	std::atomic<bool> notified; // waiting in the worker's ready queue
+	std::atomic<bool> send_queued; // a send command is pending
+	std::atomic<bool> stalled; // the I/O thread stopped reading because the inbound ring is full
+	bool detached; // the game thread released the session (game thread only)
+};
+
+enum e_io_command : uint8 {
+	IO_CMD_ADD = 0,
+	IO_CMD_SEND,
+	IO_CMD_READ,
+	IO_CMD_CLOSE,
+};
+
+struct s_io_command {
+	enum e_io_command type;
+	struct s_io_session* io;
+};
+
+struct s_io_worker {
+	std::thread thread;
+	int epfd;
+	int wakefd; // eventfd to wake the I/O thread up
+	bool wake; // commands were queued since the last wake up (game thread only)
+	std::atomic<bool> running;
+	std::atomic<bool> failed; // the I/O thread stopped because of an error, its sessions are handled by the game thread
+	spsc_queue<struct s_io_command> commands; // game thread -> I/O thread
+	spsc_queue<struct s_io_session*> ready; // I/O thread -> game thread
+	spsc_queue<struct s_io_session*> closed; // I/O thread -> game thread, sockets that were closed
+
+	s_io_worker() : epfd( -1 ), wakefd( -1 ), wake( false ), running( true ), failed( false ), commands( 4 * MAXCONN ), ready( MAXCONN ), closed( MAXCONN ){}
+};
+
+static struct s_io_worker* io_workers[IO_THREADS_MAX];
+static struct s_io_session* io_sessions[MAXCONN];
+static int io_next_worker = 0;
+static int io_notify_fd = -1; // eventfd in the game thread's epoll set, signaled by the I/O threads
+static std::vector<int> io_pending; // sessions with data left in their inbound ring
+static std::vector<struct s_io_session*> io_closing; // closed sessions waiting for deletion
+static bool io_failed = false; // an I/O thread stopped, the server is shutting down
+
+/// Returns the contiguous readable parts of the ring (consumer side).
+static size_t io_ring_readable( struct s_io_ring* ring, struct iovec iov[2], int* count ){
+	size_t t = ring->tail.load( std::memory_order_relaxed );
+	size_t len = ring->head.load( std::memory_order_acquire ) - t;
+	size_t pos = t & ( IO_RING_SIZE - 1 );
+	size_t first = std::min( len, (size_t)IO_RING_SIZE - pos );
+
+	iov[0].iov_base = ring->data + pos;
+	iov[0].iov_len = first;
+	iov[1].iov_base = ring->data;
+	iov[1].iov_len = len - first;
+	*count = ( len > first ) ? 2 : 1;
+
+	return len;
+}
+
+static void io_ring_consume( struct s_io_ring* ring, size_t len ){
+	ring->tail.store( ring->tail.load( std::memory_order_relaxed ) + len, std::memory_order_release );
+}
+
+/// Returns the contiguous writable parts of the ring (producer side).
+static size_t io_ring_writable( struct s_io_ring* ring, struct iovec iov[2], int* count ){
+	size_t h = ring->head.load( std::memory_order_relaxed );
+	size_t len = IO_RING_SIZE - ( h - ring->tail.load( std::memory_order_acquire ) );
+	size_t pos = h & ( IO_RING_SIZE - 1 );
+	size_t first = std::min( len, (size_t)IO_RING_SIZE - pos );
+
+	iov[0].iov_base = ring->data + pos;
+	iov[0].iov_len = first;
+	iov[1].iov_base = ring->data;
+	iov[1].iov_len = len - first;
+	*count = ( len > first ) ? 2 : 1;
+
+	return len;
+}
+
+static void io_ring_commit( struct s_io_ring* ring, size_t len ){
+	ring->head.store( ring->head.load( std::memory_order_relaxed ) + len, std::memory_order_release );
+}
+
+/// Copies data between a linear buffer and the parts of a ring.
+static void io_ring_copy( struct iovec iov[2], int count, uint8* buf, size_t len, bool to_ring ){
+	for( int i = 0; i < count && len > 0; i++ ){
+		size_t n = std::min( len, iov[i].iov_len );
+
+		if( to_ring ){
+			memcpy( iov[i].iov_base, buf, n );
+		}else{
+			memcpy( buf, iov[i].iov_base, n );
+		}
+
+		buf += n;
+		len -= n;
+	}
+}
+
+/// Copies data into the writable parts of a ring, starting at the given offset.
+static void io_ring_copy_at( struct iovec iov[2], int count, size_t offset, const uint8* buf, size_t len ){
+	for( int i = 0; i < count && len > 0; i++ ){
+		size_t n;
+
+		if( offset >= iov[i].iov_len ){
+			offset -= iov[i].iov_len;
+			continue;
+		}
+
+		n = std::min( len, iov[i].iov_len - offset );
+		memcpy( (uint8*)iov[i].iov_base + offset, buf, n );
+		offset = 0;
+		buf += n;
+		len -= n;
+	}
+}
+
+/// Queues the session in the worker's ready queue, so the game thread picks it up. [I/O thread]
+static bool io_worker_notify( struct s_io_worker* worker, struct s_io_session* io ){
+	if( io->notified.exchange( true ) ){
+		return false; // already queued
+	}
+
+	if( !worker->ready.push( io ) ){
+		// Can not happen, each session is queued at most once
+		io->notified = false;
+		return false;
+	}
+
+	return true;
+}
+
+/// Reads from the socket into the inbound ring until it would block. [I/O thread]
+static bool io_worker_read( struct s_io_worker* worker, struct s_io_session* io ){
+	bool changed = false;
+
+	while( !io->eof ){
+		struct iovec iov[2];
+		int count;
+		ssize_t len;
+
+		if( io_ring_writable( &io->in, iov, &count ) == 0 ){
+			// The game thread has to catch up first, it will request another read
+			io->stalled = true;
+			changed = true;
+			break;
+		}
+
+		len = readv( io->fd, iov, count );
+
+		if( len > 0 ){
+			io_ring_commit( &io->in, len );
+			changed = true;
+		}else if( len == 0 ){
+			// Normal connection end
+			io->eof = true;
+			changed = true;
+		}else if( errno == EINTR ){
+			continue;
+		}else if( errno == EAGAIN || errno == EWOULDBLOCK ){
+			break;
+		}else{
+			io->eof = true;
+			changed = true;
+		}
+	}
+
+	return changed && io_worker_notify( worker, io );
+}
+
+/// Sends the outbound ring until it is empty or the socket would block. [I/O thread]
+static bool io_worker_flush( struct s_io_worker* worker, struct s_io_session* io ){
+	while( !io->eof ){
+		struct iovec iov[2];
+		struct msghdr msg = {};
+		int count;
+		ssize_t len;
+
+		if( io_ring_readable( &io->out, iov, &count ) == 0 ){
+			break;
+		}
+
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+
+		len = sendmsg( io->fd, &msg, MSG_NOSIGNAL );
+
+		if( len > 0 ){
+			io_ring_consume( &io->out, len );
+		}else if( len < 0 && errno == EINTR ){
+			continue;
+		}else if( len < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ){
+			// Continued on EPOLLOUT
+			break;
+		}else{
+			io->eof = true;
+			return io_worker_notify( worker, io );
+		}
+	}
+
+	return false;
+}
+
+/// Executes a command of the game thread. [I/O thread]
+static bool io_worker_command( struct s_io_worker* worker, struct s_io_command* cmd ){
+	struct s_io_session* io = cmd->io;
+
+	switch( cmd->type ){
+		case IO_CMD_ADD: {
+			struct epoll_event ev = {};
+
+			ev.data.ptr = io;
+			ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+
+			if( epoll_ctl( worker->epfd, EPOLL_CTL_ADD, io->fd, &ev ) == SOCKET_ERROR ){
+				io->eof = true;
+				return io_worker_notify( worker, io );
+			}
+			return false;
+		}
+
+		case IO_CMD_SEND:
+			io->send_queued = false;
+			return io_worker_flush( worker, io );
+
+		case IO_CMD_READ:
+			return io_worker_read( worker, io );
+
+		case IO_CMD_CLOSE:
+			// Try to send what's left (although it might not succeed since it's a nonblocking socket)
+			io_worker_flush( worker, io );
+			epoll_ctl( worker->epfd, EPOLL_CTL_DEL, io->fd, nullptr );
+			shutdown( io->fd, SHUT_RDWR );
+			close( io->fd );
+			// Hand the session back to the game thread for deletion, it must not be touched afterwards
+			if( !worker->closed.push( io ) ){
+				ShowError( "io_worker_command: Close queue of the I/O thread is full, leaking connection #%d.\n", io->fd );
+			}
+			return true;
+	}
+
+	return false;
+}
+
+/// Main loop of an I/O thread.
+static void io_worker_main( struct s_io_worker* worker ){
+	struct epoll_event events[256];
+	struct s_io_command cmd;
+	uint64 value;
+
+	while( worker->running ){
+		int ret = epoll_wait( worker->epfd, events, ARRAYLENGTH( events ), -1 );
+		bool notify = false;
+
+		if( ret == SOCKET_ERROR && errno != EINTR ){
+			ShowError( "io_worker_main: epoll_wait() failed, %s! Stopping the I/O thread.\n", error_msg() );
+			// The game thread takes over the sessions and shuts the server down, nothing may be touched afterwards
+			worker->failed = true;
+			value = 1;
+			if( write( io_notify_fd, &value, sizeof( value ) ) < 0 ){
+				ShowError( "io_worker_main: Failed to notify the game thread (%s)\n", error_msg() );
+			}
+			return;
+		}
+
+		for( int i = 0; i < ret; i++ ){
+			struct s_io_session* io = (struct s_io_session*)events[i].data.ptr;
+
+			if( io == nullptr ){
+				// Woken up by the game thread, reset the event
+				while( read( worker->wakefd, &value, sizeof( value ) ) > 0 );
+				continue;
+			}
+
+			if( events[i].events & EPOLLOUT ){
+				notify |= io_worker_flush( worker, io );
+			}
+
+			if( events[i].events & ( EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR ) ){
+				notify |= io_worker_read( worker, io );
+			}
+		}
+
+		while( worker->commands.pop( cmd ) ){
+			notify |= io_worker_command( worker, &cmd );
+		}
+
+		if( notify ){
+			value = 1;
+			if( write( io_notify_fd, &value, sizeof( value ) ) < 0 ){
+				ShowError( "io_worker_main: Failed to notify the game thread (%s)\n", error_msg() );
+			}
+		}
+	}
+
+	// Execute what is left (the sockets closed on shutdown)
+	while( worker->commands.pop( cmd ) ){
+		io_worker_command( worker, &cmd );
+	}
+}
+
+/// Executes a command of a session whose I/O thread stopped. [game thread]
+static void io_command_fallback( struct s_io_session* io, enum e_io_command type ){
+	switch( type ){
+		case IO_CMD_CLOSE:
+			shutdown( io->fd, SHUT_RDWR );
+			close( io->fd );
+			io_closing.push_back( io );
+			break;
+
+		default:
+			// The connection can not be served anymore
+			io->eof = true;
+			io_pending.push_back( io->fd );
+			break;
+	}
+}
+
+/// Queues a command for the I/O thread of the session.
+/// Commands are never dropped, a lost add or close would leave the socket half registered or open.
+static void io_command( struct s_io_session* io, enum e_io_command type ){
+	struct s_io_worker* worker = io->worker;
+	struct s_io_command cmd;
+	uint64 value = 1;
+
+	cmd.type = type;
+	cmd.io = io;
+
+	if( worker->failed ){
+		io_command_fallback( io, type );
+		return;
+	}
+
+	if( !worker->commands.push( cmd ) ){
+		// The I/O thread is behind, wake it up and wait until it made room
+		if( write( worker->wakefd, &value, sizeof( value ) ) < 0 ){
+			ShowError( "io_command: Failed to wake up the I/O thread (%s)\n", error_msg() );
+		}
+
+		while( !worker->commands.push( cmd ) ){
+			if( worker->failed ){
+				io_command_fallback( io, type );
+				return;
+			}
+
+			std::this_thread::yield();
+		}
+	}
+
+	worker->wake = true;
+}
+
+/// Wakes up the I/O threads that have new commands.
+static void io_wake_workers( void ){
+	for( int i = 0; i < io_threads; i++ ){
+		struct s_io_worker* worker = io_workers[i];
+		uint64 value = 1;
+
+		if( !worker->wake ){
+			continue;
+		}
+
+		worker->wake = false;
+
+		if( write( worker->wakefd, &value, sizeof( value ) ) < 0 ){
+			ShowError( "io_wake_workers: Failed to wake up I/O thread %d (%s)\n", i, error_msg() );
+		}
+	}
+}
+
+/// Moves the inbound ring into the RFIFO. (func_recv of sessions handled by an I/O thread)
+static int io_recv_from_ring( int fd ){
+	struct s_io_session* io;
+	struct iovec iov[2];
+	int count;
+	size_t len;
+	bool eof;
+
+	if( !session_isActive( fd ) || ( io = io_sessions[fd] ) == nullptr )
+		return -1;
+
+	// Read the eof state first, everything received before is already in the ring
+	eof = io->eof;
+	len = std::min( io_ring_readable( &io->in, iov, &count ), RFIFOSPACE( fd ) );
+
+	if( len > 0 ){
+		io_ring_copy( iov, count, session[fd]->rdata + session[fd]->rdata_size, len, false );
+		io_ring_consume( &io->in, len );
+
+		session[fd]->rdata_size += len;
+		session[fd]->rdata_tick = last_tick;
+#ifdef SHOW_SERVER_STATS
+		socket_data_i += len;
+		socket_data_qi += len;
+		if (!session[fd]->flag.server)
+		{
+			socket_data_ci += len;
+		}
+#endif
+	}
+
+	if( io->stalled.exchange( false ) ){
+		io_command( io, IO_CMD_READ );
+	}
+
+	if( io_ring_readable( &io->in, iov, &count ) > 0 ){
+		// RFIFO is full, try again after the next parse
+		io_pending.push_back( fd );
+	}else if( eof ){
+		set_eof( fd );
+	}
+
 	return 0;
 }
 
-int send_from_fifo(int fd)
-{
-	int len;
+/// Moves the WFIFO into the outbound ring. (func_send of sessions handled by an I/O thread)
+static int io_send_to_ring( int fd ){
+	struct s_io_session* io;
+	struct iovec iov[2];
+	int count;
+	size_t len;
 
-	if( !session_isValid(fd) )
+	if( !session_isValid( fd ) || ( io = io_sessions[fd] ) == nullptr )
 		return -1;
 
-	if( session[fd]->wdata_size == 0 )
+	if( !session_wpending( fd ) )
 		return 0; // nothing to send
 
-	len = sSend(fd, (const char *) session[fd]->wdata, (int)session[fd]->wdata_size, MSG_NOSIGNAL);
-
-	if( len == SOCKET_ERROR )
-	{//An exception has occured
-		if( sErrno != S_EWOULDBLOCK ) {
-			//ShowDebug("send_from_fifo: %s, ending connection #%d\n", error_msg(), fd);
+	if( io->eof ){
 #ifdef SHOW_SERVER_STATS
-			socket_data_qo -= session[fd]->wdata_size;
+		socket_data_qo -= session[fd]->wdata_size;
 #endif
-			session[fd]->wdata_size = 0; //Clear the send queue as we can't send anymore. [Skotlex]
-			set_eof(fd);
-		}
+		session[fd]->wdata_size = 0; // Clear the send queue as we can't send anymore.
+		shared_clear( fd, false );
+		set_eof( fd );
 		return 0;
 	}
 
-	if( len > 0 )
-	{
-		// some data could not be transferred?
-		// shift unsent data to the beginning of the queue
-		if( (size_t)len < session[fd]->wdata_size )
-			memmove(session[fd]->wdata, session[fd]->wdata + len, session[fd]->wdata_size - len);
+	len = io_ring_writable( &io->out, iov, &count );
+
+	if( shared_size( fd ) > 0 ){
+		// The ring belongs to this session only, so shared packets are copied into it
+		struct iovec src[SHARED_IOV_MAX];
+		size_t total, copied = 0;
+		int n = shared_gather( fd, src, SHARED_IOV_MAX, &total );
+
+		len = std::min( len, total );
+
+		for( int i = 0; i < n && copied < len; i++ ){
+			size_t part = std::min( src[i].iov_len, len - copied );
 
-		session[fd]->wdata_size -= len;
+			io_ring_copy_at( iov, count, copied, (const uint8*)src[i].iov_base, part );
+			copied += part;
+		}
+	}else{
+		len = std::min( len, session[fd]->wdata_size );
+		io_ring_copy( iov, count, session[fd]->wdata, len, true );
+	}
+
+	if( len > 0 ){
+		io_ring_commit( &io->out, len );
+		shared_consume( fd, len );
 #ifdef SHOW_SERVER_STATS
 		socket_data_o += len;
 		socket_data_qo -= len;
@@ -442,24 +2214,224 @@ int send_from_fifo(int fd)
 			socket_data_co += len;
 		}
 #endif
+
+		if( !io->send_queued.exchange( true ) ){
+			io_command( io, IO_CMD_SEND );
+		}
 	}
 
 	return 0;
 }
 
-/// Best effort - there's no warranty that the data will be sent.
-void flush_fifo(int fd)
-{
-	if(session[fd] != NULL)
-		session[fd]->func_send(fd);
+/// Hands a new client connection over to an I/O thread.
+static void io_session_attach( int fd ){
+	struct s_io_session* io = new s_io_session();
+
+	io->fd = fd;
+	io->worker = io_workers[io_next_worker];
+	io->in.head = io->in.tail = 0;
+	io->out.head = io->out.tail = 0;
+	io->eof = false;
+	io->notified = false;
+	io->send_queued = false;
+	io->stalled = false;
+	io->detached = false;
+
+	io_next_worker = ( io_next_worker + 1 ) % io_threads;
+	io_sessions[fd] = io;
+
+	session[fd]->func_recv = io_recv_from_ring;
+	session[fd]->func_send = io_send_to_ring;
+
+	io_command( io, IO_CMD_ADD );
 }
 
-void flush_fifos(void)
-{
-	int i;
-	for(i = 1; i < fd_max; i++)
-		flush_fifo(i);
+/// Releases a session handled by an I/O thread, which shuts down and closes the socket.
+static bool io_session_detach( int fd ){
+	struct s_io_session* io = io_sessions[fd];
+
+	if( io == nullptr ){
+		return false;
+	}
+
+	io->detached = true;
+	io_sessions[fd] = nullptr;
+	io_command( io, IO_CMD_CLOSE );
+	io_wake_workers();
+
+	return true;
+}
+
+/// Picks up the sessions the I/O threads have data or state changes for.
+static void io_dispatch( void ){
+	std::vector<int> pending;
+
+	// Sessions that did not fit into their RFIFO on the previous run
+	pending.swap( io_pending );
+
+	for( int fd : pending ){
+		if( io_sessions[fd] != nullptr && session[fd] != nullptr ){
+			session[fd]->func_recv( fd );
+		}
+	}
+
+	for( int i = 0; i < io_threads; i++ ){
+		struct s_io_session* io;
+
+		if( io_workers[i]->failed ){
+			struct s_io_command cmd;
+
+			if( !io_failed ){
+				// Shut down in order, the game thread handles the remaining sessions of the I/O thread
+				ShowFatalError( "io_dispatch: I/O thread %d stopped, shutting down the server.\n", i );
+				io_failed = true;
+				if( shutdown_callback != NULL )
+					shutdown_callback();
+				else
+					runflag = CORE_ST_STOP;
+			}
+
+			// Commands that were queued before the I/O thread stopped
+			while( io_workers[i]->commands.pop( cmd ) ){
+				io_command_fallback( cmd.io, cmd.type );
+			}
+		}
+
+		// Collect the closed sessions first, any notification they sent before is in the ready queue then
+		while( io_workers[i]->closed.pop( io ) ){
+			io_closing.push_back( io );
+		}
+
+		while( io_workers[i]->ready.pop( io ) ){
+			io->notified = false;
+
+			if( io->detached ){
+				continue;
+			}
+
+			if( session[io->fd] != nullptr ){
+				session[io->fd]->func_recv( io->fd );
+			}
+		}
+	}
+
+	// Delete closed sessions that are not referenced by a ready queue anymore
+	for( auto it = io_closing.begin(); it != io_closing.end(); ){
+		if( !( *it )->notified ){
+			delete *it;
+			it = io_closing.erase( it );
+		}else{
+			it++;
+		}
+	}
+
+	io_wake_workers();
+}
+
+/// Starts the I/O threads.
+static void io_threads_init( void ){
+	struct epoll_event ev = {};
+
+	if( io_threads <= 0 ){
+		io_threads = 0;
+		return;
+	}
+
+	io_notify_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+
+	if( io_notify_fd == SOCKET_ERROR ){
+		ShowError( "io_threads_init: Failed to create the notification event, network I/O stays on the main thread: %s\n", error_msg() );
+		io_threads = 0;
+		return;
+	}
+
+	ev.data.fd = io_notify_fd;
+	ev.events = EPOLLIN;
+
+	if( epoll_ctl( epfd, EPOLL_CTL_ADD, io_notify_fd, &ev ) == SOCKET_ERROR ){
+		ShowError( "io_threads_init: Failed to add the notification event to the epoll event dispatcher, network I/O stays on the main thread: %s\n", error_msg() );
+		sClose( io_notify_fd );
+		io_notify_fd = -1;
+		io_threads = 0;
+		return;
+	}
+
+	for( int i = 0; i < io_threads; i++ ){
+		struct s_io_worker* worker = new s_io_worker();
+
+		worker->epfd = epoll_create1( EPOLL_CLOEXEC );
+		worker->wakefd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+
+		if( worker->epfd == SOCKET_ERROR || worker->wakefd == SOCKET_ERROR ){
+			ShowFatalError( "io_threads_init: Failed to create I/O thread %d: %s\n", i, error_msg() );
+			exit( EXIT_FAILURE );
+		}
+
+		ev.data.ptr = nullptr;
+		ev.events = EPOLLIN;
+
+		if( epoll_ctl( worker->epfd, EPOLL_CTL_ADD, worker->wakefd, &ev ) == SOCKET_ERROR ){
+			ShowFatalError( "io_threads_init: Failed to create I/O thread %d: %s\n", i, error_msg() );
+			exit( EXIT_FAILURE );
+		}
+
+		worker->thread = std::thread( io_worker_main, worker );
+		io_workers[i] = worker;
+	}
+
+	ShowInfo( "Server uses '" CL_WHITE "%d" CL_RESET "' network I/O threads for client connections\n", io_threads );
+}
+
+/// Stops the I/O threads, all sessions have to be closed already.
+static void io_threads_final( void ){
+	for( int i = 0; i < io_threads; i++ ){
+		io_workers[i]->running = false;
+		io_workers[i]->wake = true;
+	}
+
+	io_wake_workers();
+
+	for( int i = 0; i < io_threads; i++ ){
+		struct s_io_worker* worker = io_workers[i];
+		struct s_io_session* io;
+		struct s_io_command cmd;
+
+		worker->thread.join();
+
+		// Left over when the I/O thread stopped because of an error
+		while( worker->commands.pop( cmd ) ){
+			io_command_fallback( cmd.io, cmd.type );
+		}
+
+		while( worker->ready.pop( io ) ){
+			io->notified = false;
+		}
+
+		while( worker->closed.pop( io ) ){
+			io_closing.push_back( io );
+		}
+
+		sClose( worker->epfd );
+		sClose( worker->wakefd );
+		delete worker;
+		io_workers[i] = nullptr;
+	}
+
+	for( struct s_io_session* io : io_closing ){
+		delete io;
+	}
+
+	io_closing.clear();
+	io_pending.clear();
+
+	if( io_notify_fd != -1 ){
+		sClose( io_notify_fd );
+		io_notify_fd = -1;
+	}
+
+	io_threads = 0;
 }
+#endif
 
 /*======================================
  *	CORE : Connection functions
@@ -508,7 +2480,8 @@ int connect_client(int listen_fd)
 	epevent.data.fd = fd;
 	epevent.events = EPOLLIN;
 
-	if( epoll_ctl( epfd, EPOLL_CTL_ADD, fd, &epevent ) == SOCKET_ERROR ){
+	// Client connections handled by an I/O thread are not part of the game thread's event dispatcher
+	if( io_threads == 0 && !uring_active && epoll_ctl( epfd, EPOLL_CTL_ADD, fd, &epevent ) == SOCKET_ERROR ){
 		ShowError( "connect_client: Failed to add to epoll event dispatcher for new socket #%d: %s\n", fd, error_msg() );
 		sClose( fd );
 		return -1;
@@ -520,6 +2493,15 @@ int connect_client(int listen_fd)
 	create_session(fd, recv_to_fifo, send_from_fifo, default_func_parse);
 	session[fd]->client_addr = ntohl(client_address.sin_addr.s_addr);
 
+#ifdef SOCKET_IO_THREADS
+	if( io_threads > 0 )
+		io_session_attach(fd);
+#endif
+#ifdef SOCKET_IO_URING
+	if( uring_active )
+		uring_watch(fd);
+#endif
+
 	return fd;
 }
 
@@ -575,7 +2557,7 @@ int make_listen_bind(uint32 ip, uint16 port)
 	epevent.data.fd = fd;
 	epevent.events = EPOLLIN;
 
-	if( epoll_ctl( epfd, EPOLL_CTL_ADD, fd, &epevent ) == SOCKET_ERROR ){
+	if( !uring_active && epoll_ctl( epfd, EPOLL_CTL_ADD, fd, &epevent ) == SOCKET_ERROR ){
 		ShowError( "make_listen_bind: failed to add listener socket #%d to epoll event dispatcher: %s\n", fd, error_msg() );
 		sClose(fd);
 		exit(EXIT_FAILURE);
@@ -588,6 +2570,11 @@ int make_listen_bind(uint32 ip, uint16 port)
 	session[fd]->client_addr = 0; // just listens
 	session[fd]->rdata_tick = 0; // disable timeouts on this socket
 
+#ifdef SOCKET_IO_URING
+	if( uring_active )
+		uring_watch(fd);
+#endif
+
 	return fd;
 }
 
@@ -701,7 +2688,7 @@ int make_connection(uint32 ip, uint16 port, bool silent,int timeout) {
 	epevent.data.fd = fd;
 	epevent.events = EPOLLIN;
 
-	if( epoll_ctl( epfd, EPOLL_CTL_ADD, fd, &epevent ) == SOCKET_ERROR ){
+	if( !uring_active && epoll_ctl( epfd, EPOLL_CTL_ADD, fd, &epevent ) == SOCKET_ERROR ){
 		ShowError( "make_connection: failed to add socket #%d to epoll event dispatcher: %s\n", fd, error_msg() );
 		sClose(fd);
 		return -1;
@@ -713,14 +2700,19 @@ int make_connection(uint32 ip, uint16 port, bool silent,int timeout) {
 	create_session(fd, recv_to_fifo, send_from_fifo, default_func_parse);
 	session[fd]->client_addr = ntohl(remote_address.sin_addr.s_addr);
 
+#ifdef SOCKET_IO_URING
+	if( uring_active )
+		uring_watch(fd);
+#endif
+
 	return fd;
 }
 
 static int create_session(int fd, RecvFunc func_recv, SendFunc func_send, ParseFunc func_parse)
 {
 	CREATE(session[fd], struct socket_data, 1);
-	CREATE(session[fd]->rdata, unsigned char, RFIFO_SIZE);
-	CREATE(session[fd]->wdata, unsigned char, WFIFO_SIZE);
+	session[fd]->rdata = fifo_alloc(RFIFO_SIZE);
+	session[fd]->wdata = fifo_alloc(WFIFO_SIZE);
 	session[fd]->max_rdata  = RFIFO_SIZE;
 	session[fd]->max_wdata  = WFIFO_SIZE;
 	session[fd]->func_recv  = func_recv;
@@ -734,30 +2726,58 @@ static void delete_session(int fd)
 {
 	if( session_isValid(fd) )
 	{
+		bool wdata_kept = false;
+
+#ifdef SOCKET_IO_URING
+		wdata_kept = uring_send_orphan(fd); // a send in flight keeps its buffers until the completion
+#endif
 #ifdef SHOW_SERVER_STATS
 		socket_data_qi -= session[fd]->rdata_size - session[fd]->rdata_pos;
 		socket_data_qo -= session[fd]->wdata_size;
 #endif
-		aFree(session[fd]->rdata);
-		aFree(session[fd]->wdata);
+		shared_clear(fd, true);
+		fifo_free(session[fd]->rdata, session[fd]->max_rdata);
+		if( !wdata_kept )
+			fifo_free(session[fd]->wdata, session[fd]->max_wdata);
 		aFree(session[fd]->session_data);
 		aFree(session[fd]);
 		session[fd] = NULL;
 	}
 }
 
+/// Moves the WFIFO of a session to a buffer for the new size.
+/// A send in flight keeps the old buffer, the session continues with a copy.
+static uint8* wfifo_resize(int fd, size_t newsize)
+{
+	struct socket_data* s = session[fd];
+
+#ifdef SOCKET_IO_URING
+	// Same check as fifo_resize, whether the buffer is moved
+	bool moved = !( fifo_capacity(s->max_wdata) == fifo_capacity(newsize) && fifo_class(s->max_wdata) <= FIFO_CLASS_MAX );
+
+	if( moved && uring_send_keep_wdata(fd) ) {
+		uint8* buf = fifo_alloc(newsize);
+
+		memcpy(buf, s->wdata, s->wdata_size);
+		return buf;
+	}
+#endif
+
+	return fifo_resize(s->wdata, s->max_wdata, s->wdata_size, newsize);
+}
+
 int realloc_fifo(int fd, unsigned int rfifo_size, unsigned int wfifo_size)
 {
 	if( !session_isValid(fd) )
 		return 0;
 
 	if( session[fd]->max_rdata != rfifo_size && session[fd]->rdata_size < rfifo_size) {
-		RECREATE(session[fd]->rdata, unsigned char, rfifo_size);
+		session[fd]->rdata = fifo_resize(session[fd]->rdata, session[fd]->max_rdata, session[fd]->rdata_size, rfifo_size);
 		session[fd]->max_rdata  = rfifo_size;
 	}
 
 	if( session[fd]->max_wdata != wfifo_size && session[fd]->wdata_size < wfifo_size) {
-		RECREATE(session[fd]->wdata, unsigned char, wfifo_size);
+		session[fd]->wdata = wfifo_resize(fd, wfifo_size);
 		session[fd]->max_wdata  = wfifo_size;
 	}
 	return 0;
@@ -771,9 +2791,8 @@ int realloc_writefifo(int fd, size_t addition)
 		return 0;
 
 	if( session[fd]->wdata_size + addition  > session[fd]->max_wdata )
-	{	// grow rule; grow in multiples of WFIFO_SIZE
-		newsize = WFIFO_SIZE;
-		while( session[fd]->wdata_size + addition > newsize ) newsize += WFIFO_SIZE;
+	{	// grow rule; grow to the size class that fits, the whole buffer of the class is used
+		newsize = fifo_capacity(session[fd]->wdata_size + addition);
 	}
 	else
 	if( session[fd]->max_wdata >= (size_t)2*(session[fd]->flag.server?FIFOSIZE_SERVERLINK:WFIFO_SIZE)
@@ -784,7 +2803,7 @@ int realloc_writefifo(int fd, size_t addition)
 	else // no change
 		return 0;
 
-	RECREATE(session[fd]->wdata, unsigned char, newsize);
+	session[fd]->wdata = wfifo_resize(fd, newsize);
 	session[fd]->max_wdata  = newsize;
 
 	return 0;
@@ -805,6 +2824,9 @@ int RFIFOSKIP(int fd, size_t len)
 		len = RFIFOREST(fd);
 	}
 
+	if( packet_stats != nullptr && len >= 2 )
+		packet_stats_add( fd, PACKET_STATS_RECV, RFIFOW(fd,0), len );
+
 	s->rdata_pos = s->rdata_pos + len;
 #ifdef SHOW_SERVER_STATS
 	socket_data_qi -= len;
@@ -854,13 +2876,16 @@ int WFIFOSET(int fd, size_t len)
 			return 0;
 		}
 
-		if( s->wdata_size+len > WFIFO_MAX ) {// reached maximum write fifo size
+		if( s->wdata_size+shared_size(fd)+len > WFIFO_MAX ) {// reached maximum write fifo size
 			ShowError("WFIFOSET: Maximum write buffer size for client connection %d exceeded, most likely caused by packet 0x%04x (len=%" PRIuPTR ", ip=%lu.%lu.%lu.%lu).\n", fd, WFIFOW(fd,0), len, CONVIP(s->client_addr));
 			set_eof(fd);
 			return 0;
 		}
 
 	}
+	if( packet_stats != nullptr )
+		packet_stats_add( fd, PACKET_STATS_SEND, WFIFOW(fd,0), len );
+
 	s->wdata_size += len;
 #ifdef SHOW_SERVER_STATS
 	socket_data_qo += len;
@@ -883,6 +2908,58 @@ int WFIFOSET(int fd, size_t len)
 	return 0;
 }
 
+/// Queues a shared packet for sending, the packet is referenced until it was sent.
+/// Small packets and packets for server connections are copied into the WFIFO instead.
+int WFIFOSHARE(int fd, struct s_shared_packet* packet)
+{
+	struct socket_data* s;
+	struct s_shared_entry entry;
+
+	if( !session_isValid(fd) || packet == NULL )
+		return 0;
+
+	s = session[fd];
+
+#ifndef WIN32
+	if( packet->len >= SHARED_PACKET_MIN && !s->flag.server )
+	{
+		if( packet->len > socket_max_client_packet ) {// see declaration of socket_max_client_packet for details
+			ShowError("WFIFOSHARE: Dropped too large client packet 0x%04x (length=%" PRIuPTR ", max=%" PRIuPTR ").\n", WBUFW(packet->data,0), packet->len, socket_max_client_packet);
+			return 0;
+		}
+
+		if( s->wdata_size+shared_size(fd)+packet->len > WFIFO_MAX ) {// reached maximum write fifo size
+			ShowError("WFIFOSHARE: Maximum write buffer size for client connection %d exceeded, most likely caused by packet 0x%04x (len=%" PRIuPTR ", ip=%lu.%lu.%lu.%lu).\n", fd, WBUFW(packet->data,0), packet->len, CONVIP(s->client_addr));
+			set_eof(fd);
+			return 0;
+		}
+
+		if( s->wshared == NULL )
+			s->wshared = new s_shared_queue();
+
+		entry.offset = s->wdata_size;
+		entry.packet = packet;
+		packet->refcount++;
+		s->wshared->entries.push_back(entry);
+		s->wshared->size += packet->len;
+		if( packet_stats != nullptr )
+			packet_stats_add( fd, PACKET_STATS_SEND, WBUFW(packet->data,0), packet->len );
+#ifdef SHOW_SERVER_STATS
+		socket_data_qo += packet->len;
+#endif
+
+#ifdef SEND_SHORTLIST
+		send_shortlist_add_fd(fd);
+#endif
+		return 0;
+	}
+#endif
+
+	WFIFOHEAD(fd, packet->len);
+	memcpy(WFIFOP(fd,0), packet->data, packet->len);
+	return WFIFOSET(fd, packet->len);
+}
+
 int do_sockets(t_tick next)
 {
 #ifndef SOCKET_EPOLL
@@ -901,7 +2978,7 @@ int do_sockets(t_tick next)
 		if(!session[i])
 			continue;
 
-		if(session[i]->wdata_size)
+		if(session_wpending(i))
 			session[i]->func_send(i);
 	}
 #endif
@@ -928,11 +3005,16 @@ int do_sockets(t_tick next)
 #else
 	// Epoll based Event Dispatcher
 
+#ifdef SOCKET_IO_URING
+	if( uring_active )
+		ret = uring_wait( next );
+	else
+#endif
 	ret = epoll_wait( epfd, epevents, epoll_maxevents, next );
 
 	if( ret == SOCKET_ERROR ){
 		if( sErrno != S_EINTR ){
-			ShowFatalError( "do_sockets: epoll_wait() failed, %s!\n", error_msg() );
+			ShowFatalError( "do_sockets: %s() failed, %s!\n", uring_active ? "io_uring_enter" : "epoll_wait", error_msg() );
 			exit( EXIT_FAILURE );
 		}
 
@@ -951,6 +3033,14 @@ int do_sockets(t_tick next)
 			session[fd]->func_recv(fd);
 	}
 #elif defined(SOCKET_EPOLL)
+#ifdef SOCKET_IO_URING
+	// io_uring based selection
+	if( uring_active ){
+		uring_dispatch();
+		ret = 0;
+	}
+#endif
+
 	// epoll based selection
 
 	for( i = 0; i < ret; i++ ){
@@ -958,6 +3048,15 @@ int do_sockets(t_tick next)
 		int fd = it->data.fd;
 		struct socket_data *sock = session[fd];
 
+#ifdef SOCKET_IO_THREADS
+		if( fd == io_notify_fd ){
+			// I/O threads have data for us, reset the event and collect it below
+			uint64 value;
+			while( read( io_notify_fd, &value, sizeof( value ) ) > 0 );
+			continue;
+		}
+#endif
+
 		if( !sock ){
 			continue;
 		}
@@ -982,6 +3081,12 @@ int do_sockets(t_tick next)
 	}
 #endif
 
+#ifdef SOCKET_IO_THREADS
+	// collect data received by the I/O threads
+	if( io_threads > 0 )
+		io_dispatch();
+#endif
+
 	// POSTSEND Send remaining data and handle eof sessions.
 #ifdef SEND_SHORTLIST
 	send_shortlist_do_sends();
@@ -991,7 +3096,7 @@ int do_sockets(t_tick next)
 		if(!session[i])
 			continue;
 
-		if(session[i]->wdata_size)
+		if(session_wpending(i))
 			session[i]->func_send(i);
 
 		if(session[i]->flag.eof) //func_send can't free a session, this is safe.
@@ -1341,6 +3446,14 @@ int socket_config_read(const char* cfgName)
 			ddos_autoreset = atoi(w2);
 		else if (!strcmpi(w1,"debug"))
 			access_debug = config_switch(w2);
+		else if (!strcmpi(w1, "packet_stats"))
+			packet_stats_enabled = config_switch(w2) != 0;
+		else if (!strcmpi(w1, "packet_stats_interval")) {
+			packet_stats_interval = atoi(w2);
+			if( packet_stats_interval < 0 )
+				packet_stats_interval = 0;
+		} else if (!strcmpi(w1, "packet_stats_file"))
+			safestrncpy(packet_stats_file, w2, sizeof(packet_stats_file));
 #ifdef SOCKET_EPOLL
 		else if( !strcmpi( w1, "epoll_maxevents" ) ){
 			epoll_maxevents = atoi(w2);
@@ -1351,6 +3464,21 @@ int socket_config_read(const char* cfgName)
 				epoll_maxevents = 16;
 			}
 		}
+#ifdef SOCKET_IO_URING
+		else if( !strcmpi( w1, "io_uring" ) ){
+			uring_enabled = config_switch(w2) != 0;
+		}
+#endif
+		else if( !strcmpi( w1, "io_threads" ) ){
+			io_threads = atoi(w2);
+
+			if( io_threads < 0 ){
+				io_threads = 0;
+			}else if( io_threads > IO_THREADS_MAX ){
+				ShowWarning( "socket_config_read: io_threads is set too high. Defaulting to %d...\n", IO_THREADS_MAX );
+				io_threads = IO_THREADS_MAX;
+			}
+		}
 #endif
 #endif
 		else if (!strcmpi(w1, "import"))
@@ -1364,6 +3492,137 @@ int socket_config_read(const char* cfgName)
 }
 
 
+/// Displays the fifo pool usage and the sessions with the largest send queues.
+void socket_report( void ){
+	static const int top_count = 10;
+	int top[top_count];
+	int top_num = 0, sessions = 0;
+	size_t queued = 0, reserved = 0;
+
+	for( int c = FIFO_CLASS_MIN; c <= FIFO_CLASS_MAX; c++ ){
+		struct s_fifo_pool* pool = &fifo_pools[c - FIFO_CLASS_MIN];
+
+		if( pool->used == 0 && pool->unused == 0 )
+			continue;
+
+		ShowMessage(CL_BOLD "[FIFO pool of size '" CL_NORMAL CL_WHITE "%u KB" CL_NORMAL CL_BOLD "' report]\n" CL_NORMAL, 1u << ( c - 10 ));
+		ShowMessage("\tbuffers in use     : %u/%u\n", pool->used, pool->used + pool->unused);
+		ShowMessage("\tmemory in use      : %.2f MB\n", (double)( (size_t)pool->used << c ) / 1024 / 1024);
+		ShowMessage("\tmemory allocated   : %.2f MB\n", (double)( (size_t)( pool->used + pool->unused ) << c ) / 1024 / 1024);
+	}
+
+	if( fifo_direct_used > 0 )
+		ShowMessage("\tunpooled buffers   : %.2f MB\n", (double)fifo_direct_used / 1024 / 1024);
+
+	for( int fd = 1; fd < fd_max; fd++ ){
+		int i;
+
+		if( !session_isValid( fd ) )
+			continue;
+
+		sessions++;
+		queued += session[fd]->wdata_size + shared_size( fd );
+		reserved += fifo_capacity( session[fd]->max_rdata ) + fifo_capacity( session[fd]->max_wdata );
+
+		// keep the sessions with the largest send queues, sorted descending
+		for( i = top_num; i > 0 && session[top[i - 1]]->wdata_size + shared_size( top[i - 1] ) < session[fd]->wdata_size + shared_size( fd ); i-- ){
+			if( i < top_count )
+				top[i] = top[i - 1];
+		}
+
+		if( i < top_count ){
+			top[i] = fd;
+
+			if( top_num < top_count )
+				top_num++;
+		}
+	}
+
+	ShowInfo("socket_report: '" CL_WHITE "%d" CL_NORMAL "' sessions, '" CL_WHITE "%.2f MB" CL_NORMAL "' reserved for their fifos\n", sessions, (double)reserved / 1024 / 1024);
+	ShowInfo("socket_report: '" CL_WHITE "%.2f KB" CL_NORMAL "' waiting to be sent\n", (double)queued / 1024);
+
+	for( int i = 0; i < top_num && session[top[i]]->wdata_size + shared_size( top[i] ) > 0; i++ ){
+		int fd = top[i];
+		uint32 ip = session[fd]->client_addr;
+
+		ShowInfo("socket_report: Connection #%d (%d.%d.%d.%d%s) has %" PRIuPTR " bytes queued (%" PRIuPTR " shared), fifo size %" PRIuPTR "\n",
+			fd, CONVIP( ip ), session[fd]->flag.server ? ", server" : "", session[fd]->wdata_size + shared_size( fd ), shared_size( fd ), session[fd]->max_wdata);
+	}
+}
+
+/// Displays the packets with the most traffic per direction and the sessions with the most traffic.
+void packet_report( void ){
+	static const int top_count = 10;
+	static const char* dir_names[PACKET_STATS_MAX] = { "received", "sent" };
+	std::vector<int> top;
+	time_t elapsed;
+
+	if( packet_stats == nullptr ){
+		ShowInfo("packet_report: Packet statistics are disabled, enable them with 'packet_stats' in 'conf/packet_athena.conf'.\n");
+		return;
+	}
+
+	elapsed = std::max<time_t>( time( nullptr ) - packet_stats_start, 1 );
+
+	for( int dir = PACKET_STATS_RECV; dir < PACKET_STATS_MAX; dir++ ){
+		struct s_packet_stats* table = &packet_stats[dir * 0x10000];
+		struct s_packet_stats total = {};
+
+		top.clear();
+
+		for( int cmd = 0; cmd < 0x10000; cmd++ ){
+			if( table[cmd].count == 0 )
+				continue;
+
+			total.count += table[cmd].count;
+			total.bytes += table[cmd].bytes;
+			top.push_back( cmd );
+		}
+
+		size_t top_num = std::min<size_t>( top.size(), top_count );
+
+		std::partial_sort( top.begin(), top.begin() + top_num, top.end(), [table]( int a, int b ){
+			return table[a].bytes > table[b].bytes;
+		} );
+
+		ShowInfo("packet_report: '" CL_WHITE "%" PRIu64 CL_NORMAL "' packets %s, '" CL_WHITE "%.2f KB" CL_NORMAL "' (%.2f KB/s)\n",
+			total.count, dir_names[dir], (double)total.bytes / 1024, (double)total.bytes / 1024 / elapsed);
+
+		for( size_t i = 0; i < top_num; i++ ){
+			struct s_packet_stats* entry = &table[top[i]];
+
+			ShowMessage("\tpacket 0x%04x : %10" PRIu64 " packets, %10.2f KB (%5.1f%%)\n", top[i], entry->count, (double)entry->bytes / 1024, 100. * entry->bytes / total.bytes);
+		}
+	}
+
+	// top talkers
+	top.clear();
+
+	for( int fd = 1; fd < fd_max; fd++ ){
+		if( session_isValid( fd ) )
+			top.push_back( fd );
+	}
+
+	auto traffic = []( int fd ){
+		return session[fd]->traffic[PACKET_STATS_RECV].bytes + session[fd]->traffic[PACKET_STATS_SEND].bytes;
+	};
+	size_t top_num = std::min<size_t>( top.size(), top_count );
+
+	std::partial_sort( top.begin(), top.begin() + top_num, top.end(), [&traffic]( int a, int b ){
+		return traffic( a ) > traffic( b );
+	} );
+
+	for( size_t i = 0; i < top_num && traffic( top[i] ) > 0; i++ ){
+		int fd = top[i];
+		uint32 ip = session[fd]->client_addr;
+		struct s_packet_stats* recv = &session[fd]->traffic[PACKET_STATS_RECV];
+		struct s_packet_stats* sent = &session[fd]->traffic[PACKET_STATS_SEND];
+
+		ShowInfo("packet_report: Connection #%d (%d.%d.%d.%d%s) received %" PRIu64 " packets (%.2f KB), sent %" PRIu64 " packets (%.2f KB)\n",
+			fd, CONVIP( ip ), session[fd]->flag.server ? ", server" : "", recv->count, (double)recv->bytes / 1024, sent->count, (double)sent->bytes / 1024);
+	}
+}
+
 void socket_final(void)
 {
 	int i;
@@ -1389,13 +3648,24 @@ void socket_final(void)
 		if(session[i])
 			do_close(i);
 
+#ifdef SOCKET_IO_THREADS
+	io_threads_final();
+#endif
+#ifdef SOCKET_IO_URING
+	if( uring_active )
+		uring_final();
+#endif
+
 	// session[0]
-	aFree(session[0]->rdata);
-	aFree(session[0]->wdata);
+	fifo_free(session[0]->rdata, session[0]->max_rdata);
+	fifo_free(session[0]->wdata, session[0]->max_wdata);
 	aFree(session[0]->session_data);
 	aFree(session[0]);
 	session[0] = NULL;
 
+	fifo_pool_final();
+	packet_stats_final();
+
 #ifdef WIN32
 	// Shut down windows networking
 	if( WSACleanup() != 0 ){
@@ -1422,14 +3692,31 @@ void do_close(int fd)
 
 	flush_fifo(fd); // Try to send what's left (although it might not succeed since it's a nonblocking socket)
 
+#ifdef SOCKET_IO_THREADS
+	// The I/O thread shuts down and closes the socket, after sending what's left
+	if( io_session_detach(fd) ) {
+		if (session[fd]) delete_session(fd);
+		return;
+	}
+#endif
+
 #ifndef SOCKET_EPOLL
 	// Select based Event Dispatcher
 	sFD_CLR(fd, &readfds);// this needs to be done before closing the socket
 #else
+#ifdef SOCKET_IO_URING
+	if( uring_active ) {
+		// io_uring based Event Dispatcher
+		uring_unwatch(fd);
+		uring_submit(); // queued requests refer to the socket by number, they have to reach the kernel before it is closed
+	} else
+#endif
+	{
 	// Epoll based Event Dispatcher
 	epevent.data.fd = fd;
 	epevent.events = EPOLLIN;
 	epoll_ctl( epfd, EPOLL_CTL_DEL, fd, &epevent ); // removing the socket from epoll when it's being closed is not required but recommended
+	}
 #endif
 
 	sShutdown(fd, SHUT_RDWR); // Disallow further reads/writes
@@ -1590,9 +3877,6 @@ void socket_init(void)
 	}
 
 	memset( &epevent, 0x00, sizeof( struct epoll_event ) );
-	epevents = (struct epoll_event *)aCalloc( epoll_maxevents, sizeof( struct epoll_event ) );
-
-	ShowInfo( "Server uses '" CL_WHITE "epoll" CL_RESET "' with up to " CL_WHITE "%d" CL_RESET " events per cycle as event dispatcher\n", epoll_maxevents );
 #endif
 
 #if defined(SEND_SHORTLIST)
@@ -1601,6 +3885,26 @@ void socket_init(void)
 
 	socket_config_read(SOCKET_CONF_FILENAME);
 
+#ifdef SOCKET_EPOLL
+	// Allocate after reading the configuration, which can change the maximum
+	epevents = (struct epoll_event *)aCalloc( epoll_maxevents, sizeof( struct epoll_event ) );
+
+#ifdef SOCKET_IO_URING
+	// io_uring is not used together with I/O threads, they have their own epoll instances
+	if( uring_enabled && io_threads == 0 )
+		uring_active = uring_init();
+
+	if( uring_active )
+		ShowInfo( "Server uses '" CL_WHITE "io_uring" CL_RESET "' with up to " CL_WHITE "%d" CL_RESET " queued requests as event dispatcher\n", URING_ENTRIES );
+	else
+#endif
+	ShowInfo( "Server uses '" CL_WHITE "epoll" CL_RESET "' with up to " CL_WHITE "%d" CL_RESET " events per cycle as event dispatcher\n", epoll_maxevents );
+#endif
+
+#ifdef SOCKET_IO_THREADS
+	io_threads_init();
+#endif
+
 	// initialise last send-receive tick
 	last_tick = time(NULL);
 
@@ -1608,6 +3912,8 @@ void socket_init(void)
 	// should hold enough buffer (it is a vacuum so to speak) as it is never flushed. [Skotlex]
 	create_session(0, null_recv, null_send, null_parse); //FIXME this is causing leak
 
+	packet_stats_init();
+
 #ifndef MINICORE
 	// Delete old connection history every 5 minutes
 	memset(connect_history, 0, sizeof(connect_history));
@@ -1719,7 +4025,7 @@ void send_shortlist_do_sends()
 		if( session[fd] )
 		{
 			// Send data
-			if( session[fd]->wdata_size )
+			if( session_wpending(fd) )
 				session[fd]->func_send(fd);
 
 			// If it's been marked as eof, call the parse func on it so that
@@ -1729,7 +4035,7 @@ void send_shortlist_do_sends()
 
 			// If the session still exists, is not eof and has things left to
 			// be sent from it we'll re-add it to the shortlist.
-			if( session[fd] && !session[fd]->flag.eof && session[fd]->wdata_size )
+			if( session[fd] && !session[fd]->flag.eof && session_wpending(fd) )
 				send_shortlist_add_fd(fd);
 		}
 	}
@@ -83,6 +83,12 @@ typedef int (*RecvFunc)(int fd);
 typedef int (*SendFunc)(int fd);
 typedef int (*ParseFunc)(int fd);
 
+/// Packet and byte counters of the packet statistics (see packet_stats in packet_athena.conf)
+struct s_packet_stats {
+	uint64 count;
+	uint64 bytes;
+};
+
 struct socket_data
 {
 	struct {
@@ -103,9 +109,23 @@ struct socket_data
 	SendFunc func_send;
 	ParseFunc func_parse;
 
+	struct s_shared_queue* wshared; // shared packets that are queued in between the WFIFO data (see WFIFOSHARE)
+	struct s_packet_stats traffic[2]; // received and sent packets, only counted when the packet statistics are enabled
+
 	void* session_data; // stores application-specific data related to the session
 };
 
+/// Immutable, reference counted packet buffer.
+/// Used to send the same packet to many sessions without copying it into each WFIFO.
+struct s_shared_packet {
+	int refcount;
+	size_t len;
+	uint8 data[1];
+};
+
+/// Packets smaller than this are copied into the WFIFO, for them the copy is cheaper than an extra iovec
+#define SHARED_PACKET_MIN 64
+
 
 // Data prototype declaration
 
@@ -129,12 +149,17 @@ int make_connection(uint32 ip, uint16 port, bool silent, int timeout);
 int realloc_fifo(int fd, unsigned int rfifo_size, unsigned int wfifo_size);
 int realloc_writefifo(int fd, size_t addition);
 int WFIFOSET(int fd, size_t len);
+int WFIFOSHARE(int fd, struct s_shared_packet* packet);
+struct s_shared_packet* shared_packet_create(const uint8* buf, size_t len);
+void shared_packet_release(struct s_shared_packet* packet);
 int RFIFOSKIP(int fd, size_t len);
 
 int do_sockets(t_tick next);
 void do_close(int fd);
 void socket_init(void);
 void socket_final(void);
+void socket_report(void);
+void packet_report(void);
 
 extern void flush_fifo(int fd);
 extern void flush_fifos(void);
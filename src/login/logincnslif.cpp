@@ -10,6 +10,7 @@
 #include "../common/md5calc.hpp"
 #include "../common/mmo.hpp" //cbasetype + NAME_LENGTH
 #include "../common/showmsg.hpp" //show notice
+#include "../common/socket.hpp"
 #include "../common/strlib.hpp"
 #include "../common/timer.hpp"
 
@@ -140,12 +141,16 @@ int cnslif_parse(const char* buf){
 			ShowStatus("Console: Account '%s' created successfully.\n", username);
 		}
 	}
+	else if( strcmpi("packet_report", type) == 0 ){
+		packet_report();
+	}
 	else if( strcmpi("help", type) == 0 ){
 		ShowInfo("Available commands:\n");
 		ShowInfo("\t server:shutdown => Stops the server.\n");
 		ShowInfo("\t server:alive => Checks if the server is running.\n");
 		ShowInfo("\t server:reloadconf => Reload config file: \"%s\"\n", login_config.loginconf_name);
 		ShowInfo("\t create:<username> <password> <sex:M|F> => Creates a new account.\n");
+		ShowInfo("\t packet_report => Displays the traffic per packet type and the connections with the most traffic.\n");
 	}
 	return 1;
 }
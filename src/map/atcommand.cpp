@@ -10056,6 +10056,41 @@ ACMD_FUNC(resurrect) {
 	return 0;
 }
 
+/**
+ * Starts, stops or reports the script profiler
+ * Usage: @scriptprofile <start|stop|report>
+ */
+ACMD_FUNC(scriptprofile) {
+	char action[16];
+
+	memset(action, '\0', sizeof(action));
+
+	if( !message || !*message || sscanf(message, "%15s", action) < 1 ){
+		clif_displaymessage(fd, msg_txt(sd, 1505)); // Usage: @scriptprofile <start|stop|report>
+		return -1;
+	}
+
+	if( strcmpi(action, "start") == 0 ){
+		script_profile_start();
+		clif_displaymessage(fd, msg_txt(sd, 1506)); // Script profiler started.
+	}else if( strcmpi(action, "stop") == 0 ){
+		script_profile_stop();
+		clif_displaymessage(fd, msg_txt(sd, 1507)); // Script profiler stopped.
+	}else if( strcmpi(action, "report") == 0 ){
+		if( !script_profile_report(SCRIPT_PROFILE_FILE) ){
+			clif_displaymessage(fd, msg_txt(sd, 1509)); // Could not write the script profile.
+			return -1;
+		}
+		sprintf(atcmd_output, msg_txt(sd, 1508), SCRIPT_PROFILE_FILE); // Script profile written to '%s'.
+		clif_displaymessage(fd, atcmd_output);
+	}else{
+		clif_displaymessage(fd, msg_txt(sd, 1505)); // Usage: @scriptprofile <start|stop|report>
+		return -1;
+	}
+
+	return 0;
+}
+
 #include "../custom/atcommand.inc"
 
 /**
@@ -10357,6 +10392,7 @@ void atcommand_basecommands(void) {
 		ACMD_DEFR(changedress, ATCMD_NOCONSOLE|ATCMD_NOAUTOTRADE),
 		ACMD_DEFR(camerainfo, ATCMD_NOCONSOLE|ATCMD_NOAUTOTRADE),
 		ACMD_DEFR(resurrect, ATCMD_NOCONSOLE),
+		ACMD_DEF(scriptprofile),
 	};
 	AtCommandInfo* atcommand;
 	int i;
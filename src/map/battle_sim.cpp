@@ -0,0 +1,624 @@
+// Copyright (c) rAthena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#include "battle_sim.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include "../common/malloc.hpp"
+#include "../common/mapindex.hpp"
+#include "../common/nullpo.hpp"
+#include "../common/showmsg.hpp"
+#include "../common/strlib.hpp"
+#include "../common/timer.hpp"
+#include "../common/utils.hpp"
+
+#include "battle.hpp"
+#include "clif.hpp"
+#include "itemdb.hpp"
+#include "map.hpp"
+#include "mob.hpp"
+#include "pc.hpp"
+#include "pc_groups.hpp"
+#include "script.hpp"
+#include "skill.hpp"
+#include "status.hpp"
+#include "unit.hpp"
+
+#define BATTLESIM_HISTOGRAM_BARS 10
+#define BATTLESIM_HISTOGRAM_WIDTH 40
+
+void BattleSimDatabase::clear(){
+	this->cases.clear();
+}
+
+const std::string BattleSimDatabase::getDefaultLocation(){
+	return this->path;
+}
+
+/**
+ * Reads a list of status changes.
+ * @param node: List node
+ * @param buffs: Status changes that are read
+ * @return true on success
+ */
+bool BattleSimDatabase::parseBuffs( const YAML::Node& node, std::vector<s_battlesim_buff>& buffs ){
+	for( const YAML::Node& buffNode : node ){
+		std::string status_name;
+
+		if( !this->asString( buffNode, "Status", status_name ) ){
+			return false;
+		}
+
+		int constant;
+
+		if( !script_get_constant( ( "SC_" + status_name ).c_str(), &constant ) || constant <= SC_NONE || constant >= SC_MAX ){
+			this->invalidWarning( buffNode["Status"], "Status change %s does not exist.\n", status_name.c_str() );
+			return false;
+		}
+
+		s_battlesim_buff buff = {};
+
+		buff.type = static_cast<sc_type>( constant );
+
+		for( size_t i = 0; i < ARRAYLENGTH( buff.val ); i++ ){
+			std::string name = "Value" + std::to_string( i + 1 );
+
+			if( this->nodeExists( buffNode, name ) && !this->asInt32( buffNode, name, buff.val[i] ) ){
+				return false;
+			}
+		}
+
+		buffs.push_back( buff );
+	}
+
+	return true;
+}
+
+uint64 BattleSimDatabase::parseBodyNode( const YAML::Node& node ){
+	if( !this->nodesExist( node, { "Name", "Job", "Target" } ) ){
+		return 0;
+	}
+
+	std::shared_ptr<s_battlesim_case> entry = std::make_shared<s_battlesim_case>();
+
+	if( !this->asString( node, "Name", entry->name ) ){
+		return 0;
+	}
+
+	if( this->nodeExists( node, "Map" ) ){
+		if( !this->asString( node, "Map", entry->map ) ){
+			return 0;
+		}
+	}else{
+		entry->map = MAP_PRONTERA;
+	}
+
+	std::string job_name;
+
+	if( !this->asString( node, "Job", job_name ) ){
+		return 0;
+	}
+
+	int constant;
+
+	if( !script_get_constant( ( "JOB_" + job_name ).c_str(), &constant ) || !pcdb_checkid( constant ) ){
+		this->invalidWarning( node["Job"], "Job %s does not exist.\n", job_name.c_str() );
+		return 0;
+	}
+
+	entry->class_ = static_cast<uint16>( constant );
+
+	if( this->nodeExists( node, "BaseLevel" ) ){
+		if( !this->asUInt32( node, "BaseLevel", entry->base_level ) ){
+			return 0;
+		}
+	}else{
+		entry->base_level = 1;
+	}
+
+	if( this->nodeExists( node, "JobLevel" ) ){
+		if( !this->asUInt32( node, "JobLevel", entry->job_level ) ){
+			return 0;
+		}
+	}else{
+		entry->job_level = 1;
+	}
+
+	const char* stat_names[] = { "Str", "Agi", "Vit", "Int", "Dex", "Luk" };
+
+	for( size_t i = 0; i < ARRAYLENGTH( stat_names ); i++ ){
+		if( this->nodeExists( node, stat_names[i] ) ){
+			if( !this->asUInt16( node, stat_names[i], entry->stats[i] ) ){
+				return 0;
+			}
+		}else{
+			entry->stats[i] = 1;
+		}
+	}
+
+	if( this->nodeExists( node, "Equipment" ) ){
+		for( const YAML::Node& equipNode : node["Equipment"] ){
+			std::string item_name;
+
+			if( !this->asString( equipNode, "Item", item_name ) ){
+				return 0;
+			}
+
+			struct item_data* item = itemdb_search_aegisname( item_name.c_str() );
+
+			if( item == nullptr || !itemdb_isequip2( item ) ){
+				this->invalidWarning( equipNode["Item"], "Equipment %s does not exist.\n", item_name.c_str() );
+				return 0;
+			}
+
+			s_battlesim_equip equip = {};
+
+			equip.nameid = item->nameid;
+
+			if( this->nodeExists( equipNode, "Refine" ) ){
+				uint16 refine;
+
+				if( !this->asUInt16( equipNode, "Refine", refine ) ){
+					return 0;
+				}
+
+				equip.refine = static_cast<uint8>( cap_value( refine, 0, MAX_REFINE ) );
+			}
+
+			if( this->nodeExists( equipNode, "Cards" ) ){
+				int slot = 0;
+
+				for( const YAML::Node& cardNode : equipNode["Cards"] ){
+					std::string card_name = cardNode.as<std::string>();
+					struct item_data* card = itemdb_search_aegisname( card_name.c_str() );
+
+					if( card == nullptr || card->type != IT_CARD ){
+						this->invalidWarning( cardNode, "Card %s does not exist.\n", card_name.c_str() );
+						return 0;
+					}
+
+					if( slot >= MAX_SLOTS ){
+						this->invalidWarning( cardNode, "Equipment %s cannot hold more than %d cards.\n", item_name.c_str(), MAX_SLOTS );
+						return 0;
+					}
+
+					equip.card[slot++] = card->nameid;
+				}
+			}
+
+			entry->equipment.push_back( equip );
+		}
+	}
+
+	if( this->nodeExists( node, "Skills" ) ){
+		for( const YAML::Node& skillNode : node["Skills"] ){
+			std::string skill_name;
+
+			if( !this->asString( skillNode, "Name", skill_name ) ){
+				return 0;
+			}
+
+			struct s_skill skill = {};
+
+			skill.id = skill_name2id( skill_name.c_str() );
+
+			if( skill.id == 0 ){
+				this->invalidWarning( skillNode["Name"], "Skill %s does not exist.\n", skill_name.c_str() );
+				return 0;
+			}
+
+			uint16 skill_lv;
+
+			if( !this->asUInt16( skillNode, "Level", skill_lv ) ){
+				return 0;
+			}
+
+			skill.lv = static_cast<uint8>( cap_value( skill_lv, 1, MAX_SKILL_LEVEL ) );
+			skill.flag = SKILL_FLAG_PERMANENT;
+
+			entry->skills.push_back( skill );
+		}
+	}
+
+	if( this->nodeExists( node, "Buffs" ) && !this->parseBuffs( node["Buffs"], entry->buffs ) ){
+		return 0;
+	}
+
+	std::string mob_name;
+
+	if( !this->asString( node, "Target", mob_name ) ){
+		return 0;
+	}
+
+	struct mob_db* mob = mobdb_search_aegisname( mob_name.c_str() );
+
+	if( mob == nullptr ){
+		this->invalidWarning( node["Target"], "Monster %s does not exist.\n", mob_name.c_str() );
+		return 0;
+	}
+
+	entry->mob_id = mob->vd.class_;
+
+	if( this->nodeExists( node, "TargetBuffs" ) && !this->parseBuffs( node["TargetBuffs"], entry->target_buffs ) ){
+		return 0;
+	}
+
+	if( this->nodeExists( node, "Skill" ) ){
+		std::string skill_name;
+
+		if( !this->asString( node, "Skill", skill_name ) ){
+			return 0;
+		}
+
+		entry->skill_id = skill_name2id( skill_name.c_str() );
+
+		if( entry->skill_id == 0 ){
+			this->invalidWarning( node["Skill"], "Skill %s does not exist.\n", skill_name.c_str() );
+			return 0;
+		}
+
+		if( !( skill_get_type( entry->skill_id )&( BF_WEAPON|BF_MAGIC|BF_MISC ) ) ){
+			this->invalidWarning( node["Skill"], "Skill %s does not cause damage.\n", skill_name.c_str() );
+			return 0;
+		}
+
+		if( this->nodeExists( node, "SkillLevel" ) ){
+			if( !this->asUInt16( node, "SkillLevel", entry->skill_lv ) ){
+				return 0;
+			}
+
+			entry->skill_lv = cap_value( entry->skill_lv, 1, MAX_SKILL_LEVEL );
+		}else{
+			entry->skill_lv = skill_get_max( entry->skill_id );
+		}
+	}else{
+		entry->skill_id = 0;
+		entry->skill_lv = 0;
+	}
+
+	if( this->nodeExists( node, "Iterations" ) ){
+		if( !this->asUInt32( node, "Iterations", entry->iterations ) ){
+			return 0;
+		}
+
+		entry->iterations = umax( entry->iterations, 1 );
+	}else{
+		entry->iterations = 10000;
+	}
+
+	if( this->nodeExists( node, "Golden" ) ){
+		const YAML::Node& goldenNode = node["Golden"];
+
+		if( !this->nodesExist( goldenNode, { "Average" } ) ){
+			return 0;
+		}
+
+		entry->golden = std::unique_ptr<s_battlesim_golden>( new s_battlesim_golden() );
+
+		if( !this->asDouble( goldenNode, "Average", entry->golden->average ) ){
+			return 0;
+		}
+
+		if( this->nodeExists( goldenNode, "Min" ) ){
+			if( !this->asInt64( goldenNode, "Min", entry->golden->min ) ){
+				return 0;
+			}
+		}else{
+			entry->golden->min = 0;
+		}
+
+		if( this->nodeExists( goldenNode, "Max" ) ){
+			if( !this->asInt64( goldenNode, "Max", entry->golden->max ) ){
+				return 0;
+			}
+		}else{
+			entry->golden->max = INT64_MAX;
+		}
+
+		if( this->nodeExists( goldenNode, "Tolerance" ) ){
+			if( !this->asDouble( goldenNode, "Tolerance", entry->golden->tolerance ) ){
+				return 0;
+			}
+		}else{
+			entry->golden->tolerance = 1.;
+		}
+	}
+
+	this->cases.push_back( entry );
+
+	return 1;
+}
+
+/**
+ * Applies the status changes of a case to a unit.
+ * @param bl: Unit that receives the status changes
+ * @param buffs: Status changes
+ */
+static void battlesim_buff( struct block_list* bl, const std::vector<s_battlesim_buff>& buffs ){
+	for( const s_battlesim_buff& buff : buffs ){
+		status_change_start( bl, bl, buff.type, 10000, buff.val[0], buff.val[1], buff.val[2], buff.val[3], INFINITE_TICK, SCSTART_NOAVOID|SCSTART_NOTICKDEF|SCSTART_NORATEDEF|SCSTART_NOICON );
+	}
+}
+
+/**
+ * Creates the character of a case, without a connection to a client or the char-server.
+ * See pc_authok and intif_parse_StorageReceived for the initialization of a character that logs in.
+ * @param entry: Simulation case
+ * @param m: Map of the character
+ * @return Character
+ */
+static struct map_session_data* battlesim_createpc( const s_battlesim_case& entry, int16 m ){
+	struct map_session_data* sd;
+	int i;
+
+	CREATE( sd, struct map_session_data, 1 );
+	pc_setnewpc( sd, START_ACCOUNT_NUM, START_CHAR_NUM, 0, gettick(), SEX_MALE, 0 );
+	pc_group_pc_load( sd );
+
+	safestrncpy( sd->status.name, entry.name.c_str(), NAME_LENGTH );
+	sd->status.class_ = entry.class_;
+	sd->class_ = pc_jobid2mapid( entry.class_ );
+	sd->status.base_level = entry.base_level;
+	sd->status.job_level = entry.job_level;
+	sd->status.str = entry.stats[0];
+	sd->status.agi = entry.stats[1];
+	sd->status.vit = entry.stats[2];
+	sd->status.int_ = entry.stats[3];
+	sd->status.dex = entry.stats[4];
+	sd->status.luk = entry.stats[5];
+	sd->status.hp = sd->status.sp = 1;
+
+	sd->followtimer = INVALID_TIMER;
+	sd->invincible_timer = INVALID_TIMER;
+	sd->npc_timer_id = INVALID_TIMER;
+	sd->pvp_timer = INVALID_TIMER;
+	sd->expiration_tid = INVALID_TIMER;
+	sd->autotrade_tid = INVALID_TIMER;
+	sd->respawn_tid = INVALID_TIMER;
+	sd->rental_timer = INVALID_TIMER;
+	for( i = 0; i < MAX_SPIRITBALL; i++ )
+		sd->spirit_timer[i] = INVALID_TIMER;
+	for( i = 0; i < MAX_EVENTTIMER; i++ )
+		sd->eventtimer[i] = INVALID_TIMER;
+	for( i = 0; i < MAX_PC_FEELHATE; i++ )
+		sd->hate_mob[i] = -1;
+	memset( &sd->equip_index, -1, sizeof( sd->equip_index ) );
+	memset( &sd->equip_switch_index, -1, sizeof( sd->equip_switch_index ) );
+	sd->regs.vars = i64db_alloc( DB_OPT_BASE );
+	sd->last_addeditem_index = -1;
+
+	status_change_init( &sd->bl );
+	unit_dataset( &sd->bl );
+
+	for( const struct s_skill& skill : entry.skills ){
+		uint16 idx = skill_get_index( skill.id );
+
+		if( idx > 0 )
+			sd->status.skill[idx] = skill;
+	}
+
+	// Equip the items in the given order, one-handed weapons and accessories go into the free slot
+	unsigned int used = 0;
+
+	i = 0;
+	for( const s_battlesim_equip& equip : entry.equipment ){
+		struct item_data* id = itemdb_search( equip.nameid );
+		int ep = pc_equippoint_sub( sd, id );
+
+		if( ep == EQP_ARMS && id->equip == EQP_HAND_R )
+			ep = ( used&EQP_HAND_R ) ? EQP_HAND_L : EQP_HAND_R;
+		else if( ep == EQP_ACC )
+			ep = ( used&EQP_ACC_R ) ? EQP_ACC_L : EQP_ACC_R;
+
+		if( ep == 0 || ( ep&used ) ){
+			ShowWarning( "battlesim: '%s' cannot equip %s, the slot is already used.\n", entry.name.c_str(), id->name );
+			continue;
+		}
+
+		struct item* item = &sd->inventory.u.items_inventory[i++];
+
+		item->nameid = equip.nameid;
+		item->amount = 1;
+		item->identify = 1;
+		item->refine = equip.refine;
+		item->equip = ep;
+		memcpy( item->card, equip.card, sizeof( item->card ) );
+		used |= ep;
+	}
+
+	pc_setinventorydata( sd );
+	pc_setequipindex( sd );
+	status_set_viewdata( &sd->bl, sd->status.class_ );
+	pc_load_combo( sd );
+	status_calc_pc( sd, (enum e_status_calc_opt)( SCO_FIRST|SCO_FORCE ) );
+	sd->state.active = 1;
+	sd->state.pc_loaded = true;
+
+	sd->bl.m = m;
+	map_search_freecell( nullptr, m, &sd->bl.x, &sd->bl.y, -1, -1, 1 );
+	map_addiddb( &sd->bl );
+	map_addblock( &sd->bl );
+
+	battlesim_buff( &sd->bl, entry.buffs );
+
+	sd->status.hp = sd->battle_status.hp = sd->base_status.hp = sd->battle_status.max_hp;
+	sd->status.sp = sd->battle_status.sp = sd->base_status.sp = sd->battle_status.max_sp;
+
+	return sd;
+}
+
+/**
+ * Removes the character of a case again.
+ * @param sd: Character
+ */
+static void battlesim_freepc( struct map_session_data* sd ){
+	nullpo_retv( sd );
+
+	unit_free( &sd->bl, CLR_OUTSIGHT );
+	map_deliddb( &sd->bl );
+	if( sd->regs.vars )
+		sd->regs.vars->destroy( sd->regs.vars, script_reg_destroy );
+	aFree( sd );
+}
+
+/**
+ * Runs a case and prints its results.
+ * @param entry: Simulation case
+ * @return false if the golden values of the case did not match
+ */
+static bool battlesim_run( const s_battlesim_case& entry ){
+	int16 m = map_mapname2mapid( entry.map.c_str() );
+
+	if( m < 0 ){
+		ShowError( "battlesim: Map '%s' of case '%s' is not loaded by this map-server.\n", entry.map.c_str(), entry.name.c_str() );
+		return false;
+	}
+
+	struct map_session_data* sd = battlesim_createpc( entry, m );
+	struct mob_data* md = mob_once_spawn_sub( &sd->bl, m, -1, -1, nullptr, entry.mob_id, "", SZ_SMALL, AI_NONE );
+
+	if( md == nullptr ){
+		ShowError( "battlesim: Failed to spawn monster %d for case '%s'.\n", entry.mob_id, entry.name.c_str() );
+		battlesim_freepc( sd );
+		return false;
+	}
+
+	mob_spawn( md );
+	battlesim_buff( &md->bl, entry.target_buffs );
+
+	int attack_type = entry.skill_id ? skill_get_type( entry.skill_id ) : BF_WEAPON;
+	std::vector<int64> damages;
+	uint32 misses = 0, criticals = 0;
+
+	damages.reserve( entry.iterations );
+
+	auto start = std::chrono::steady_clock::now();
+
+	for( uint32 i = 0; i < entry.iterations; i++ ){
+		struct Damage dmg = battle_calc_attack( attack_type, &sd->bl, &md->bl, entry.skill_id, entry.skill_lv, 0 );
+
+		if( dmg.dmg_lv != ATK_DEF ){
+			misses++;
+			continue;
+		}
+
+		if( dmg.type == DMG_CRITICAL || dmg.type == DMG_MULTI_HIT_CRITICAL )
+			criticals++;
+
+		damages.push_back( dmg.damage + dmg.damage2 );
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	unit_free( &md->bl, CLR_OUTSIGHT );
+	battlesim_freepc( sd );
+
+	int64 min_damage = 0, max_damage = 0;
+	double average = 0., deviation = 0.;
+
+	if( !damages.empty() ){
+		auto bounds = std::minmax_element( damages.begin(), damages.end() );
+		double sum = 0., sum_sq = 0.;
+
+		min_damage = *bounds.first;
+		max_damage = *bounds.second;
+
+		for( int64 damage : damages ){
+			sum += (double)damage;
+			sum_sq += (double)damage * damage;
+		}
+
+		average = sum / damages.size();
+		deviation = sum_sq / damages.size() - average * average;
+		deviation = deviation > 0. ? sqrt( deviation ) : 0.;
+	}
+
+	if( entry.skill_id )
+		ShowInfo( "Case '" CL_WHITE "%s" CL_RESET "': %s uses %s Lv %d against %s (%d)\n", entry.name.c_str(), job_name( entry.class_ ),
+			skill_get_desc( entry.skill_id ), entry.skill_lv, mob_db( entry.mob_id )->jname, entry.mob_id );
+	else
+		ShowInfo( "Case '" CL_WHITE "%s" CL_RESET "': %s attacks %s (%d)\n", entry.name.c_str(), job_name( entry.class_ ),
+			mob_db( entry.mob_id )->jname, entry.mob_id );
+	ShowInfo( "  Attacks: %u, Hits: %" PRIuPTR ", Misses: %u (%.2f%%), Criticals: %u (%.2f%%)\n", entry.iterations, damages.size(),
+		misses, misses * 100. / entry.iterations, criticals, criticals * 100. / entry.iterations );
+	ShowInfo( "  Damage: min " CL_WHITE "%" PRId64 CL_RESET ", avg " CL_WHITE "%.2f" CL_RESET ", max " CL_WHITE "%" PRId64 CL_RESET ", stddev %.2f\n",
+		min_damage, average, max_damage, deviation );
+	ShowInfo( "  Speed: %.0f calculations/s (%.3f ms in total)\n", elapsed.count() > 0 ? entry.iterations / elapsed.count() : 0., elapsed.count() * 1000 );
+
+	if( max_damage > min_damage ){
+		uint32 bars[BATTLESIM_HISTOGRAM_BARS] = {};
+		double width = (double)( max_damage - min_damage + 1 ) / BATTLESIM_HISTOGRAM_BARS;
+		uint32 highest = 0;
+
+		for( int64 damage : damages ){
+			int bar = min( (int)( ( damage - min_damage ) / width ), BATTLESIM_HISTOGRAM_BARS - 1 );
+
+			highest = umax( highest, ++bars[bar] );
+		}
+
+		for( int i = 0; i < BATTLESIM_HISTOGRAM_BARS; i++ ){
+			char bar[BATTLESIM_HISTOGRAM_WIDTH + 1];
+			int length = (int)( (uint64)bars[i] * BATTLESIM_HISTOGRAM_WIDTH / highest );
+
+			memset( bar, '#', length );
+			bar[length] = '\0';
+			ShowInfo( "  %10" PRId64 " - %10" PRId64 " | %-*s %u\n", min_damage + (int64)( i * width ), min_damage + (int64)( ( i + 1 ) * width ) - 1,
+				BATTLESIM_HISTOGRAM_WIDTH, bar, bars[i] );
+		}
+	}
+
+	if( entry.golden == nullptr )
+		return true;
+
+	const s_battlesim_golden& golden = *entry.golden;
+	double difference;
+
+	if( golden.average != 0. )
+		difference = fabs( average - golden.average ) * 100. / golden.average;
+	else
+		difference = average != 0. ? 100. : 0.;
+
+	if( min_damage < golden.min || max_damage > golden.max || difference > golden.tolerance ){
+		ShowError( "  Golden values " CL_RED "failed" CL_RESET ": expected min %" PRId64 ", avg %.2f (+-%.2f%%), max %" PRId64 " - average differs by %.2f%%\n",
+			golden.min, golden.average, golden.tolerance, golden.max, difference );
+		return false;
+	}
+
+	ShowStatus( "  Golden values " CL_GREEN "passed" CL_RESET " (average differs by %.2f%%).\n", difference );
+
+	return true;
+}
+
+/**
+ * Runs all cases of a battle simulation file.
+ * Called by the map-server after all databases were loaded, when it was started with --battle-sim.
+ * @param filename: Path of the YAML file with the cases
+ * @return false if the file could not be read or any golden values did not match
+ */
+bool do_battlesim( const char* filename ){
+	BattleSimDatabase db( filename );
+
+	if( !db.load() )
+		return false;
+
+	uint32 failed = 0;
+
+	for( const std::shared_ptr<s_battlesim_case>& entry : db.getCases() ){
+		if( !battlesim_run( *entry ) )
+			failed++;
+	}
+
+	if( failed > 0 ){
+		ShowError( "battlesim: '" CL_WHITE "%u" CL_RESET "' of '" CL_WHITE "%" PRIuPTR CL_RESET "' cases failed.\n", failed, db.getCases().size() );
+		return false;
+	}
+
+	ShowStatus( "battlesim: All '" CL_WHITE "%" PRIuPTR CL_RESET "' cases done.\n", db.getCases().size() );
+
+	return true;
+}
@@ -0,0 +1,86 @@
+// Copyright (c) rAthena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#ifndef BATTLE_SIM_HPP
+#define BATTLE_SIM_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../common/cbasetypes.hpp"
+#include "../common/database.hpp"
+#include "../common/mmo.hpp"
+
+enum sc_type : int16;
+
+/// Offline battle simulator, started with the --battle-sim option of the map-server.
+/// Builds characters from a YAML file, lets them attack monsters of the mob_db and
+/// reports the damage distribution and the calculation speed of the battle formulas.
+
+/// Item equipped by a simulated character
+struct s_battlesim_equip {
+	uint16 nameid;
+	uint8 refine;
+	uint16 card[MAX_SLOTS];
+};
+
+/// Status change applied before the attacks
+struct s_battlesim_buff {
+	enum sc_type type;
+	int val[4];
+};
+
+/// Expected results of a case, to detect changes of the battle formulas
+struct s_battlesim_golden {
+	int64 min; ///< No attack may do less damage
+	int64 max; ///< No attack may do more damage
+	double average; ///< Expected average damage
+	double tolerance; ///< Allowed deviation of the average in percent
+};
+
+struct s_battlesim_case {
+	std::string name;
+	std::string map;
+
+	// Character
+	uint16 class_;
+	uint32 base_level, job_level;
+	uint16 stats[6]; ///< Str, Agi, Vit, Int, Dex, Luk
+	std::vector<s_battlesim_equip> equipment;
+	std::vector<struct s_skill> skills;
+	std::vector<s_battlesim_buff> buffs;
+
+	// Attack
+	uint16 mob_id;
+	std::vector<s_battlesim_buff> target_buffs;
+	uint16 skill_id, skill_lv;
+	uint32 iterations;
+
+	std::unique_ptr<s_battlesim_golden> golden;
+};
+
+class BattleSimDatabase : public YamlDatabase{
+private:
+	std::string path;
+	std::vector<std::shared_ptr<s_battlesim_case>> cases;
+
+	bool parseBuffs( const YAML::Node& node, std::vector<s_battlesim_buff>& buffs );
+
+public:
+	BattleSimDatabase( const std::string& path_ ) : YamlDatabase( "BATTLE_SIM", 1 ), path( path_ ){
+
+	}
+
+	void clear();
+	const std::string getDefaultLocation();
+	uint64 parseBodyNode( const YAML::Node& node );
+
+	const std::vector<std::shared_ptr<s_battlesim_case>>& getCases(){
+		return this->cases;
+	}
+};
+
+bool do_battlesim( const char* filename );
+
+#endif /* BATTLE_SIM_HPP */
@@ -10,6 +10,7 @@
 #include <ctime>
 
 #include "../common/cbasetypes.hpp"
+#include "../common/cli.hpp"
 #include "../common/conf.hpp"
 #include "../common/ers.hpp"
 #include "../common/grfio.hpp"
@@ -68,6 +69,7 @@ struct s_packet_db packet_db[MAX_PACKET_DB + 1];
 int packet_db_ack[MAX_ACK_FUNC + 1];
 unsigned long color_table[COLOR_MAX];
 
+#include "clif_capture.hpp"
 #include "clif_obfuscation.hpp"
 static bool clif_session_isValid(struct map_session_data *sd);
 
@@ -297,6 +299,33 @@ static bool clif_session_isValid(struct map_session_data *sd) {
 	return ( sd != NULL && session_isActive(sd->fd) );
 }
 
+/// Sends a packet of clif_send to one recipient.
+/// Large packets are shared between all recipients, the shared copy is created for the first one.
+static void clif_send_packet(int fd, const uint8* buf, int len, struct s_shared_packet** packet)
+{
+	if( !session_isValid(fd) )
+		return;
+
+	if( WFIFOP(fd,0) == buf ) {
+		ShowError("WARNING: Invalid use of clif_send function\n");
+		ShowError("         Packet x%4x use a WFIFO of a player instead of to use a buffer.\n", WBUFW(buf,0));
+		ShowError("         Please correct your code.\n");
+		// don't send to not move the pointer of the packet for next sessions in the loop
+		return;
+	}
+
+	if( len < SHARED_PACKET_MIN ) {
+		WFIFOHEAD(fd,len);
+		memcpy(WFIFOP(fd,0), buf, len);
+		WFIFOSET(fd,len);
+		return;
+	}
+
+	if( *packet == NULL )
+		*packet = shared_packet_create(buf, len);
+	WFIFOSHARE(fd, *packet);
+}
+
 /*==========================================
  * sub process of clif_send
  * Called from a map_foreachinallarea (grabs all players in specific area and subjects them to this function)
@@ -311,7 +340,8 @@ static int clif_send_sub(struct block_list *bl, va_list ap)
 {
 	struct block_list *src_bl;
 	struct map_session_data *sd;
-	unsigned char *buf;
+	struct s_shared_packet **packet;
+	const uint8 *buf;
 	int len, type, fd;
 
 	nullpo_ret(bl);
@@ -321,8 +351,9 @@ static int clif_send_sub(struct block_list *bl, va_list ap)
 	if (!fd) //Don't send to disconnected clients.
 		return 0;
 
-	buf = va_arg(ap,unsigned char*);
+	buf = va_arg(ap,const uint8*);
 	len = va_arg(ap,int);
+	packet = va_arg(ap,struct s_shared_packet**);
 	nullpo_ret(src_bl = va_arg(ap,struct block_list*));
 	type = va_arg(ap,int);
 
@@ -359,19 +390,7 @@ static int clif_send_sub(struct block_list *bl, va_list ap)
 		!sd->sc.data[SC_INTRAVISION] && battle_check_target(src_bl,&sd->bl,BCT_ENEMY) > 0)
 		return 0;
 
-	WFIFOHEAD(fd, len);
-	if (WFIFOP(fd,0) == buf) {
-		ShowError("WARNING: Invalid use of clif_send function\n");
-		ShowError("         Packet x%4x use a WFIFO of a player instead of to use a buffer.\n", WBUFW(buf,0));
-		ShowError("         Please correct your code.\n");
-		// don't send to not move the pointer of the packet for next sessions in the loop
-		//WFIFOSET(fd,0);//## TODO is this ok?
-		//NO. It is not ok. There is the chance WFIFOSET actually sends the buffer data, and shifts elements around, which will corrupt the buffer.
-		return 0;
-	}
-
-	memcpy(WFIFOP(fd,0), buf, len);
-	WFIFOSET(fd,len);
+	clif_send_packet(fd, buf, len, packet);
 
 	return 0;
 }
@@ -389,6 +408,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 	struct battleground_data *bg = NULL;
 	int x0 = 0, x1 = 0, y0 = 0, y1 = 0, fd;
 	struct s_mapiterator* iter;
+	struct s_shared_packet* packet = NULL;
 
 	if( type != ALL_CLIENT )
 		nullpo_ret(bl);
@@ -400,24 +420,20 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 	case ALL_CLIENT: //All player clients.
 		iter = mapit_getallusers();
 		while( (tsd = (TBL_PC*)mapit_next(iter)) != NULL ){
-			WFIFOHEAD(tsd->fd, len);
-			memcpy(WFIFOP(tsd->fd, 0), buf, len);
-			WFIFOSET(tsd->fd, len);
+			clif_send_packet(tsd->fd, buf, len, &packet);
 		}
 		mapit_free(iter);
 		break;
 
 	case ALL_SAMEMAP: //All players on the same map
-		iter = mapit_getallusers();
-		while( (tsd = (TBL_PC*)mapit_next(iter)) != NULL )
 		{
-			if( bl->m == tsd->bl.m ){
-				WFIFOHEAD(tsd->fd, len);
-				memcpy(WFIFOP(tsd->fd,0), buf, len);
-				WFIFOSET(tsd->fd,len);
-			}
+			struct map_data *mapdata = map_getmapdata(bl->m);
+
+			if( mapdata == NULL )
+				break;
+			for( tsd = mapdata->user_list; tsd != NULL; tsd = tsd->user_next )
+				clif_send_packet(tsd->fd, buf, len, &packet);
 		}
-		mapit_free(iter);
 		break;
 
 	case AREA:
@@ -427,11 +443,11 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 	case AREA_WOC:
 	case AREA_WOS:
 		map_foreachinallarea(clif_send_sub, bl->m, bl->x-AREA_SIZE, bl->y-AREA_SIZE, bl->x+AREA_SIZE, bl->y+AREA_SIZE,
-			BL_PC, buf, len, bl, type);
+			BL_PC, buf, len, &packet, bl, type);
 		break;
 	case AREA_CHAT_WOC:
 		map_foreachinallarea(clif_send_sub, bl->m, bl->x-(AREA_SIZE-5), bl->y-(AREA_SIZE-5),
-			bl->x+(AREA_SIZE-5), bl->y+(AREA_SIZE-5), BL_PC, buf, len, bl, AREA_WOC);
+			bl->x+(AREA_SIZE-5), bl->y+(AREA_SIZE-5), BL_PC, buf, len, &packet, bl, AREA_WOC);
 		break;
 
 	case CHAT:
@@ -449,9 +465,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 				if (type == CHAT_WOS && cd->usersd[i] == sd)
 					continue;
 				if ((fd=cd->usersd[i]->fd) >0 && session[fd]){ // Added check to see if session exists [PoW]
-					WFIFOHEAD(fd,len);
-					memcpy(WFIFOP(fd,0), buf, len);
-					WFIFOSET(fd,len);
+					clif_send_packet(fd, buf, len, &packet);
 				}
 			}
 		}
@@ -487,9 +501,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 				if( (type == PARTY_AREA || type == PARTY_AREA_WOS) && (sd->bl.x < x0 || sd->bl.y < y0 || sd->bl.x > x1 || sd->bl.y > y1) )
 					continue;
 
-				WFIFOHEAD(fd, len);
-				memcpy(WFIFOP(fd, 0), buf, len);
-				WFIFOSET(fd, len);
+				clif_send_packet(fd, buf, len, &packet);
 			}
 			if (!enable_spy) //Skip unnecessary parsing. [Skotlex]
 				break;
@@ -498,9 +510,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 			while( (tsd = (TBL_PC*)mapit_next(iter)) != NULL )
 			{
 				if( tsd->partyspy == p->party.party_id ){
-					WFIFOHEAD(tsd->fd, len);
-					memcpy(WFIFOP(tsd->fd,0), buf, len);
-					WFIFOSET(tsd->fd,len);
+					clif_send_packet(tsd->fd, buf, len, &packet);
 				}
 			}
 			mapit_free(iter);
@@ -517,9 +527,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 			if( type == DUEL_WOS && bl->id == tsd->bl.id )
 				continue;
 			if( sd->duel_group == tsd->duel_group ){
-				WFIFOHEAD(tsd->fd, len);
-				memcpy(WFIFOP(tsd->fd,0), buf, len);
-				WFIFOSET(tsd->fd,len);
+				clif_send_packet(tsd->fd, buf, len, &packet);
 			}
 		}
 		mapit_free(iter);
@@ -567,9 +575,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 					if( (type == GUILD_AREA || type == GUILD_AREA_WOS) && (sd->bl.x < x0 || sd->bl.y < y0 || sd->bl.x > x1 || sd->bl.y > y1) )
 						continue;
 
-					WFIFOHEAD(fd,len);
-					memcpy(WFIFOP(fd,0), buf, len);
-					WFIFOSET(fd,len);
+					clif_send_packet(fd, buf, len, &packet);
 				}
 			}
 			if (!enable_spy) //Skip unnecessary parsing. [Skotlex]
@@ -579,9 +585,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 			while( (tsd = (TBL_PC*)mapit_next(iter)) != NULL )
 			{
 				if( tsd->guildspy == g->guild_id ){
-					WFIFOHEAD(tsd->fd, len);
-					memcpy(WFIFOP(tsd->fd,0), buf, len);
-					WFIFOSET(tsd->fd,len);
+					clif_send_packet(tsd->fd, buf, len, &packet);
 				}
 			}
 			mapit_free(iter);
@@ -610,9 +614,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 					continue;
 				if( (type == BG_AREA || type == BG_AREA_WOS) && (sd->bl.x < x0 || sd->bl.y < y0 || sd->bl.x > x1 || sd->bl.y > y1) )
 					continue;
-				WFIFOHEAD(fd,len);
-				memcpy(WFIFOP(fd,0), buf, len);
-				WFIFOSET(fd,len);
+				clif_send_packet(fd, buf, len, &packet);
 			}
 		}
 		break;
@@ -625,9 +627,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 					continue;
 				}
 
-				WFIFOHEAD(fd,len);
-				memcpy(WFIFOP(fd,0), buf, len);
-				WFIFOSET(fd,len);
+				clif_send_packet(fd, buf, len, &packet);
 			}
 
 			if (!enable_spy) //Skip unnecessary parsing. [Skotlex]
@@ -636,9 +636,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 			iter = mapit_getallusers();
 			while ((tsd = (TBL_PC*)mapit_next(iter)) != NULL){
 				if (tsd->clanspy == clan->id){
-					WFIFOHEAD(tsd->fd, len);
-					memcpy(WFIFOP(tsd->fd, 0), buf, len);
-					WFIFOSET(tsd->fd, len);
+					clif_send_packet(tsd->fd, buf, len, &packet);
 				}
 			}
 			mapit_free(iter);
@@ -647,9 +645,11 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 
 	default:
 		ShowError("clif_send: Unrecognized type %d\n",type);
+		shared_packet_release(packet);
 		return -1;
 	}
 
+	shared_packet_release(packet);
 	return 0;
 }
 
@@ -658,15 +658,16 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 /// 0073 <start time>.L <position>.3B <x size>.B <y size>.B (ZC_ACCEPT_ENTER)
 /// 02eb <start time>.L <position>.3B <x size>.B <y size>.B <font>.W (ZC_ACCEPT_ENTER2)
 /// 0a18 <start time>.L <position>.3B <x size>.B <y size>.B <font>.W <sex>.B (ZC_ACCEPT_ENTER3)
-void clif_authok(struct map_session_data *sd)
-{
 #if PACKETVER < 20080102
-	const int cmd = 0x73;
+static const int clif_authok_cmd = 0x73;
 #elif PACKETVER < 20141022 || PACKETVER >= 20160330
-	const int cmd = 0x2eb;
+static const int clif_authok_cmd = 0x2eb;
 #else
-	const int cmd = 0xa18;
+static const int clif_authok_cmd = 0xa18;
 #endif
+void clif_authok(struct map_session_data *sd)
+{
+	const int cmd = clif_authok_cmd;
 	int fd = sd->fd;
 
 	WFIFOHEAD(fd,packet_len(cmd));
@@ -1417,16 +1418,14 @@ static void clif_weather_check(struct map_session_data *sd)
  **/
 void clif_weather(int16 m)
 {
-	struct s_mapiterator* iter;
-	struct map_session_data *sd=NULL;
+	struct map_data *mapdata = map_getmapdata(m);
+	struct map_session_data *sd;
 
-	iter = mapit_getallusers();
-	for( sd = (struct map_session_data*)mapit_first(iter); mapit_exists(iter); sd = (struct map_session_data*)mapit_next(iter) )
-	{
-		if( sd->bl.m == m )
-			clif_weather_check(sd);
-	}
-	mapit_free(iter);
+	if( mapdata == NULL )
+		return;
+
+	for( sd = mapdata->user_list; sd != NULL; sd = sd->user_next )
+		clif_weather_check(sd);
 }
 /**
  * Main function to spawn a unit on the client (player/mob/pet/etc)
@@ -10365,6 +10364,7 @@ void clif_parse_LoadEndAck(int fd,struct map_session_data *sd)
 
 	if( mapdata->users++ == 0 && battle_config.dynamic_mobs )
 		map_spawnmobs(sd->bl.m);
+	map_addmapuser(sd);
 	if( !pc_isinvisible(sd) ) { // increment the number of pvp players on the map
 		mapdata->users_pvp++;
 	}
@@ -20905,6 +20905,110 @@ void clif_parse_equipswitch_request_single( int fd, struct map_session_data* sd
 #endif
 }
 
+/*==========================================
+ * Client packet capture
+ * Records the decrypted packets of all client sessions, which connect
+ * while the capture is running, for the replay tool (see clif_capture.hpp).
+ *------------------------------------------*/
+static FILE* clif_capture_fp = NULL;
+static t_tick clif_capture_tick;
+static uint32 clif_capture_sessions;
+static uint32 clif_capture_session[MAXCONN]; // capture session id of each connection, 0 if it is not recorded
+
+static void clif_capture_write(int fd, enum e_capture_record type, const void* data, uint16 len)
+{
+	struct s_capture_record record;
+
+	record.session = clif_capture_session[fd];
+	record.time = (uint32)(gettick() - clif_capture_tick);
+	record.type = type;
+	record.len = len;
+
+	fwrite(&record, sizeof(record), 1, clif_capture_fp);
+	if( len > 0 )
+		fwrite(data, len, 1, clif_capture_fp);
+}
+
+/// Records a client packet, the connect packet starts a new session.
+static void clif_capture_packet(int fd, int cmd, int packet_len)
+{
+	if( packet_db[cmd].func == clif_parse_WantToConnection ) {
+		struct s_capture_session positions;
+
+		positions.account_id = packet_db[cmd].pos[0];
+		positions.char_id = packet_db[cmd].pos[1];
+		positions.login_id1 = packet_db[cmd].pos[2];
+		positions.client_tick = packet_db[cmd].pos[3];
+		positions.sex = packet_db[cmd].pos[4];
+
+		clif_capture_session[fd] = ++clif_capture_sessions;
+		clif_capture_write(fd, CAPTURE_SESSION, &positions, sizeof(positions));
+	}
+
+	if( clif_capture_session[fd] != 0 )
+		clif_capture_write(fd, CAPTURE_PACKET, RFIFOP(fd,0), packet_len);
+}
+
+/// Starts recording the sessions of connecting clients to the given file.
+bool clif_capture_start(const char* filename)
+{
+	struct s_capture_header header;
+	int cmd;
+
+	clif_capture_stop();
+
+	if( (clif_capture_fp = fopen(filename, "wb")) == NULL ) {
+		ShowError("clif_capture_start: Could not open '%s' for writing.\n", filename);
+		return false;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+	header.version = CAPTURE_VERSION;
+	header.packetver = PACKETVER;
+#ifdef PACKET_OBFUSCATION
+	header.crypt_key[0] = clif_cryptKey[0];
+	header.crypt_key[1] = clif_cryptKey[1];
+	header.crypt_key[2] = clif_cryptKey[2];
+#endif
+	header.max_packet_db = MAX_PACKET_DB;
+	header.authok_cmd = clif_authok_cmd;
+
+	ARR_FIND(MIN_PACKET_DB, MAX_PACKET_DB + 1, cmd, packet_db[cmd].func == clif_parse_TickSend);
+	if( cmd <= MAX_PACKET_DB ) {
+		header.tick_cmd = cmd;
+		header.tick_len = packet_db[cmd].len;
+		header.tick_pos = packet_db[cmd].pos[0];
+	}
+
+	fwrite(&header, sizeof(header), 1, clif_capture_fp);
+
+	for( cmd = 0; cmd <= MAX_PACKET_DB; cmd++ ) {
+		int16 len = packet_db[cmd].len;
+
+		fwrite(&len, sizeof(len), 1, clif_capture_fp);
+	}
+
+	clif_capture_tick = gettick();
+	clif_capture_sessions = 0;
+	memset(clif_capture_session, 0, sizeof(clif_capture_session));
+
+	ShowStatus("Recording the packets of connecting clients to '" CL_WHITE "%s" CL_RESET "'.\n", filename);
+	return true;
+}
+
+/// Stops the packet capture.
+void clif_capture_stop(void)
+{
+	if( clif_capture_fp == NULL )
+		return;
+
+	fclose(clif_capture_fp);
+	clif_capture_fp = NULL;
+
+	ShowStatus("Stopped the packet capture, '" CL_WHITE "%u" CL_RESET "' sessions were recorded.\n", clif_capture_sessions);
+}
+
 /*==========================================
  * Main client packet processing function
  *------------------------------------------*/
@@ -20945,6 +21049,10 @@ static int clif_parse(int fd)
 		} else {
 			ShowInfo("Closed connection from '" CL_WHITE "%s" CL_RESET "'.\n", ip2str(session[fd]->client_addr, NULL));
 		}
+		if( clif_capture_fp != NULL && clif_capture_session[fd] != 0 ) {
+			clif_capture_write(fd, CAPTURE_CLOSE, NULL, 0);
+			clif_capture_session[fd] = 0;
+		}
 		do_close(fd);
 		return 0;
 	}
@@ -21023,6 +21131,9 @@ static int clif_parse(int fd)
 		sd->cryptKey = ((sd->cryptKey * clif_cryptKey[1]) + clif_cryptKey[2]) & 0xFFFFFFFF; // Update key for the next packet
 #endif
 
+	if( clif_capture_fp != NULL )
+		clif_capture_packet(fd, cmd, packet_len);
+
 	if( packet_db[cmd].func == clif_parse_debug )
 		packet_db[cmd].func(fd, sd);
 	else if( packet_db[cmd].func != NULL ) {
@@ -21115,7 +21226,8 @@ void do_init_clif(void) {
 	packetdb_readdb();
 
 	set_defaultparse(clif_parse);
-	if( make_listen_bind(bind_ip,map_port) == -1 ) {
+	// The battle simulator does not accept clients
+	if( BATTLE_SIM_FILENAME == nullptr && make_listen_bind(bind_ip,map_port) == -1 ) {
 		ShowFatalError("Failed to bind to port '" CL_WHITE "%d" CL_RESET "'\n",map_port);
 		exit(EXIT_FAILURE);
 	}
@@ -21123,10 +21235,14 @@ void do_init_clif(void) {
 	add_timer_func_list(clif_clearunit_delayed_sub, "clif_clearunit_delayed_sub");
 	add_timer_func_list(clif_delayquit, "clif_delayquit");
 
+	if( packet_capture )
+		clif_capture_start(packet_capture_file);
+
 	delay_clearunit_ers = ers_new(sizeof(struct block_list),"clif.cpp::delay_clearunit_ers",ERS_OPT_CLEAR);
 }
 
 void do_final_clif(void) {
+	clif_capture_stop();
 	ers_destroy(delay_clearunit_ers);
 }
 
@@ -916,6 +916,8 @@ void clif_displayexp(struct map_session_data *sd, unsigned int exp, char type, b
 int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target type);
 void do_init_clif(void);
 void do_final_clif(void);
+bool clif_capture_start(const char* filename);
+void clif_capture_stop(void);
 
 // MAIL SYSTEM
 enum mail_send_result : uint8_t {
@@ -0,0 +1,55 @@
+// Copyright (c) rAthena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#ifndef CLIF_CAPTURE_HPP
+#define CLIF_CAPTURE_HPP
+
+#include "../common/cbasetypes.hpp"
+
+/// Client packet capture file, written by the map-server (see packet_capture_file in
+/// map_athena.conf) and read by the replay tool. Values are in host byte order.
+///
+/// Layout:
+///   s_capture_header
+///   int16 packet length for every packet id from 0 to max_packet_db (as in packet_db, -1 = variable)
+///   s_capture_record followed by <len> bytes of data, repeated until the end of the file
+
+#define CAPTURE_MAGIC "RACAPT1"
+#define CAPTURE_VERSION 1
+
+struct s_capture_header {
+	char magic[8];
+	uint32 version;
+	uint32 packetver;
+	uint32 crypt_key[3]; ///< packet id obfuscation keys of the map-server, all zero when disabled
+	uint16 max_packet_db;
+	uint16 tick_cmd; ///< CZ_REQUEST_TIME packet, used as latency probe by the replay tool
+	uint16 tick_len;
+	uint16 tick_pos; ///< position of the client tick in tick_cmd
+	uint16 authok_cmd; ///< packet sent by the map-server when the character was accepted
+	uint16 unused;
+};
+
+enum e_capture_record : uint16 {
+	CAPTURE_SESSION = 0, ///< A client connects, the data are the s_capture_session positions
+	CAPTURE_PACKET, ///< A packet of the client, with the decrypted packet id
+	CAPTURE_CLOSE, ///< The session was closed, no data
+};
+
+struct s_capture_record {
+	uint32 session; ///< Id of the session, unique within the capture
+	uint32 time; ///< Milliseconds since the start of the capture
+	uint16 type; ///< e_capture_record
+	uint16 len; ///< Length of the following data
+};
+
+/// Positions of the fields in the connect packet (CZ_ENTER), which follows as first packet of the session
+struct s_capture_session {
+	uint16 account_id;
+	uint16 char_id;
+	uint16 login_id1;
+	uint16 client_tick;
+	uint16 sex;
+};
+
+#endif /* CLIF_CAPTURE_HPP */
@@ -24,6 +24,7 @@
 #include "achievement.hpp"
 #include "atcommand.hpp"
 #include "battle.hpp"
+#include "battle_sim.hpp"
 #include "battleground.hpp"
 #include "cashshop.hpp"
 #include "channel.hpp"
@@ -47,6 +48,7 @@
 #include "pc.hpp"
 #include "pet.hpp"
 #include "quest.hpp"
+#include "script.hpp"
 #include "storage.hpp"
 #include "trade.hpp"
 
@@ -160,6 +162,8 @@ struct map_cache_map_info {
 };
 
 char motd_txt[256] = "conf/motd.txt";
+bool packet_capture = false;
+char packet_capture_file[256] = "log/packet_capture.bin";
 char help_txt[256] = "conf/help.txt";
 char help2_txt[256] = "conf/help2.txt";
 char charhelp_txt[256] = "conf/charhelp.txt";
@@ -310,6 +314,44 @@ static void map_delblcell(struct block_list *bl)
 }
 #endif
 
+/**
+ * Adds a skill unit to the skill unit index of its cell.
+ * The index is used to look up the skill units of a cell without scanning its block.
+ * @param bl: skill unit that was placed on its cell
+ */
+static void map_addskillcell(struct block_list *bl)
+{
+	if( bl->type != BL_SKILL )
+		return;
+
+	struct map_data *mapdata = map_getmapdata(bl->m);
+
+	mapdata->skill_cells[bl->x + bl->y * mapdata->xs].push_back(bl);
+}
+
+/**
+ * Removes a skill unit from the skill unit index of its cell.
+ * @param bl: skill unit that leaves its cell
+ */
+static void map_delskillcell(struct block_list *bl)
+{
+	if( bl->type != BL_SKILL )
+		return;
+
+	struct map_data *mapdata = map_getmapdata(bl->m);
+	auto cell = mapdata->skill_cells.find(bl->x + bl->y * mapdata->xs);
+
+	if( cell == mapdata->skill_cells.end() )
+		return;
+
+	auto it = std::find(cell->second.begin(), cell->second.end(), bl);
+
+	if( it != cell->second.end() )
+		cell->second.erase(it);
+	if( cell->second.empty() )
+		mapdata->skill_cells.erase(cell);
+}
+
 /*==========================================
  * Adds a block to the map.
  * Returns 0 on success, 1 on failure (illegal coordinates).
@@ -361,6 +403,7 @@ int map_addblock(struct block_list* bl)
 #ifdef CELL_NOSTACK
 	map_addblcell(bl);
 #endif
+	map_addskillcell(bl);
 
 	return 0;
 }
@@ -385,6 +428,7 @@ int map_delblock(struct block_list* bl)
 #ifdef CELL_NOSTACK
 	map_delblcell(bl);
 #endif
+	map_delskillcell(bl);
 
 	struct map_data *mapdata = map_getmapdata(bl->m);
 
@@ -408,6 +452,54 @@ int map_delblock(struct block_list* bl)
 	return 0;
 }
 
+/**
+ * Adds a player to the player list of the map it is on.
+ * The list contains the same players as map_data::users counts, so map-wide
+ * operations on players don't have to check every online character.
+ * @param sd: player that finished loading the map
+ */
+void map_addmapuser(struct map_session_data* sd)
+{
+	nullpo_retv(sd);
+
+	if (sd->user_map != NULL) // still listed on the previous map
+		map_delmapuser(sd);
+
+	struct map_data *mapdata = map_getmapdata(sd->bl.m);
+
+	if (mapdata == NULL)
+		return;
+
+	sd->user_prev = NULL;
+	sd->user_next = mapdata->user_list;
+	if (mapdata->user_list != NULL)
+		mapdata->user_list->user_prev = sd;
+	mapdata->user_list = sd;
+	sd->user_map = mapdata;
+}
+
+/**
+ * Removes a player from the player list of its map.
+ * @param sd: player that leaves the map
+ */
+void map_delmapuser(struct map_session_data* sd)
+{
+	nullpo_retv(sd);
+
+	if (sd->user_map == NULL)
+		return;
+
+	if (sd->user_next != NULL)
+		sd->user_next->user_prev = sd->user_prev;
+	if (sd->user_prev != NULL)
+		sd->user_prev->user_next = sd->user_next;
+	else
+		sd->user_map->user_list = sd->user_next;
+
+	sd->user_prev = sd->user_next = NULL;
+	sd->user_map = NULL;
+}
+
 /**
  * Moves a block a x/y target position. [Skotlex]
  * Pass flag as 1 to prevent doing skill_unit_move checks
@@ -455,18 +547,23 @@ int map_moveblock(struct block_list *bl, int x1, int y1, t_tick tick)
 		npc_unsetcells((TBL_NPC*)bl);
 
 	if (moveblock) map_delblock(bl);
+	else {
 #ifdef CELL_NOSTACK
-	else map_delblcell(bl);
+		map_delblcell(bl);
 #endif
+		map_delskillcell(bl);
+	}
 	bl->x = x1;
 	bl->y = y1;
 	if (moveblock) {
 		if(map_addblock(bl))
 			return 1;
-	}
+	} else {
 #ifdef CELL_NOSTACK
-	else map_addblcell(bl);
+		map_addblcell(bl);
 #endif
+		map_addskillcell(bl);
+	}
 
 	if (bl->type&BL_CHAR) {
 
@@ -582,23 +679,20 @@ int map_count_oncell(int16 m, int16 x, int16 y, int type, int flag)
  * flag&1: runs battle_check_target check based on unit->group->target_flag
  */
 struct skill_unit* map_find_skill_unit_oncell(struct block_list* target,int16 x,int16 y,uint16 skill_id,struct skill_unit* out_unit, int flag) {
-	int16 bx,by;
-	struct block_list *bl;
 	struct skill_unit *unit;
 	struct map_data *mapdata = map_getmapdata(target->m);
 
 	if (x < 0 || y < 0 || (x >= mapdata->xs) || (y >= mapdata->ys))
 		return NULL;
 
-	bx = x/BLOCK_SIZE;
-	by = y/BLOCK_SIZE;
+	auto cell = mapdata->skill_cells.find(x + y * mapdata->xs);
 
-	for( bl = mapdata->block[bx+by*mapdata->bxs] ; bl != NULL ; bl = bl->next )
-	{
-		if (bl->x != x || bl->y != y || bl->type != BL_SKILL)
-			continue;
+	if( cell == mapdata->skill_cells.end() )
+		return NULL;
 
-		unit = (struct skill_unit *) bl;
+	for( auto it = cell->second.rbegin(); it != cell->second.rend(); ++it )
+	{
+		unit = (struct skill_unit *) *it;
 		if( unit == out_unit || !unit->alive || !unit->group || unit->group->skill_id != skill_id )
 			continue;
 		if( !(flag&1) || battle_check_target(&unit->bl,target,unit->group->target_flag) > 0 )
@@ -1122,7 +1216,13 @@ int map_foreachincell(int (*func)(struct block_list*,va_list), int16 m, int16 x,
 	by = y / BLOCK_SIZE;
 	bx = x / BLOCK_SIZE;
 
-	if( type&~BL_MOB )
+	if( type == BL_SKILL ) { // Skill units are indexed by cell
+		auto cell = mapdata->skill_cells.find(x + y * mapdata->xs);
+
+		if( cell != mapdata->skill_cells.end() )
+			for( auto it = cell->second.rbegin(); it != cell->second.rend() && bl_list_count < BL_LIST_MAX; ++it )
+				bl_list[ bl_list_count++ ] = *it;
+	} else if( type&~BL_MOB )
 		for( bl = mapdata->block[ bx + by * mapdata->bxs ]; bl != NULL; bl = bl->next )
 			if( bl->type&type && bl->x == x && bl->y == y && bl_list_count < BL_LIST_MAX )
 				bl_list[ bl_list_count++ ] = bl;
@@ -1517,7 +1617,12 @@ int map_foreachinmap(int (*func)(struct block_list*,va_list), int16 m, int type,
 
 	bsize = mapdata->bxs * mapdata->bys;
 
-	if( type&~BL_MOB )
+	if( type == BL_PC ){
+		// Only players, no need to check every block of the map
+		for( struct map_session_data* sd = mapdata->user_list; sd != NULL && bl_list_count < BL_LIST_MAX; sd = sd->user_next )
+			if( sd->bl.prev != NULL )
+				bl_list[ bl_list_count++ ] = &sd->bl;
+	}else if( type&~BL_MOB )
 		for( b = 0; b < bsize; b++ )
 			for( bl = mapdata->block[ b ]; bl != NULL; bl = bl->next )
 				if( bl->type&type && bl_list_count < BL_LIST_MAX )
@@ -2737,6 +2842,7 @@ int map_addinstancemap(const char *name, unsigned short instance_id)
 	dst_map->instance_id = instance_id;
 	dst_map->instance_src_map = src_m;
 	dst_map->users = 0;
+	dst_map->user_list = NULL;
 	dst_map->xs = src_map->xs;
 	dst_map->ys = src_map->ys;
 	dst_map->bxs = src_map->bxs;
@@ -2845,6 +2951,7 @@ int map_delinstancemap(int m)
 	if (mapdata->block_mob)
 		aFree(mapdata->block_mob);
 	mapdata->block_mob = NULL;
+	mapdata->skill_cells.clear();
 
 	map_free_questinfo(mapdata);
 	mapdata->damage_adjust = {};
@@ -3992,15 +4099,42 @@ int parse_console(const char* buf){
 			runflag = 0;
 		}
 	}
+	else if( n == 2 && strcmpi("capture", type) == 0 ){
+		if( strcmpi("start", command) == 0 )
+			clif_capture_start(packet_capture_file);
+		else if( strcmpi("stop", command) == 0 )
+			clif_capture_stop();
+	}
+	else if( n == 2 && strcmpi("scriptprofile", type) == 0 ){
+		if( strcmpi("start", command) == 0 )
+			script_profile_start();
+		else if( strcmpi("stop", command) == 0 )
+			script_profile_stop();
+		else if( strcmpi("report", command) == 0 )
+			script_profile_report(SCRIPT_PROFILE_FILE);
+	}
 	else if( strcmpi("ers_report", type) == 0 ){
 		ers_report();
 	}
+	else if( strcmpi("socket_report", type) == 0 ){
+		socket_report();
+	}
+	else if( strcmpi("packet_report", type) == 0 ){
+		packet_report();
+	}
 	else if( strcmpi("help", type) == 0 ) {
 		ShowInfo("Available commands:\n");
 		ShowInfo("\t admin:@<atcommand> => Uses an atcommand. Do NOT use commands requiring an attached player.\n");
 		ShowInfo("\t admin:map:<map> <x> <y> => Changes the map from which console commands are executed.\n");
 		ShowInfo("\t server:shutdown => Stops the server.\n");
+		ShowInfo("\t capture:start => Starts recording the packets of connecting clients to \"%s\".\n", packet_capture_file);
+		ShowInfo("\t capture:stop => Stops recording the client packets.\n");
+		ShowInfo("\t scriptprofile:start => Starts measuring the run time of the NPC scripts and buildin functions.\n");
+		ShowInfo("\t scriptprofile:stop => Stops measuring the scripts.\n");
+		ShowInfo("\t scriptprofile:report => Displays the scripts using the most time and writes all to \"%s\".\n", SCRIPT_PROFILE_FILE);
 		ShowInfo("\t ers_report => Displays database usage.\n");
+		ShowInfo("\t socket_report => Displays network buffer usage and the largest send queues.\n");
+		ShowInfo("\t packet_report => Displays the traffic per packet type and the connections with the most traffic.\n");
 	}
 
 	return 0;
@@ -4097,7 +4231,11 @@ int map_config_read(const char *cfgName)
 			console = config_switch(w2);
 			if (console)
 				ShowNotice("Console Commands are enabled.\n");
-		} else if (strcmpi(w1, "enable_spy") == 0)
+		} else if (strcmpi(w1, "packet_capture") == 0)
+			packet_capture = config_switch(w2) != 0;
+		else if (strcmpi(w1, "packet_capture_file") == 0)
+			safestrncpy(packet_capture_file, w2, sizeof(packet_capture_file));
+		else if (strcmpi(w1, "enable_spy") == 0)
 			enable_spy = config_switch(w2);
 		else if (strcmpi(w1, "use_grf") == 0)
 			enable_grf = config_switch(w2);
@@ -5106,6 +5244,7 @@ void display_helpscreen(bool do_exit)
 	ShowInfo("  --grf-path <file>\t\tAlternative GRF path configuration.\n");
 	ShowInfo("  --inter-config <file>\t\tAlternative inter-server configuration.\n");
 	ShowInfo("  --log-config <file>\t\tAlternative logging configuration.\n");
+	ShowInfo("  --battle-sim <file>\t\tRuns the battle simulator with the given cases and exits.\n");
 	if( do_exit )
 		exit(EXIT_SUCCESS);
 }
@@ -5302,9 +5441,12 @@ int do_init(int argc, char *argv[])
 	regen_db = idb_alloc(DB_OPT_BASE); // efficient status_natural_heal processing
 	iwall_db = strdb_alloc(DB_OPT_RELEASE_DATA,2*NAME_LENGTH+2+1); // [Zephyrus] Invisible Walls
 
-	map_sql_init();
-	if (log_config.sql_logs)
-		log_sql_init();
+	// The battle simulator only needs the SQL server when the databases are read from it
+	if (BATTLE_SIM_FILENAME == nullptr || db_use_sqldbs) {
+		map_sql_init();
+		if (log_config.sql_logs)
+			log_sql_init();
+	}
 
 	mapindex_init();
 	if(enable_grf)
@@ -5351,10 +5493,14 @@ int do_init(int argc, char *argv[])
 
 	npc_event_do_oninit();	// Init npcs (OnInit)
 
+	if (BATTLE_SIM_FILENAME != nullptr && !do_battlesim(BATTLE_SIM_FILENAME))
+		exit(EXIT_FAILURE);
+
 	if (battle_config.pk_mode)
 		ShowNotice("Server is running on '" CL_WHITE "PK Mode" CL_RESET "'.\n");
 
-	ShowStatus("Server is '" CL_GREEN "ready" CL_RESET "' and listening on port '" CL_WHITE "%d" CL_RESET "'.\n\n", map_port);
+	if (BATTLE_SIM_FILENAME == nullptr) // The battle simulator does not listen for clients
+		ShowStatus("Server is '" CL_GREEN "ready" CL_RESET "' and listening on port '" CL_WHITE "%d" CL_RESET "'.\n\n", map_port);
 
 	if( runflag != CORE_ST_STOP )
 	{
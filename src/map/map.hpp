@@ -738,7 +738,9 @@ struct map_data {
 	int npc_num_warp; // number of warp npc on the map
 	int users;
 	int users_pvp;
+	struct map_session_data *user_list; // players on the map, see map_addmapuser
 	int iwall_num; // Total of invisible walls in this map
+	std::unordered_map<int32, std::vector<struct block_list*>> skill_cells; // skill units by cell (x + y * xs), see map_addskillcell
 
 	std::unordered_map<int16, int> flag;
 	struct point save;
@@ -969,6 +971,8 @@ inline bool map_flag_gvg2_no_te(int16 m) {
 }
 
 extern char motd_txt[];
+extern bool packet_capture;
+extern char packet_capture_file[];
 extern char help_txt[];
 extern char help2_txt[];
 extern char charhelp_txt[];
@@ -1010,6 +1014,8 @@ int map_freeblock_unlock(void);
 // blocklist manipulation
 int map_addblock(struct block_list* bl);
 int map_delblock(struct block_list* bl);
+void map_addmapuser(struct map_session_data* sd);
+void map_delmapuser(struct map_session_data* sd);
 int map_moveblock(struct block_list *, int, int, t_tick);
 int map_foreachinrange(int (*func)(struct block_list*,va_list), struct block_list* center, int16 range, int type, ...);
 int map_foreachinallrange(int (*func)(struct block_list*,va_list), struct block_list* center, int16 range, int type, ...);
@@ -4,6 +4,7 @@
 #include "mapreg.hpp"
 
 #include <stdlib.h>
+#include <vector>
 
 #include "../common/cbasetypes.hpp"
 #include "../common/db.hpp"
@@ -22,10 +23,16 @@ static struct eri *mapreg_ers;
 bool skip_insert = false;
 
 static char mapreg_table[32] = "mapreg";
-static bool mapreg_dirty = false; // Whether there are modified regs to be saved
+static std::vector<int64> mapreg_queue; // Permanent variables with changes to be saved, by uid
 struct reg_db regs;
 
+static int mapreg_flush_timer = INVALID_TIMER;
+
 #define MAPREG_AUTOSAVE_INTERVAL (300*1000)
+#define MAPREG_FLUSH_DELAY 1000 // Delay before new and removed variables are saved
+#define MAPREG_SAVE_ROWS 500 // Maximum rows per query when saving
+
+static void mapreg_flush_later(void);
 
 
 /**
@@ -69,9 +76,9 @@ bool mapreg_setreg(int64 uid, int val)
 	if (val != 0) {
 		if ((m = static_cast<mapreg_save *>(i64db_get(regs.vars, uid)))) {
 			m->u.i = val;
-			if (name[1] != '@') {
+			if (name[1] != '@' && !m->save) {
 				m->save = true;
-				mapreg_dirty = true;
+				mapreg_queue.push_back(uid);
 			}
 		} else {
 			if (i)
@@ -85,27 +92,26 @@ bool mapreg_setreg(int64 uid, int val)
 			m->is_string = false;
 
 			if (name[1] != '@' && !skip_insert) {// write new variable to database
-				char esc_name[32 * 2 + 1];
-				Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-				if (SQL_ERROR == Sql_Query(mmysql_handle, "INSERT INTO `%s`(`varname`,`index`,`value`) VALUES ('%s','%d','%d')", mapreg_table, esc_name, i, val))
-					Sql_ShowDebug(mmysql_handle);
+				m->save = true;
+				mapreg_queue.push_back(uid);
+				mapreg_flush_later();
 			}
 			i64db_put(regs.vars, uid, m);
 		}
 	} else { // val == 0
 		if (i)
 			script_array_update(&regs, uid, true);
-		if ((m = static_cast<mapreg_save *>(i64db_get(regs.vars, uid)))) {
-			ers_free(mapreg_ers, m);
-		}
-		i64db_remove(regs.vars, uid);
+		m = static_cast<mapreg_save *>(i64db_get(regs.vars, uid));
 
-		if (name[1] != '@') {// Remove from database because it is unused.
-			char esc_name[32 * 2 + 1];
-			Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-			if (SQL_ERROR == Sql_Query(mmysql_handle, "DELETE FROM `%s` WHERE `varname`='%s' AND `index`='%d'", mapreg_table, esc_name, i))
-				Sql_ShowDebug(mmysql_handle);
+		if (name[1] != '@' && m != NULL) { // Remove from database because it is unused. Pending saves are already queued.
+			if (!m->save)
+				mapreg_queue.push_back(uid);
+			mapreg_flush_later();
 		}
+
+		if (m != NULL)
+			ers_free(mapreg_ers, m);
+		i64db_remove(regs.vars, uid);
 	}
 
 	return true;
@@ -128,13 +134,15 @@ bool mapreg_setregstr(int64 uid, const char* str)
 	if (str == NULL || *str == 0) {
 		if (i)
 			script_array_update(&regs, uid, true);
-		if (name[1] != '@') {
-			char esc_name[32 * 2 + 1];
-			Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-			if (SQL_ERROR == Sql_Query(mmysql_handle, "DELETE FROM `%s` WHERE `varname`='%s' AND `index`='%d'", mapreg_table, esc_name, i))
-				Sql_ShowDebug(mmysql_handle);
+		m = static_cast<mapreg_save *>(i64db_get(regs.vars, uid));
+
+		if (name[1] != '@' && m != NULL) { // Remove from database because it is unused. Pending saves are already queued.
+			if (!m->save)
+				mapreg_queue.push_back(uid);
+			mapreg_flush_later();
 		}
-		if ((m = static_cast<mapreg_save *>(i64db_get(regs.vars, uid)))) {
+
+		if (m != NULL) {
 			if (m->u.str != NULL)
 				aFree(m->u.str);
 			ers_free(mapreg_ers, m);
@@ -145,9 +153,9 @@ bool mapreg_setregstr(int64 uid, const char* str)
 			if (m->u.str != NULL)
 				aFree(m->u.str);
 			m->u.str = aStrdup(str);
-			if (name[1] != '@') {
-				mapreg_dirty = true;
+			if (name[1] != '@' && !m->save) {
 				m->save = true;
+				mapreg_queue.push_back(uid);
 			}
 		} else {
 			if (i)
@@ -161,12 +169,9 @@ bool mapreg_setregstr(int64 uid, const char* str)
 			m->is_string = true;
 
 			if (name[1] != '@' && !skip_insert) { //put returned null, so we must insert.
-				char esc_name[32 * 2 + 1];
-				char esc_str[255 * 2 + 1];
-				Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-				Sql_EscapeStringLen(mmysql_handle, esc_str, str, strnlen(str, 255));
-				if (SQL_ERROR == Sql_Query(mmysql_handle, "INSERT INTO `%s`(`varname`,`index`,`value`) VALUES ('%s','%d','%s')", mapreg_table, esc_name, i, esc_str))
-					Sql_ShowDebug(mmysql_handle);
+				m->save = true;
+				mapreg_queue.push_back(uid);
+				mapreg_flush_later();
 			}
 			i64db_put(regs.vars, uid, m);
 		}
@@ -224,41 +229,88 @@ static void script_load_mapreg(void)
 	SqlStmt_Free(stmt);
 
 	skip_insert = false;
-	mapreg_dirty = false;
+}
+
+/**
+ * Sends a batched query of script_save_mapreg and starts the next one.
+ */
+static void script_save_mapreg_flush(StringBuf* buf, int* rows, const char* suffix)
+{
+	if (*rows == 0)
+		return;
+	StringBuf_AppendStr(buf, suffix);
+	if (SQL_ERROR == Sql_QueryStr(mmysql_handle, StringBuf_Value(buf)))
+		Sql_ShowDebug(mmysql_handle);
+	StringBuf_Clear(buf);
+	*rows = 0;
 }
 
 /**
  * Saves permanent variables to database.
+ *
+ * Only the variables in the save queue are written. Changed and new
+ * variables are upserted and removed variables deleted with a query
+ * for many rows each. The queries are not atomic as a whole, the
+ * mapreg table uses MyISAM.
  */
 static void script_save_mapreg(void)
 {
-	if (mapreg_dirty) {
-		DBIterator *iter = db_iterator(regs.vars);
-		struct mapreg_save *m;
-		for (m = static_cast<mapreg_save *>(dbi_first(iter)); dbi_exists(iter); m = static_cast<mapreg_save *>(dbi_next(iter))) {
-			if (m->save) {
-				int num = script_getvarid(m->uid);
-				int i = script_getvaridx(m->uid);
-				const char* name = get_str(num);
-				if (!m->is_string) {
-					char esc_name[32 * 2 + 1];
-					Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-					if (SQL_ERROR == Sql_Query(mmysql_handle, "UPDATE `%s` SET `value`='%d' WHERE `varname`='%s' AND `index`='%d' LIMIT 1", mapreg_table, m->u.i, esc_name, i))
-						Sql_ShowDebug(mmysql_handle);
-				} else {
-					char esc_str[2 * 255 + 1];
-					char esc_name[32 * 2 + 1];
-					Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-					Sql_EscapeStringLen(mmysql_handle, esc_str, m->u.str, safestrnlen(m->u.str, 255));
-					if (SQL_ERROR == Sql_Query(mmysql_handle, "UPDATE `%s` SET `value`='%s' WHERE `varname`='%s' AND `index`='%d' LIMIT 1", mapreg_table, esc_str, esc_name, i))
-						Sql_ShowDebug(mmysql_handle);
-				}
-				m->save = false;
+	StringBuf upsert, remove;
+	int upsert_rows = 0, remove_rows = 0;
+
+	if (mapreg_queue.empty())
+		return;
+
+	StringBuf_Init(&upsert);
+	StringBuf_Init(&remove);
+
+	for (int64 uid : mapreg_queue) {
+		struct mapreg_save *m = static_cast<mapreg_save *>(i64db_get(regs.vars, uid));
+		int i = script_getvaridx(uid);
+		const char* name = get_str(script_getvarid(uid));
+		char esc_name[32 * 2 + 1];
+
+		if (m != NULL && !m->save)
+			continue; // Saved by an earlier entry of the queue
+
+		Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
+
+		if (m != NULL) {
+			if (upsert_rows == 0)
+				StringBuf_Printf(&upsert, "INSERT INTO `%s`(`varname`,`index`,`value`) VALUES ", mapreg_table);
+			else
+				StringBuf_AppendStr(&upsert, ",");
+
+			if (!m->is_string)
+				StringBuf_Printf(&upsert, "('%s','%d','%d')", esc_name, i, m->u.i);
+			else {
+				char esc_str[2 * 255 + 1];
+
+				Sql_EscapeStringLen(mmysql_handle, esc_str, m->u.str, safestrnlen(m->u.str, 255));
+				StringBuf_Printf(&upsert, "('%s','%d','%s')", esc_name, i, esc_str);
 			}
+			m->save = false;
+
+			if (++upsert_rows == MAPREG_SAVE_ROWS)
+				script_save_mapreg_flush(&upsert, &upsert_rows, " ON DUPLICATE KEY UPDATE `value`=VALUES(`value`)");
+		} else {
+			if (remove_rows == 0)
+				StringBuf_Printf(&remove, "DELETE FROM `%s` WHERE (`varname`,`index`) IN (", mapreg_table);
+			else
+				StringBuf_AppendStr(&remove, ",");
+
+			StringBuf_Printf(&remove, "('%s','%d')", esc_name, i);
+
+			if (++remove_rows == MAPREG_SAVE_ROWS)
+				script_save_mapreg_flush(&remove, &remove_rows, ")");
 		}
-		dbi_destroy(iter);
-		mapreg_dirty = false;
 	}
+	script_save_mapreg_flush(&upsert, &upsert_rows, " ON DUPLICATE KEY UPDATE `value`=VALUES(`value`)");
+	script_save_mapreg_flush(&remove, &remove_rows, ")");
+
+	StringBuf_Destroy(&upsert);
+	StringBuf_Destroy(&remove);
+	mapreg_queue.clear();
 }
 
 /**
@@ -269,6 +321,26 @@ static TIMER_FUNC(script_autosave_mapreg){
 	return 0;
 }
 
+/**
+ * Timer event to save new and removed permanent variables soon after the change.
+ */
+static TIMER_FUNC(script_flush_mapreg){
+	mapreg_flush_timer = INVALID_TIMER;
+	script_save_mapreg();
+	return 0;
+}
+
+/**
+ * Saves the queue after MAPREG_FLUSH_DELAY, called when a permanent variable
+ * was created or removed. Values that only changed wait for the autosave,
+ * unless they are queued when the flush runs.
+ */
+static void mapreg_flush_later(void)
+{
+	if (mapreg_flush_timer == INVALID_TIMER)
+		mapreg_flush_timer = add_timer(gettick() + MAPREG_FLUSH_DELAY, script_flush_mapreg, 0, 0);
+}
+
 /**
  * Destroys a mapreg_save structure, freeing the contained string, if any.
  *
@@ -317,6 +389,10 @@ void mapreg_reload(void)
  */
 void mapreg_final(void)
 {
+	if (mapreg_flush_timer != INVALID_TIMER) {
+		delete_timer(mapreg_flush_timer, script_flush_mapreg);
+		mapreg_flush_timer = INVALID_TIMER;
+	}
 	script_save_mapreg();
 
 	regs.vars->destroy(regs.vars, mapreg_destroyreg);
@@ -341,6 +417,7 @@ void mapreg_init(void)
 	script_load_mapreg();
 
 	add_timer_func_list(script_autosave_mapreg, "script_autosave_mapreg");
+	add_timer_func_list(script_flush_mapreg, "script_flush_mapreg");
 	add_timer_interval(gettick() + MAPREG_AUTOSAVE_INTERVAL, script_autosave_mapreg, 0, 0, MAPREG_AUTOSAVE_INTERVAL);
 }
 
@@ -6,6 +6,8 @@
 #include <errno.h>
 #include <map>
 #include <stdlib.h>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "../common/cbasetypes.hpp"
@@ -116,7 +118,101 @@ struct script_event_s{
 };
 
 // Holds pointers to the commonly executed scripts for speedup. [Skotlex]
-std::map<enum npce_event, std::vector<struct script_event_s>> script_event;
+static std::vector<struct script_event_s> script_event[NPCE_MAX];
+
+/// Target of an indexed event
+struct s_npc_event_target {
+	struct event_data* ev;
+	std::string name; ///< full event name, key in ev_db
+};
+
+/// Event index, lower case event name -> events with that name.
+/// Contains the full names ("<npc>::<label>") and the global names ("::<label>").
+/// New events are added directly, it is rebuilt on the first use after events were removed.
+/// A list that is being dispatched is shared with npc_event_run_indexed and copied before it is changed.
+static std::unordered_map<std::string, std::shared_ptr<std::vector<struct s_npc_event_target>>> npc_event_index;
+static bool npc_event_index_valid = false;
+static unsigned int npc_event_generation = 0; ///< changes whenever ev_db changes
+
+/// Marks the event index as outdated, must be called whenever events are removed from ev_db.
+static void npc_event_index_invalidate(void)
+{
+	npc_event_index_valid = false;
+	npc_event_generation++;
+}
+
+static std::string npc_event_index_key(const char* name)
+{
+	std::string key(name);
+
+	for( char& c : key )
+		c = TOLOWER(c);
+	return key;
+}
+
+/// Returns the list of the given index key for changing it, a list that is being dispatched is replaced by a copy.
+static std::vector<struct s_npc_event_target>& npc_event_index_list(const std::string& key)
+{
+	std::shared_ptr<std::vector<struct s_npc_event_target>>& targets = npc_event_index[key];
+
+	if( targets == nullptr )
+		targets = std::make_shared<std::vector<struct s_npc_event_target>>();
+	else if( targets.use_count() > 1 )
+		targets = std::make_shared<std::vector<struct s_npc_event_target>>(*targets);
+	return *targets;
+}
+
+/// Adds the event to the list of the given index key or replaces the event of the same name in it.
+static void npc_event_index_put_sub(const std::string& key, const char* name, struct event_data* ev)
+{
+	std::vector<struct s_npc_event_target>& targets = npc_event_index_list(key);
+
+	for( struct s_npc_event_target& target : targets ) {
+		if( target.name == name ) {
+			target.ev = ev;
+			return;
+		}
+	}
+
+	struct s_npc_event_target target = { ev, name };
+
+	targets.push_back(target);
+}
+
+/// Adds an event to the event index, must be called whenever an event is put into ev_db.
+static void npc_event_index_put(const char* name, struct event_data* ev)
+{
+	const char* p = strchr(name, ':');
+
+	npc_event_generation++;
+	if( !npc_event_index_valid )
+		return; // the whole index is built on the next use
+
+	npc_event_index_put_sub(npc_event_index_key(name), name, ev);
+	if( p != NULL && p != name )
+		npc_event_index_put_sub(npc_event_index_key(p), name, ev);
+}
+
+/// Builds the event index from ev_db.
+static void npc_event_index_build(void)
+{
+	DBIterator* iter;
+	DBKey key;
+	DBData* data;
+
+	npc_event_index.clear();
+	iter = db_iterator(ev_db);
+	for( data = iter->first(iter,&key); iter->exists(iter); data = iter->next(iter,&key) ) {
+		struct s_npc_event_target target = { (struct event_data*)db_data2ptr(data), key.str };
+		const char* p = strchr(key.str, ':');
+
+		npc_event_index_list(npc_event_index_key(key.str)).push_back(target);
+		if( p != NULL && p != key.str )
+			npc_event_index_list(npc_event_index_key(p)).push_back(target);
+	}
+	dbi_destroy(iter);
+	npc_event_index_valid = true;
+}
 
 struct view_data* npc_get_viewdata(int class_)
 {	//Returns the viewdata for normal npc classes.
@@ -386,7 +482,9 @@ static int npc_event_export(struct npc_data *nd, int i)
 		CREATE(ev, struct event_data, 1);
 		ev->nd = nd;
 		ev->pos = pos;
-		if (strdb_put(ev_db, buf, ev)) // There was already another event of the same name?
+		bool duplicate = ( strdb_put(ev_db, buf, ev) != 0 ); // There was already another event of the same name?
+		npc_event_index_put(buf, ev);
+		if (duplicate)
 			return 1;
 	}
 	return 0;
@@ -395,69 +493,47 @@ static int npc_event_export(struct npc_data *nd, int i)
 int npc_event_sub(struct map_session_data* sd, struct event_data* ev, const char* eventname); //[Lance]
 
 /**
- * Exec name (NPC events) on player or global
- * Do on all NPC when called with foreach
- * @see DBApply
+ * Exec all events with the given name, using the event index.
+ * @param name: full ("<npc>::<label>") or global ("::<label>") event name
+ * @param rid: player to attach
+ * @param sub: run through npc_event_sub when a player is attached, a player may only have 1 script running at the same time
+ * @return number of executed events
  */
-int npc_event_doall_sub(DBKey key, DBData *data, va_list ap)
+static int npc_event_run_indexed(const char* name, int rid, bool sub)
 {
-	const char* p = key.str;
-	struct event_data* ev;
-	int* c;
-	const char* name;
-	int rid;
+	if( !npc_event_index_valid )
+		npc_event_index_build();
 
-	nullpo_ret(ev = (struct event_data*)db_data2ptr(data));
-	nullpo_ret(c = va_arg(ap, int *));
-	nullpo_ret(name = va_arg(ap, const char *));
-	rid = va_arg(ap, int);
+	auto it = npc_event_index.find(npc_event_index_key(name));
+	if( it == npc_event_index.end() )
+		return 0;
 
-	p = strchr(p, ':'); // match only the event name
-	if( p && strcmpi(name, p) == 0 /* && !ev->nd->src_id */ ) // Do not run on duplicates. [Paradox924X]
-	{
-		if(rid) // a player may only have 1 script running at the same time
-			npc_event_sub(map_id2sd(rid),ev,key.str);
-		else
-			run_script(ev->nd->u.scr.script,ev->pos,rid,ev->nd->bl.id);
-		(*c)++;
-	}
+	// The events may load or unload NPCs, holding the list makes the index copy it before it is changed
+	std::shared_ptr<const std::vector<struct s_npc_event_target>> targets = it->second;
+	unsigned int generation = npc_event_generation;
+	int c = 0;
 
-	return 0;
-}
+	for( const struct s_npc_event_target& target : *targets ) {
+		struct event_data* ev = target.ev;
 
-/**
- * @see DBApply
- */
-static int npc_event_do_sub(DBKey key, DBData *data, va_list ap)
-{
-	const char* p = key.str;
-	struct event_data* ev;
-	int* c, rid;
-	const char* name;
+		if( generation != npc_event_generation && (ev = (struct event_data*)strdb_get(ev_db, target.name.c_str())) == NULL )
+			continue; // removed by a previous event
 
-	nullpo_ret(ev = (struct event_data*)db_data2ptr(data));
-	nullpo_ret(c = va_arg(ap, int *));
-	nullpo_ret(name = va_arg(ap, const char *));
-	rid = va_arg(ap, int);
-
-	if( p && strcmpi(name, p) == 0 )
-	{
-		run_script(ev->nd->u.scr.script,ev->pos,rid,ev->nd->bl.id);
-		(*c)++;
+		if( sub && rid )
+			npc_event_sub(map_id2sd(rid),ev,target.name.c_str());
+		else
+			run_script(ev->nd->u.scr.script,ev->pos,rid,ev->nd->bl.id);
+		c++;
 	}
 
-	return 0;
+	return c;
 }
 
 int npc_event_do_id(const char* name, int rid) {
-	int c = 0;
-
 	if( name[0] == ':' && name[1] == ':' )
-		ev_db->foreach(ev_db,npc_event_doall_sub,&c,name,0,rid);
+		return npc_event_run_indexed(name, 0, true);
 	else
-		ev_db->foreach(ev_db,npc_event_do_sub,&c,name,rid);
-
-	return c;
+		return npc_event_run_indexed(name, rid, false);
 }
 
 // runs the specified event (supports both single-npc and global events)
@@ -479,11 +555,9 @@ void npc_event_runall( const char* eventname ){
 // runs the specified event, with a RID attached (global only)
 int npc_event_doall_id(const char* name, int rid)
 {
-	int c = 0;
 	char buf[EVENT_NAME_LENGTH];
 	safesnprintf(buf, sizeof(buf), "::%s", name);
-	ev_db->foreach(ev_db,npc_event_doall_sub,&c,buf,rid);
-	return c;
+	return npc_event_run_indexed(buf, rid, true);
 }
 
 /*==========================================
@@ -2210,6 +2284,7 @@ static int npc_unload_ev(DBKey key, DBData *data, va_list ap)
 
 	if(strcmp(ev->nd->exname,npcname)==0){
 		db_remove(ev_db, key);
+		npc_event_index_invalidate();
 		return 1;
 	}
 	return 0;
@@ -3138,7 +3213,7 @@ static const char* npc_parse_script(char* w1, char* w2, char* w3, char* w4, cons
 	if( end == NULL )
 		return NULL;// (simple) parse error, don't continue
 
-	script = parse_script(script_start, filepath, strline(buffer,script_start-buffer), SCRIPT_USE_LABEL_DB);
+	script = parse_script_cached(script_start, end, filepath, strline(buffer,script_start-buffer), SCRIPT_USE_LABEL_DB);
 	label_list = NULL;
 	label_list_num = 0;
 	if( script )
@@ -3855,7 +3930,7 @@ static const char* npc_parse_function(char* w1, char* w2, char* w3, char* w4, co
 	if( end == NULL )
 		return NULL;// (simple) parse error, don't continue
 
-	script = parse_script(script_start, filepath, strline(buffer,start-buffer), SCRIPT_RETURN_EMPTY_SCRIPT);
+	script = parse_script_cached(script_start, end, filepath, strline(buffer,start-buffer), SCRIPT_RETURN_EMPTY_SCRIPT);
 	if( script == NULL )// parse error, continue
 		return end;
 
@@ -3865,9 +3940,7 @@ static const char* npc_parse_function(char* w1, char* w2, char* w3, char* w4, co
 
 		ShowInfo("npc_parse_function: Overwriting user function [%s] (%s:%d)\n", w3, filepath, strline(buffer,start-buffer));
 		script_stop_scriptinstances(oldscript);
-		script_free_vars(oldscript->local.vars);
-		aFree(oldscript->script_buf);
-		aFree(oldscript);
+		script_free_code(oldscript);
 	}
 
 	return end;
@@ -4496,7 +4569,8 @@ void npc_read_event_script(void)
 {
 	int i;
 
-	script_event.clear();
+	for (i = 0; i < NPCE_MAX; i++)
+		script_event[i].clear();
 
 	for (i = 0; i < NPCE_MAX; i++)
 	{
@@ -4561,6 +4635,7 @@ int npc_reload(void) {
 
 	db_clear(npcname_db);
 	db_clear(ev_db);
+	npc_event_index_invalidate();
 
 	//Remove all npcs/mobs. [Skotlex]
 
@@ -4616,10 +4691,12 @@ int npc_reload(void) {
 
 	//TODO: the following code is copy-pasted from do_init_npc(); clean it up
 	// Reloading npcs now
+	script_cache_begin();
 	for (nsl = npc_src_files; nsl; nsl = nsl->next) {
 		ShowStatus("Loading NPC file: %s" CL_CLL "\r", nsl->name);
 		npc_parsesrcfile(nsl->name,false);
 	}
+	script_cache_end();
 	ShowInfo ("Done loading '" CL_WHITE "%d" CL_RESET "' NPCs:" CL_CLL "\n"
 		"\t-'" CL_WHITE "%d" CL_RESET "' Warps\n"
 		"\t-'" CL_WHITE "%d" CL_RESET "' Shops\n"
@@ -4681,6 +4758,7 @@ bool npc_unloadfile( const char* path ) {
 void do_clear_npc(void) {
 	db_clear(npcname_db);
 	db_clear(ev_db);
+	npc_event_index_invalidate();
 }
 
 /*==========================================
@@ -4688,7 +4766,9 @@ void do_clear_npc(void) {
  *------------------------------------------*/
 void do_final_npc(void) {
 	npc_clear_pathlist();
-	script_event.clear();
+	for (int i = 0; i < NPCE_MAX; i++)
+		script_event[i].clear();
+	npc_event_index.clear();
 	ev_db->destroy(ev_db, NULL);
 	npcname_db->destroy(npcname_db, NULL);
 	npc_path_db->destroy(npc_path_db, NULL);
@@ -4767,10 +4847,12 @@ void do_init_npc(void){
 
 	// process all npc files
 	ShowStatus("Loading NPCs...\r");
+	script_cache_begin();
 	for( file = npc_src_files; file != NULL; file = file->next ) {
 		ShowStatus("Loading NPC file: %s" CL_CLL "\r", file->name);
 		npc_parsesrcfile(file->name,false);
 	}
+	script_cache_end();
 	ShowInfo ("Done loading '" CL_WHITE "%d" CL_RESET "' NPCs:" CL_CLL "\n"
 		"\t-'" CL_WHITE "%d" CL_RESET "' Warps\n"
 		"\t-'" CL_WHITE "%d" CL_RESET "' Shops\n"
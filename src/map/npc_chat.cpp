@@ -69,6 +69,7 @@ struct pcrematch_entry {
 	pcre* pcre_;
 	pcre_extra* pcre_extra_;
 	char* label;
+	char* literal; // lower case text that every match contains, NULL if unknown (see npc_chat_pattern_literal)
 };
 
 /* A set of patterns that can be activated and deactived with a single command */
@@ -105,6 +106,7 @@ void finalize_pcrematch_entry(struct pcrematch_entry* e)
 	pcre_free(e->pcre_extra_);
 	aFree(e->pattern);
 	aFree(e->label);
+	aFree(e->literal);
 }
 
 /**
@@ -297,6 +299,127 @@ static struct pcrematch_entry* create_pcrematch_entry(struct pcrematch_set* set)
 	return e;
 }
 
+/**
+ * Find the longest text that every match of a pattern must contain.
+ *
+ * The chat messages are searched for this text before running the
+ * pattern, so most messages are rejected without pcre_exec. Only the
+ * top level of the pattern is looked at and anything that is not
+ * understood gives up, since a wrong text would lose matches.
+ *
+ * Returns the lower case text (patterns are caseless) or NULL.
+ */
+static char* npc_chat_pattern_literal(const char* pattern)
+{
+	size_t len = strlen(pattern);
+	char* run = (char*)aMalloc(len + 1);
+	char* best = (char*)aMalloc(len + 1);
+	size_t run_len = 0, best_len = 0;
+	const char* p = pattern;
+
+#define END_RUN() do{ if( run_len > best_len ){ memcpy(best, run, run_len); best_len = run_len; } run_len = 0; }while(0)
+#define GIVE_UP() do{ aFree(run); aFree(best); return NULL; }while(0)
+
+	while( *p ) {
+		char c = *p++;
+
+		switch( c ) {
+			case '|': // alternatives, nothing is required
+				GIVE_UP();
+			case '.': case '^': case '$':
+				END_RUN();
+				continue;
+			case '[': // character class
+				if( *p == '^' )
+					p++;
+				if( *p == ']' )
+					p++;
+				while( *p && *p != ']' ) {
+					if( *p == '\\' && p[1] )
+						p++;
+					else if( *p == '[' && ( p[1] == ':' || p[1] == '.' || p[1] == '=' ) ) { // POSIX class like [:alpha:], ends with the same character
+						const char* end = strchr(p + 2, ']');
+
+						if( end == NULL || end[-1] != p[1] || end == p + 2 )
+							GIVE_UP();
+						p = end;
+					}
+					p++;
+				}
+				if( *p == '\0' )
+					GIVE_UP();
+				p++;
+				END_RUN();
+				continue;
+			case '(': { // group
+				int depth = 1;
+
+				if( *p == '?' ) // options and special groups
+					GIVE_UP();
+				while( *p && depth > 0 ) {
+					if( *p == '\\' && p[1] )
+						p++;
+					else if( *p == '(' )
+						depth++;
+					else if( *p == ')' )
+						depth--;
+					p++;
+				}
+				if( depth > 0 )
+					GIVE_UP();
+				END_RUN();
+				continue;
+			}
+			case ')':
+				GIVE_UP();
+			case '?': case '*': case '{': // previous character is optional
+				if( run_len > 0 )
+					run_len--;
+				END_RUN();
+				if( c == '{' ) {
+					while( *p && *p != '}' )
+						p++;
+					if( *p == '\0' )
+						GIVE_UP();
+					p++;
+				}
+				if( *p == '?' || *p == '+' ) // lazy or possessive
+					p++;
+				continue;
+			case '+': // previous character is required at least once
+				END_RUN();
+				if( *p == '?' || *p == '+' )
+					p++;
+				continue;
+			case '\\':
+				c = *p++;
+				if( c == '\0' )
+					GIVE_UP();
+				if( ISALNUM(c) ) {
+					if( strchr("dDsSwWbBAzZGhHvVRNX", c) == NULL ) // escapes with arguments, back references, quoting
+						GIVE_UP();
+					END_RUN();
+					continue;
+				}
+				break;
+		}
+
+		run[run_len++] = TOLOWER(c);
+	}
+	END_RUN();
+
+#undef END_RUN
+#undef GIVE_UP
+
+	aFree(run);
+	if( best_len == 0 ) {
+		aFree(best);
+		return NULL;
+	}
+	best[best_len] = '\0';
+	return best;
+}
+
 /**
  * define/compile a new pattern
  */
@@ -311,6 +434,7 @@ void npc_chat_def_pattern(struct npc_data* nd, int setid, const char* pattern, c
 	e->label = aStrdup(label);
 	e->pcre_ = pcre_compile(pattern, PCRE_CASELESS, &err, &erroff, NULL);
 	e->pcre_extra_ = pcre_study(e->pcre_, 0, &err);
+	e->literal = npc_chat_pattern_literal(pattern);
 }
 
 /**
@@ -348,6 +472,8 @@ int npc_chat_sub(struct block_list* bl, va_list ap)
 	struct npc_label_list* lst;
 	struct pcrematch_set* pcreset;
 	struct pcrematch_entry* e;
+	char lower[CHAT_SIZE_MAX + NAME_LENGTH + 4];
+	bool lowered = false;
 	
 	// Not interested in anything you might have to say...
 	if (npcParse == NULL || npcParse->active == NULL)
@@ -365,6 +491,20 @@ int npc_chat_sub(struct block_list* bl, va_list ap)
 		{
 			int offsets[2*10 + 10]; // 1/3 reserved for temp space requred by pcre_exec
 			
+			// skip the pattern if the message lacks its required text
+			if (e->literal != NULL && len < (int)sizeof(lower))
+			{
+				if (!lowered)
+				{
+					for (i = 0; i < len; i++)
+						lower[i] = TOLOWER(msg[i]);
+					lower[len] = '\0';
+					lowered = true;
+				}
+				if (strstr(lower, e->literal) == NULL)
+					continue;
+			}
+			
 			// perform pattern match
 			int r = pcre_exec(e->pcre_, e->pcre_extra_, msg, len, 0, 0, offsets, ARRAYLENGTH(offsets));
 			if (r > 0)
@@ -144,6 +144,18 @@ struct s_addele2 {
 	unsigned char ele;
 };
 
+/// Bonus values of a player before the status change layer of status_calc_pc was applied.
+/// Status changes that only change these are recalculated from here (see status_calc_pc_sc).
+struct s_pc_sc_layer {
+	int subele[ELE_MAX];
+	int subrace[RC_MAX];
+	int right_addrace[RC_MAX];
+	int left_addrace[RC_MAX];
+	int magic_addrace[RC_MAX];
+	int ignore_mdef_by_race[RC_MAX];
+	int crit_atk_rate;
+};
+
 struct weapon_data {
 	int atkmods[3];
 	// all the variables except atkmods get zero'ed in each call of status_calc_pc
@@ -300,6 +312,7 @@ struct map_session_data {
 		unsigned int warping : 1;//states whether you're in the middle of a warp processing
 		unsigned int permanent_speed : 1; // When 1, speed cannot be changed through status_calc_pc().
 		unsigned int hold_recalc : 1;
+		unsigned int sc_layer_dirty : 1; // sc_layer does not hold the values of the last status_calc_pc, status changes need a full recalculation
 		unsigned int banking : 1; //1 when we using the banking system 0 when closed
 		unsigned int hpmeter_visible : 1;
 		unsigned int autopilotmode;
@@ -522,6 +535,8 @@ struct map_session_data {
 	} bonus;
 	// zeroed vars end here.
 
+	struct s_pc_sc_layer sc_layer;
+
 	int castrate,delayrate,hprate,sprate,dsprate;
 	int hprecov_rate,sprecov_rate;
 	int matk_rate;
@@ -651,6 +666,10 @@ struct map_session_data {
 	bool *qi_display;
 	unsigned short qi_count;
 
+	// Player list of the current map (see map_data::user_list)
+	struct map_data *user_map; // map whose list contains this player, NULL if none
+	struct map_session_data *user_prev, *user_next;
+
 	// temporary debug [flaviojs]
 	const char* debug_file;
 	int debug_line;
@@ -7,12 +7,23 @@
 //#define DEBUG_HASH
 //#define DEBUG_DUMP_STACK
 
+// Dispatch the script instructions with computed gotos (GCC/Clang extension) instead of a switch
+#if defined(__GNUC__)
+	#define SCRIPT_THREADED_DISPATCH
+#endif
+
 #include "script.hpp"
 
 #include <errno.h>
 #include <math.h>
 #include <setjmp.h>
 #include <stdlib.h> // atoi, strtol, strtoll, exit
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #ifdef PCRE_SUPPORT
 #include "../../3rdparty/pcre/include/pcre.h" // preg_match
@@ -193,6 +204,10 @@ static inline int GETVALUE(const unsigned char* buf, int i)
 {
 	return (int)MakeDWord(MakeWord(buf[i], buf[i+1]), MakeWord(buf[i+2], 0));
 }
+static void script_decode(struct script_code* code);
+static void script_bonus_compile(struct script_code* code);
+static bool script_bonus_apply(const struct script_code* code, struct map_session_data* sd);
+
 static inline void SETVALUE(unsigned char* buf, int i, int n)
 {
 	buf[i]   = GetByte(n, 0);
@@ -200,6 +215,20 @@ static inline void SETVALUE(unsigned char* buf, int i, int n)
 	buf[i+2] = GetByte(n, 2);
 }
 
+/// Scope of a script variable, resolved from the prefix of its name when the name is added.
+enum e_script_var_scope : uint8 {
+	// player variables
+	SCRIPT_VAR_CHAR = 0, ///< permanent character variable (no prefix)
+	SCRIPT_VAR_CHAR_TEMP, ///< '@' temporary character variable
+	SCRIPT_VAR_ACCOUNT, ///< '#' permanent local account variable
+	SCRIPT_VAR_ACCOUNT_GLOBAL, ///< '##' permanent global account variable
+	// server variables
+	SCRIPT_VAR_MAP, ///< '$' and '$@' global variable
+	SCRIPT_VAR_NPC, ///< '.' npc variable
+	SCRIPT_VAR_SCOPE, ///< '.@' scope variable
+	SCRIPT_VAR_INSTANCE, ///< '\'' instance variable
+};
+
 // String buffer structures.
 // str_data stores string information
 static struct str_data_struct {
@@ -212,6 +241,9 @@ static struct str_data_struct {
 	int next;
 	const char *name;
 	bool deprecated;
+	int len; // length of the string
+	enum e_script_var_scope var_scope; // scope if the string is used as variable name
+	bool var_string; // the string is a string variable name ('$' postfix)
 } *str_data = nullptr;
 static int str_data_size = 0; // size of the data
 static int str_num = LABEL_START; // next id to be assigned
@@ -233,6 +265,7 @@ int str_hash[SCRIPT_HASH_SIZE];
 static DBMap* scriptlabel_db = NULL; // const char* label_name -> int script_pos
 static DBMap* userfunc_db = NULL; // const char* func_name -> struct script_code*
 static int parse_options = 0;
+static std::vector<std::string> parse_userfunc_refs; // global user functions called by the script being parsed, see parse_script_cached
 DBMap* script_get_label_db(void) { return scriptlabel_db; }
 DBMap* script_get_userfunc_db(void) { return userfunc_db; }
 
@@ -241,6 +274,7 @@ static int buildin_set_ref = 0;
 static int buildin_callsub_ref = 0;
 static int buildin_callfunc_ref = 0;
 static int buildin_getelementofarray_ref = 0;
+static int buildin_bonus_ref[5] = {}; // bonus to bonus5
 
 // Caches compiled autoscript item code.
 // Note: This is not cleared when reloading itemdb.
@@ -379,6 +413,7 @@ static struct linkdb_node *sleep_db; // int oid -> struct script_state *
  *------------------------------------------*/
 const char* parse_subexpr(const char* p,int limit);
 int run_func(struct script_state *st);
+static void script_profile_forget(struct script_code* code);
 unsigned short script_instancegetid(struct script_state *st, enum instance_mode mode = IM_NONE);
 
 const char* script_op2name(int op)
@@ -686,6 +721,19 @@ static int search_str(const char* p)
 	return -1;
 }
 
+/// Returns the scope of a variable with the given name.
+static enum e_script_var_scope script_var_scope(const char* name)
+{
+	switch( name[0] ) {
+		case '@': return SCRIPT_VAR_CHAR_TEMP;
+		case '$': return SCRIPT_VAR_MAP;
+		case '#': return ( name[1] == '#' ) ? SCRIPT_VAR_ACCOUNT_GLOBAL : SCRIPT_VAR_ACCOUNT;
+		case '.': return ( name[1] == '@' ) ? SCRIPT_VAR_SCOPE : SCRIPT_VAR_NPC;
+		case '\'': return SCRIPT_VAR_INSTANCE;
+		default: return SCRIPT_VAR_CHAR;
+	}
+}
+
 /// Stores a copy of the string and returns its id.
 /// If an identical string is already present, returns its id instead.
 int add_str(const char* p)
@@ -739,6 +787,9 @@ int add_str(const char* p)
 	str_data[str_num].func = NULL;
 	str_data[str_num].backpatch = -1;
 	str_data[str_num].label = -1;
+	str_data[str_num].len = len;
+	str_data[str_num].var_scope = script_var_scope(p);
+	str_data[str_num].var_string = ( len > 0 && p[len - 1] == '$' );
 	str_pos += len+1;
 
 	return str_num++;
@@ -979,6 +1030,8 @@ const char* parse_callfunc(const char* p, int require_paren, int is_custom)
 		if( !is_custom && strdb_get(userfunc_db, name) == NULL ) {
 			disp_error_message("parse_line: expect command, missing function name or calling undeclared function",p);
 		} else {;
+			if( !is_custom )
+				parse_userfunc_refs.push_back(name);
 			add_scriptl(buildin_callfunc_ref);
 			add_scriptc(C_ARG);
 			add_scriptc(C_STR);
@@ -1276,6 +1329,109 @@ bool is_number(const char *p) {
 	return false;
 }
 
+/// Checks if the script code from start to end pushes a single integer constant.
+/// Literals and constants are both encoded as integer, negative values are followed by C_NEG.
+///
+/// @param start Start of the code
+/// @param end End of the code
+/// @param value Value of the constant
+/// @return true if the code is a constant
+static bool parse_isconstant(int start, int end, int* value)
+{
+	int pos = start;
+	int i;
+
+	if( start >= end || script_buf[pos] < 0x80 )
+		return false;
+	i = get_num(script_buf, &pos);
+	if( pos < end ) {
+		if( get_com(script_buf, &pos) != C_NEG )
+			return false;
+		i = -i;
+	}
+	if( pos != end )
+		return false;
+	*value = i;
+	return true;
+}
+
+/// Replaces the script code from start to the current position with an integer constant.
+static void parse_setconstant(int start, int value)
+{
+	script_pos = start;
+	add_scripti(abs(value));
+	if( value < 0 )
+		add_scriptc(C_NEG);
+}
+
+/// Calculates an unary operator on a constant like op_1 would.
+/// @return false if the operator must be left to the script engine
+static bool parse_fold_op1(int op, int i1, int* ret)
+{
+	switch( op ) {
+		case C_NEG:
+			if( i1 == INT_MIN )
+				return false;
+			*ret = -i1;
+			break;
+		case C_NOT:  *ret = ~i1; break;
+		case C_LNOT: *ret = !i1; break;
+		default:
+			return false;
+	}
+	return (*ret != INT_MIN); // can't be encoded
+}
+
+/// Calculates a binary operator on constants like op_2num would.
+/// Operations that raise errors or warnings at runtime are not folded.
+/// @return false if the operator must be left to the script engine
+static bool parse_fold_op2(int op, int i1, int i2, int* ret)
+{
+	int64 ret64;
+
+	switch( op ) {
+		case C_AND:  *ret = i1 & i2;	break;
+		case C_OR:   *ret = i1 | i2;	break;
+		case C_XOR:  *ret = i1 ^ i2;	break;
+		case C_LAND: *ret = (i1 && i2);	break;
+		case C_LOR:  *ret = (i1 || i2);	break;
+		case C_EQ:   *ret = (i1 == i2);	break;
+		case C_NE:   *ret = (i1 != i2);	break;
+		case C_GT:   *ret = (i1 >  i2);	break;
+		case C_GE:   *ret = (i1 >= i2);	break;
+		case C_LT:   *ret = (i1 <  i2);	break;
+		case C_LE:   *ret = (i1 <= i2);	break;
+		case C_R_SHIFT:
+		case C_L_SHIFT:
+			if( i2 < 0 || i2 >= 31 || i1 < 0 )
+				return false;
+			*ret = ( op == C_R_SHIFT ? i1 >> i2 : i1 << i2 );
+			break;
+		case C_DIV:
+		case C_MOD:
+			if( i2 == 0 || ( i1 == INT_MIN && i2 == -1 ) )
+				return false;
+			*ret = ( op == C_DIV ? i1 / i2 : i1 % i2 );
+			break;
+		case C_ADD:
+		case C_SUB:
+		case C_MUL:
+			if( op == C_ADD )
+				ret64 = (int64)i1 + i2;
+			else if( op == C_SUB )
+				ret64 = (int64)i1 - i2;
+			else
+				ret64 = (int64)i1 * i2;
+			if( ret64 < INT_MIN || ret64 > INT_MAX )
+				return false; // keep the overflow warning of the script engine
+			*ret = (int)ret64;
+			break;
+		default:
+			return false;
+	}
+	return (*ret != INT_MIN); // can't be encoded
+}
+
 /*==========================================
  * Analysis section
  *------------------------------------------*/
@@ -1398,6 +1554,7 @@ const char* parse_simpleexpr(const char *p)
 const char* parse_subexpr(const char* p,int limit)
 {
 	int op,opl,len;
+	int start,mid,cond,i1,i2,ret;
 
 	p=skip_space(p);
 
@@ -1410,11 +1567,17 @@ const char* parse_subexpr(const char* p,int limit)
 		}
 	}
 
+	// Expressions of constants are calculated here instead of at runtime
+	start = script_pos;
+
 	if( (op = C_ADD_PRE, p[0] == '+' && p[1] == '+') || (op = C_SUB_PRE, p[0] == '-' && p[1] == '-') ) // Pre ++ -- operators
 		p = parse_variable(p);
 	else if( (op = C_NEG, *p == '-') || (op = C_LNOT, *p == '!') || (op = C_NOT, *p == '~') ) { // Unary - ! ~ operators
 		p = parse_subexpr(p + 1, 11);
-		add_scriptc(op);
+		if( parse_isconstant(start, script_pos, &i1) && parse_fold_op1(op, i1, &ret) )
+			parse_setconstant(start, ret);
+		else
+			add_scriptc(op);
 	} else
 		p = parse_simpleexpr(p);
 	p = skip_space(p);
@@ -1439,16 +1602,27 @@ const char* parse_subexpr(const char* p,int limit)
 			(op=C_LE,opl=7,len=2,*p=='<' && p[1]=='=') ||
 			(op=C_LT,opl=7,len=1,*p=='<')) && opl>limit){
 		p+=len;
+		mid = script_pos;
 		if(op == C_OP3) {
+			int mid2;
+
 			p=parse_subexpr(p,-1);
 			p=skip_space(p);
 			if( *(p++) != ':')
 				disp_error_message("parse_subexpr: expected ':'", p-1);
+			mid2 = script_pos;
 			p=parse_subexpr(p,-1);
+			if( parse_isconstant(start, mid, &cond) && parse_isconstant(mid, mid2, &i1) && parse_isconstant(mid2, script_pos, &i2) )
+				parse_setconstant(start, cond ? i1 : i2);
+			else
+				add_scriptc(op);
 		} else {
 			p=parse_subexpr(p,opl);
+			if( parse_isconstant(start, mid, &i1) && parse_isconstant(mid, script_pos, &i2) && parse_fold_op2(op, i1, i2, &ret) )
+				parse_setconstant(start, ret);
+			else
+				add_scriptc(op);
 		}
-		add_scriptc(op);
 		p=skip_space(p);
 	}
 
@@ -1469,6 +1643,31 @@ const char* parse_expr(const char *p)
 	return p;
 }
 
+/// Parses the condition of an if, else if, for, while or do-while and jumps to the label when it is false.
+/// Constant conditions are not tested at runtime, the jump is left out if the condition is always true
+/// and unconditional if it is always false, so the dead branch is never run.
+static const char* parse_jump_zero(const char* p, const char* label)
+{
+	int start = script_pos;
+	int expr, cond;
+
+	add_scriptl(add_str("jump_zero"));
+	add_scriptc(C_ARG);
+	expr = script_pos;
+	p = parse_expr(p);
+	p = skip_space(p);
+	if( parse_isconstant(expr, script_pos, &cond) ) {
+		script_pos = start;
+		if( cond != 0 )
+			return p;
+		add_scriptl(add_str("goto"));
+		add_scriptc(C_ARG);
+	}
+	add_scriptl(add_str(label));
+	add_scriptc(C_FUNC);
+	return p;
+}
+
 /*==========================================
  * Analysis of the line
  *------------------------------------------*/
@@ -1825,12 +2024,7 @@ const char* parse_syntax(const char* p)
 			} else {
 				// Skip to the end point if the condition is false
 				sprintf(label,"__FR%x_FIN",syntax.curly[pos].index);
-				add_scriptl(add_str("jump_zero"));
-				add_scriptc(C_ARG);
-				p=parse_expr(p);
-				p=skip_space(p);
-				add_scriptl(add_str(label));
-				add_scriptc(C_FUNC);
+				p=parse_jump_zero(p,label);
 			}
 			if(*p != ';')
 				disp_error_message("parse_syntax: expected ';'",p);
@@ -1945,12 +2139,7 @@ const char* parse_syntax(const char* p)
 			syntax.curly[syntax.curly_count].flag  = 0;
 			sprintf(label,"__IF%x_%x",syntax.curly[syntax.curly_count].index,syntax.curly[syntax.curly_count].count);
 			syntax.curly_count++;
-			add_scriptl(add_str("jump_zero"));
-			add_scriptc(C_ARG);
-			p=parse_expr(p);
-			p=skip_space(p);
-			add_scriptl(add_str(label));
-			add_scriptc(C_FUNC);
+			p=parse_jump_zero(p,label);
 			return p;
 		}
 		break;
@@ -2002,12 +2191,7 @@ const char* parse_syntax(const char* p)
 			// Skip to the end point if the condition is false
 			sprintf(label,"__WL%x_FIN",syntax.curly[syntax.curly_count].index);
 			syntax.curly_count++;
-			add_scriptl(add_str("jump_zero"));
-			add_scriptc(C_ARG);
-			p=parse_expr(p);
-			p=skip_space(p);
-			add_scriptl(add_str(label));
-			add_scriptc(C_FUNC);
+			p=parse_jump_zero(p,label);
 			return p;
 		}
 		break;
@@ -2070,12 +2254,7 @@ const char* parse_syntax_close_sub(const char* p,int* flag)
 					disp_error_message("need '('",p);
 				}
 				sprintf(label,"__IF%x_%x",syntax.curly[pos].index,syntax.curly[pos].count);
-				add_scriptl(add_str("jump_zero"));
-				add_scriptc(C_ARG);
-				p=parse_expr(p);
-				p=skip_space(p);
-				add_scriptl(add_str(label));
-				add_scriptc(C_FUNC);
+				p=parse_jump_zero(p,label);
 				*flag = 0;
 				return p;
 			} else {
@@ -2125,12 +2304,7 @@ const char* parse_syntax_close_sub(const char* p,int* flag)
 		parse_nextline(false, p);
 
 		sprintf(label2,"__DO%x_FIN",syntax.curly[pos].index);
-		add_scriptl(add_str("jump_zero"));
-		add_scriptc(C_ARG);
-		p=parse_expr(p);
-		p=skip_space(p);
-		add_scriptl(add_str(label2));
-		add_scriptc(C_FUNC);
+		p=parse_jump_zero(p,label2);
 
 		// Skip to the starting point
 		sprintf(label2,"goto __DO%x_BGN;",syntax.curly[pos].index);
@@ -2239,6 +2413,9 @@ static void add_buildin_func(void)
 			else if (!strcmp(buildin_func[i].name, "callsub")) buildin_callsub_ref = n;
 			else if (!strcmp(buildin_func[i].name, "callfunc")) buildin_callfunc_ref = n;
 			else if( !strcmp(buildin_func[i].name, "getelementofarray") ) buildin_getelementofarray_ref = n;
+			else if( !strcmp(buildin_func[i].name, "bonus") ) buildin_bonus_ref[0] = n;
+			else if( !strncmp(buildin_func[i].name, "bonus", 5) && buildin_func[i].name[5] >= '2' && buildin_func[i].name[5] <= '5' && buildin_func[i].name[6] == '\0' )
+				buildin_bonus_ref[buildin_func[i].name[5] - '1'] = n;
 		}
 	}
 }
@@ -2465,12 +2642,24 @@ void script_warning(const char* src, const char* file, int start_line, const cha
 /*==========================================
  * Analysis of the script
  *------------------------------------------*/
+/// Loads the buildin functions and constants before the first script is parsed.
+static void script_parse_setup(void)
+{
+	static bool first=true;
+
+	if(first){
+		add_buildin_func();
+		read_constdb();
+		script_hardcoded_constants();
+		first=false;
+	}
+}
+
 struct script_code* parse_script(const char *src,const char *file,int line,int options)
 {
 	const char *p,*tmpp;
 	int i;
 	struct script_code* code = NULL;
-	static bool first=true;
 	char end;
 	bool unresolved_names = false;
 
@@ -2482,12 +2671,7 @@ struct script_code* parse_script(const char *src,const char *file,int line,int o
 		return NULL;// empty script
 
 	memset(&syntax,0,sizeof(syntax));
-	if(first){
-		add_buildin_func();
-		read_constdb();
-		script_hardcoded_constants();
-		first=false;
-	}
+	script_parse_setup();
 
 	script_buf=(unsigned char *)aMalloc(SCRIPT_BLOCK_SIZE*sizeof(unsigned char));
 	script_pos=0;
@@ -2498,6 +2682,7 @@ struct script_code* parse_script(const char *src,const char *file,int line,int o
 	if( options&SCRIPT_USE_LABEL_DB )
 		db_clear(scriptlabel_db);
 	parse_options = options;
+	parse_userfunc_refs.clear();
 
 	if( setjmp( error_jump ) != 0 ) {
 		//Restore program state when script has problems. [from jA]
@@ -2658,9 +2843,365 @@ struct script_code* parse_script(const char *src,const char *file,int line,int o
 	code->script_size = script_size;
 	code->local.vars = NULL;
 	code->local.arrays = NULL;
+	script_decode(code);
+	script_bonus_compile(code);
+	return code;
+}
+
+/*==========================================
+ * Compiled script cache
+ *------------------------------------------*/
+
+#define SCRIPT_CACHE_MAGIC "RASCRC1"
+#define SCRIPT_CACHE_VERSION 2
+
+/// Compiled script of the cache.
+/// String ids differ between runs, so the names the C_NAME operands refer to are stored with the code.
+struct s_script_cache_entry {
+	std::vector<uint8> code;
+	std::vector<std::string> names;
+	std::vector<std::pair<uint32, uint32>> relocs; ///< position of a C_NAME operand in code, index in names
+	std::vector<std::pair<std::string, int32>> labels; ///< labels exported to scriptlabel_db
+	std::vector<std::string> userfuncs; ///< global user functions the script calls, they have to exist when it is used
+	bool used; ///< used since script_cache_begin
+};
+
+static bool script_cache_enabled = true;
+static char script_cache_file[256] = "log/npc_script_cache.bin";
+static bool script_cache_active = false; ///< between script_cache_begin and script_cache_end
+static bool script_cache_loaded = false;
+static bool script_cache_dirty = false;
+static uint8 script_cache_env[16]; ///< hash of the build and the constants the cached scripts were compiled with
+static std::unordered_map<std::string, struct s_script_cache_entry> script_cache; ///< md5 of the source and the parse options -> compiled script
+static unsigned int script_cache_hits = 0, script_cache_misses = 0;
+
+/// Hashes everything the compiled code depends on besides the source:
+/// the build, and the constants, parameters and buildin functions (constants are compiled into the code).
+static void script_cache_env_hash(uint8* env)
+{
+	std::string buf = SCRIPT_CACHE_MAGIC " " __DATE__ " " __TIME__ "\n";
+
+	for( int i = 0; i < str_num; i++ ) {
+		if( str_data[i].type != C_INT && str_data[i].type != C_PARAM && str_data[i].type != C_FUNC )
+			continue;
+		buf += get_str(i);
+		buf += ':';
+		buf += std::to_string(str_data[i].type);
+		buf += ':';
+		buf += std::to_string(str_data[i].val);
+		buf += '\n';
+	}
+	MD5_Binary(buf.c_str(), env);
+}
+
+static bool script_cache_read(FILE* fp, void* buf, size_t len)
+{
+	return fread(buf, 1, len, fp) == len;
+}
+
+static bool script_cache_read_str(FILE* fp, std::string& str)
+{
+	uint16 len;
+
+	if( !script_cache_read(fp, &len, sizeof(len)) )
+		return false;
+	str.resize(len);
+	return len == 0 || script_cache_read(fp, &str[0], len);
+}
+
+static void script_cache_write_str(FILE* fp, const std::string& str)
+{
+	uint16 len = (uint16)str.size();
+
+	fwrite(&len, sizeof(len), 1, fp);
+	fwrite(str.data(), 1, len, fp);
+}
+
+/// Loads the cache file, if it was written by the same build with the same constants.
+static void script_cache_load(void)
+{
+	FILE* fp;
+	char magic[8];
+	uint32 version, count, i;
+	uint8 env[16];
+
+	if( ( fp = fopen(script_cache_file, "rb") ) == NULL )
+		return;
+
+	if( !script_cache_read(fp, magic, sizeof(magic)) || !script_cache_read(fp, &version, sizeof(version)) ||
+		!script_cache_read(fp, env, sizeof(env)) || !script_cache_read(fp, &count, sizeof(count)) ||
+		memcmp(magic, SCRIPT_CACHE_MAGIC, sizeof(magic)) != 0 || version != SCRIPT_CACHE_VERSION ||
+		memcmp(env, script_cache_env, sizeof(env)) != 0 ) {
+		ShowInfo("NPC script cache '" CL_WHITE "%s" CL_RESET "' is outdated, all scripts are compiled.\n", script_cache_file);
+		fclose(fp);
+		return;
+	}
+
+	for( i = 0; i < count; i++ ) {
+		std::string key;
+		struct s_script_cache_entry entry;
+		uint32 n[5], j;
+
+		if( !script_cache_read_str(fp, key) || !script_cache_read(fp, n, sizeof(n)) )
+			break;
+		entry.code.resize(n[0]);
+		if( !script_cache_read(fp, entry.code.data(), n[0]) )
+			break;
+		entry.names.resize(n[1]);
+		for( j = 0; j < n[1] && script_cache_read_str(fp, entry.names[j]); j++ );
+		if( j < n[1] )
+			break;
+		entry.relocs.resize(n[2]);
+		for( j = 0; j < n[2] && script_cache_read(fp, &entry.relocs[j].first, sizeof(uint32)) && script_cache_read(fp, &entry.relocs[j].second, sizeof(uint32)); j++ ) {
+			if( entry.relocs[j].first + 3 > n[0] || entry.relocs[j].second >= n[1] )
+				break;
+		}
+		if( j < n[2] )
+			break;
+		entry.labels.resize(n[3]);
+		for( j = 0; j < n[3] && script_cache_read_str(fp, entry.labels[j].first) && script_cache_read(fp, &entry.labels[j].second, sizeof(int32)); j++ );
+		if( j < n[3] )
+			break;
+		entry.userfuncs.resize(n[4]);
+		for( j = 0; j < n[4] && script_cache_read_str(fp, entry.userfuncs[j]); j++ );
+		if( j < n[4] )
+			break;
+		entry.used = false;
+		script_cache[key] = std::move(entry);
+	}
+	fclose(fp);
+
+	if( i < count ) {
+		ShowWarning("NPC script cache '" CL_WHITE "%s" CL_RESET "' is damaged, all scripts are compiled.\n", script_cache_file);
+		script_cache.clear();
+	}
+}
+
+/// Writes the cache file.
+static void script_cache_save(void)
+{
+	FILE* fp;
+	uint32 version = SCRIPT_CACHE_VERSION, count = (uint32)script_cache.size();
+	char tmpfile[sizeof(script_cache_file) + 4];
+
+	safesnprintf(tmpfile, sizeof(tmpfile), "%s.tmp", script_cache_file);
+	if( ( fp = fopen(tmpfile, "wb") ) == NULL ) {
+		ShowError("script_cache_save: Could not open '%s' for writing.\n", tmpfile);
+		return;
+	}
+
+	fwrite(SCRIPT_CACHE_MAGIC, 1, 8, fp);
+	fwrite(&version, sizeof(version), 1, fp);
+	fwrite(script_cache_env, sizeof(script_cache_env), 1, fp);
+	fwrite(&count, sizeof(count), 1, fp);
+	for( const auto& it : script_cache ) {
+		const struct s_script_cache_entry& entry = it.second;
+		uint32 n[5] = { (uint32)entry.code.size(), (uint32)entry.names.size(), (uint32)entry.relocs.size(), (uint32)entry.labels.size(), (uint32)entry.userfuncs.size() };
+
+		script_cache_write_str(fp, it.first);
+		fwrite(n, sizeof(n), 1, fp);
+		fwrite(entry.code.data(), 1, entry.code.size(), fp);
+		for( const auto& name : entry.names )
+			script_cache_write_str(fp, name);
+		for( const auto& reloc : entry.relocs ) {
+			fwrite(&reloc.first, sizeof(uint32), 1, fp);
+			fwrite(&reloc.second, sizeof(uint32), 1, fp);
+		}
+		for( const auto& label : entry.labels ) {
+			script_cache_write_str(fp, label.first);
+			fwrite(&label.second, sizeof(int32), 1, fp);
+		}
+		for( const auto& name : entry.userfuncs )
+			script_cache_write_str(fp, name);
+	}
+
+	if( ferror(fp) ) {
+		ShowError("script_cache_save: Could not write '%s'.\n", tmpfile);
+		fclose(fp);
+		remove(tmpfile);
+		return;
+	}
+	fclose(fp);
+	remove(script_cache_file);
+	if( rename(tmpfile, script_cache_file) != 0 ) {
+		ShowError("script_cache_save: Could not rename '%s' to '%s'.\n", tmpfile, script_cache_file);
+		return;
+	}
+	script_cache_dirty = false;
+}
+
+/// Adds a compiled script to the cache.
+static void script_cache_store(const std::string& key, struct script_code* code, int options)
+{
+	struct s_script_cache_entry entry;
+	std::unordered_map<int, uint32> name_index;
+
+	entry.code.assign(code->script_buf, code->script_buf + code->script_size);
+	for( int i = 0; i < code->insn_count; i++ ) {
+		int id, pos;
+
+		if( code->insns[i].op != C_NAME )
+			continue;
+		id = code->insns[i].value;
+		if( id < 0 || id >= str_num )
+			return; // unresolved reference, not cached
+		// the operand is in the last 3 bytes of the instruction
+		pos = ( i + 1 < code->insn_count ? code->insns[i + 1].pos : code->script_size ) - 3;
+
+		auto it = name_index.find(id);
+		if( it == name_index.end() ) {
+			it = name_index.insert(std::make_pair(id, (uint32)entry.names.size())).first;
+			entry.names.push_back(get_str(id));
+		}
+		entry.relocs.push_back(std::make_pair((uint32)pos, it->second));
+	}
+
+	if( options&SCRIPT_USE_LABEL_DB ) {
+		DBIterator* iter = db_iterator(scriptlabel_db);
+		DBKey dbkey;
+
+		for( DBData* data = iter->first(iter, &dbkey); iter->exists(iter); data = iter->next(iter, &dbkey) )
+			entry.labels.push_back(std::make_pair(std::string(dbkey.str), (int32)db_data2i(data)));
+		dbi_destroy(iter);
+	}
+
+	entry.userfuncs = parse_userfunc_refs;
+	entry.used = true;
+	script_cache[key] = std::move(entry);
+	script_cache_dirty = true;
+}
+
+/// Creates the script code of a cached script, with the same side effects as parse_script.
+static struct script_code* script_cache_instantiate(const struct s_script_cache_entry& entry, int options)
+{
+	struct script_code* code;
+	std::vector<int> ids(entry.names.size());
+
+	for( size_t i = 0; i < entry.names.size(); i++ ) {
+		int id = add_str(entry.names[i].c_str());
+
+		if( str_data[id].type == C_NOP ) {// new name, default to variable like parse_script
+			str_data[id].type = C_NAME;
+			str_data[id].label = id;
+		}
+		ids[i] = id;
+	}
+
+	CREATE(code, struct script_code, 1);
+	code->script_size = (int)entry.code.size();
+	CREATE(code->script_buf, unsigned char, code->script_size);
+	memcpy(code->script_buf, entry.code.data(), code->script_size);
+	for( const auto& reloc : entry.relocs )
+		SETVALUE(code->script_buf, reloc.first, ids[reloc.second]);
+	code->local.vars = NULL;
+	code->local.arrays = NULL;
+	script_decode(code);
+	script_bonus_compile(code);
+
+	if( options&SCRIPT_USE_LABEL_DB ) {
+		db_clear(scriptlabel_db);
+		for( const auto& label : entry.labels )
+			strdb_iput(scriptlabel_db, label.first.c_str(), label.second);
+	}
+
 	return code;
 }
 
+/// Parses a script, unchanged scripts are taken from the compiled script cache.
+/// Outside of script_cache_begin/script_cache_end this is the same as parse_script.
+/// @param src Start of the script
+/// @param src_end End of the script source, the text in between is the cache key
+struct script_code* parse_script_cached(const char* src, const char* src_end, const char* file, int line, int options)
+{
+	struct script_code* code;
+	std::string key;
+	uint8 md5[16];
+
+	if( !script_cache_active || src == NULL || src_end == NULL || src_end <= src )
+		return parse_script(src, file, line, options);
+
+	key.assign(src, src_end);
+	MD5_Binary(key.c_str(), md5);
+	key.assign((const char*)md5, sizeof(md5));
+	key += (char)options;
+
+	auto it = script_cache.find(key);
+	if( it != script_cache.end() ) {
+		bool valid = true;
+
+		// parse_script fails if a called user function was not loaded before the script
+		for( const auto& name : it->second.userfuncs ) {
+			if( strdb_get(userfunc_db, name.c_str()) == NULL ) {
+				valid = false;
+				break;
+			}
+		}
+		if( valid ) {
+			script_cache_hits++;
+			it->second.used = true;
+			return script_cache_instantiate(it->second, options);
+		}
+	}
+
+	script_cache_misses++;
+	code = parse_script(src, file, line, options);
+	if( code != NULL )
+		script_cache_store(key, code, options);
+	return code;
+}
+
+/// Drops the compiled scripts kept in memory, the next script_cache_begin loads the cache file again.
+static void script_cache_clear(void)
+{
+	script_cache.clear();
+	script_cache_loaded = false;
+	script_cache_active = false;
+}
+
+/// Starts using the compiled script cache, before the NPC files are loaded.
+void script_cache_begin(void)
+{
+	uint8 env[16];
+
+	if( !script_cache_enabled )
+		return;
+
+	script_parse_setup();
+	script_cache_env_hash(env);
+	if( !script_cache_loaded || memcmp(env, script_cache_env, sizeof(env)) != 0 ) {
+		script_cache.clear();
+		memcpy(script_cache_env, env, sizeof(env));
+		script_cache_load();
+		script_cache_loaded = true;
+	}
+
+	for( auto& it : script_cache )
+		it.second.used = false;
+	script_cache_hits = script_cache_misses = 0;
+	script_cache_active = true;
+}
+
+/// Stops using the compiled script cache after the NPC files were loaded.
+/// Scripts that were not used anymore are dropped and the cache file is updated.
+void script_cache_end(void)
+{
+	if( !script_cache_active )
+		return;
+	script_cache_active = false;
+
+	for( auto it = script_cache.begin(); it != script_cache.end(); ) {
+		if( !it->second.used ) {
+			it = script_cache.erase(it);
+			script_cache_dirty = true;
+		} else
+			++it;
+	}
+
+	ShowStatus("Done loading '" CL_WHITE "%u" CL_RESET "' NPC scripts from the cache, '" CL_WHITE "%u" CL_RESET "' compiled.\n", script_cache_hits, script_cache_misses);
+	if( script_cache_dirty )
+		script_cache_save();
+}
+
 /// Returns the player attached to this script, identified by the rid.
 /// If there is no player attached, the script is terminated.
 static bool script_rid2sd_( struct script_state *st, struct map_session_data** sd, const char *func ){
@@ -2685,21 +3226,20 @@ static bool script_rid2sd_( struct script_state *st, struct map_session_data** s
  */
 struct script_data *get_val_(struct script_state* st, struct script_data* data, struct map_session_data *sd)
 {
+	const struct str_data_struct* var;
 	const char* name;
-	char prefix;
-	char postfix;
 
 	if( !data_isreference(data) )
 		return data;// not a variable/constant
 
-	name = reference_getname(data);
-	prefix = name[0];
-	postfix = name[strlen(name) - 1];
+	// scope and type were resolved when the name was added
+	var = &str_data[reference_getid(data)];
+	name = str_buf + var->str;
 
 	//##TODO use reference_tovariable(data) when it's confirmed that it works [FlavioJS]
-	if( !reference_toconstant(data) && not_server_variable(prefix) ) {
+	if( !reference_toconstant(data) && var->var_scope <= SCRIPT_VAR_ACCOUNT_GLOBAL ) {
 		if( sd == NULL && !script_rid2sd(sd) ) {// needs player attached
-			if( postfix == '$' ) {// string variable
+			if( var->var_string ) {// string variable
 				ShowWarning("script:get_val: cannot access player variable '%s', defaulting to \"\"\n", name);
 				data->type = C_CONSTSTR;
 				data->u.str = const_cast<char *>("");
@@ -2712,25 +3252,26 @@ struct script_data *get_val_(struct script_state* st, struct script_data* data,
 		}
 	}
 
-	if( postfix == '$' ) {// string variable
+	if( var->var_string ) {// string variable
 
-		switch( prefix ) {
-			case '@':
+		switch( var->var_scope ) {
+			case SCRIPT_VAR_CHAR_TEMP:
 				data->u.str = pc_readregstr(sd, data->u.num);
 				break;
-			case '$':
+			case SCRIPT_VAR_MAP:
 				data->u.str = mapreg_readregstr(data->u.num);
 				break;
-			case '#':
-				if( name[1] == '#' )
-					data->u.str = pc_readaccountreg2str(sd, data->u.num);// global
-				else
-					data->u.str = pc_readaccountregstr(sd, data->u.num);// local
+			case SCRIPT_VAR_ACCOUNT_GLOBAL:
+				data->u.str = pc_readaccountreg2str(sd, data->u.num);
+				break;
+			case SCRIPT_VAR_ACCOUNT:
+				data->u.str = pc_readaccountregstr(sd, data->u.num);
 				break;
-			case '.':
+			case SCRIPT_VAR_NPC:
+			case SCRIPT_VAR_SCOPE:
 				{
 					struct DBMap* n = data->ref ?
-							data->ref->vars : name[1] == '@' ?
+							data->ref->vars : var->var_scope == SCRIPT_VAR_SCOPE ?
 							st->stack->scope.vars : // instance/scope variable
 							st->script->local.vars; // npc variable
 					if( n )
@@ -2739,7 +3280,7 @@ struct script_data *get_val_(struct script_state* st, struct script_data* data,
 						data->u.str = NULL;
 				}
 				break;
-			case '\'':
+			case SCRIPT_VAR_INSTANCE:
 				{
 					struct DBMap* n = nullptr;
 					if (data->ref)
@@ -2779,23 +3320,24 @@ struct script_data *get_val_(struct script_state* st, struct script_data* data,
 		} else if( reference_toparam(data) ) {
 			data->u.num = pc_readparam(sd, reference_getparamtype(data));
 		} else
-			switch( prefix ) {
-				case '@':
+			switch( var->var_scope ) {
+				case SCRIPT_VAR_CHAR_TEMP:
 					data->u.num = pc_readreg(sd, data->u.num);
 					break;
-				case '$':
+				case SCRIPT_VAR_MAP:
 					data->u.num = mapreg_readreg(data->u.num);
 					break;
-				case '#':
-					if( name[1] == '#' )
-						data->u.num = pc_readaccountreg2(sd, data->u.num);// global
-					else
-						data->u.num = pc_readaccountreg(sd, data->u.num);// local
+				case SCRIPT_VAR_ACCOUNT_GLOBAL:
+					data->u.num = pc_readaccountreg2(sd, data->u.num);
+					break;
+				case SCRIPT_VAR_ACCOUNT:
+					data->u.num = pc_readaccountreg(sd, data->u.num);
 					break;
-				case '.':
+				case SCRIPT_VAR_NPC:
+				case SCRIPT_VAR_SCOPE:
 					{
 						struct DBMap* n = data->ref ?
-								data->ref->vars : name[1] == '@' ?
+								data->ref->vars : var->var_scope == SCRIPT_VAR_SCOPE ?
 								st->stack->scope.vars : // instance/scope variable
 								st->script->local.vars; // npc variable
 						if( n )
@@ -2804,7 +3346,7 @@ struct script_data *get_val_(struct script_state* st, struct script_data* data,
 							data->u.num = 0;
 					}
 					break;
-				case '\'':
+				case SCRIPT_VAR_INSTANCE:
 					{
 						struct DBMap* n = nullptr;
 						if (data->ref)
@@ -2856,6 +3398,36 @@ void* get_val2(struct script_state* st, int64 uid, struct reg_db *ref)
 	return (data->type == C_INT ? (void*)__64BPRTSIZE((int)data->u.num) : (void*)__64BPRTSIZE(data->u.str));
 }
 
+/**
+ * Returns the position of the array index in the member list of script_array
+ *
+ * @param idx the index of the array member
+ * @return position of the member, sa->size if it is not a member
+ **/
+static unsigned int script_array_find_member(struct script_array *sa, unsigned int idx)
+{
+	unsigned int i;
+
+	if( sa->members == NULL ) // dense, the position is the index
+		return ( idx < sa->size ) ? idx : sa->size;
+
+	ARR_FIND(0, sa->size, i, sa->members[i] == idx);
+	return i;
+}
+
+/**
+ * Converts a dense script_array to a member list
+ **/
+static void script_array_make_sparse(struct script_array *sa)
+{
+	unsigned int i;
+
+	sa->max_members = max(sa->size * 2, 8);
+	CREATE(sa->members, unsigned int, sa->max_members);
+	for(i = 0; i < sa->size; i++)
+		sa->members[i] = i;
+}
+
 /**
  * Because, currently, array members with key 0 are indifferenciable from normal variables, we should ensure its actually in
  * Will be gone as soon as undefined var feature is implemented
@@ -2887,9 +3459,8 @@ void script_array_ensure_zero(struct script_state *st, struct map_session_data *
 	if (src && src->arrays) {
 		struct script_array *sa = static_cast<script_array *>(idb_get(src->arrays, script_getvarid(uid)));
 		if (sa) {
-			unsigned int i;
+			unsigned int i = script_array_find_member(sa, 0);
 
-			ARR_FIND(0, sa->size, i, sa->members[i] == 0);
 			if( i != sa->size ) {
 				if( !insert )
 					script_array_remove_member(src,sa,i);
@@ -2933,6 +3504,9 @@ unsigned int script_array_highest_key(struct script_state *st, struct map_sessio
 		if( ( sa = static_cast<script_array *>(idb_get(src->arrays, key)) ) ) {
 			unsigned int i, highest_key = 0;
 
+			if( sa->members == NULL ) // dense
+				return sa->size;
+
 			for(i = 0; i < sa->size; i++) {
 				if( sa->members[i] > highest_key )
 					highest_key = sa->members[i];
@@ -2978,6 +3552,14 @@ void script_array_remove_member(struct reg_db *src, struct script_array *sa, uns
 		return;
 	}
 
+	if( sa->members == NULL ) {
+		if( idx == sa->size - 1 ) { // last member of a dense array, it stays dense
+			sa->size--;
+			return;
+		}
+		script_array_make_sparse(sa);
+	}
+
 	sa->members[idx] = UINT_MAX;
 
 	for(i = 0, cursor = 0; i < sa->size; i++) {
@@ -2998,9 +3580,20 @@ void script_array_remove_member(struct reg_db *src, struct script_array *sa, uns
  **/
 void script_array_add_member(struct script_array *sa, unsigned int idx)
 {
-	RECREATE(sa->members, unsigned int, ++sa->size);
+	if( sa->members == NULL ) {
+		if( idx == sa->size ) { // appended to a dense array
+			sa->size++;
+			return;
+		}
+		script_array_make_sparse(sa);
+	}
+
+	if( sa->size == sa->max_members ) {
+		sa->max_members = max(sa->max_members * 2, 8);
+		RECREATE(sa->members, unsigned int, sa->max_members);
+	}
 
-	sa->members[sa->size - 1] = idx;
+	sa->members[sa->size++] = idx;
 }
 
 /**
@@ -3070,13 +3663,7 @@ void script_array_update(struct reg_db *src, int64 num, bool empty)
 	}
 
 	if( sa ) {
-		unsigned int i;
-
-		// search
-		for(i = 0; i < sa->size; i++) {
-			if( sa->members[i] == index )
-				break;
-		}
+		unsigned int i = script_array_find_member(sa, index);
 
 		// if existent
 		if( i != sa->size ) {
@@ -3092,6 +3679,7 @@ void script_array_update(struct reg_db *src, int64 num, bool empty)
 		sa = ers_alloc(array_ers, struct script_array);
 		sa->id = id;
 		sa->members = NULL;
+		sa->max_members = 0;
 		sa->size = 0;
 		script_array_add_member(sa,index);
 		idb_put(src->arrays, id, sa);
@@ -3111,46 +3699,58 @@ void script_array_update(struct reg_db *src, int64 num, bool empty)
  *
  * TODO: return values are screwed up, have been for some time (reaad: years), e.g. some functions return 1 failure and success.
  *------------------------------------------*/
+/// Returns the variables of a reg_db, they are created on the first write.
+/// Script states and scripts start without variables, since most of them never set one.
+static struct DBMap* script_reg_vars(struct reg_db* ref)
+{
+	if( ref->vars == NULL )
+		ref->vars = i64db_alloc(DB_OPT_RELEASE_DATA);
+	return ref->vars;
+}
+
 int set_reg(struct script_state* st, struct map_session_data* sd, int64 num, const char* name, const void* value, struct reg_db *ref)
 {
-	char prefix = name[0];
-	size_t vlen = 0;
-	if ( !script_check_RegistryVariableLength(0,name,&vlen) )
+	// scope and type were resolved when the name was added
+	const struct str_data_struct* var = &str_data[script_getvarid(num)];
+
+	if ( var->len >= 33 ) // see script_check_RegistryVariableLength
 	{
-		ShowError("set_reg: Variable name length is too long (aid: %d, cid: %d): '%s' sz=%" PRIuPTR "\n", sd?sd->status.account_id:-1, sd?sd->status.char_id:-1, name, vlen);
+		ShowError("set_reg: Variable name length is too long (aid: %d, cid: %d): '%s' sz=%d\n", sd?sd->status.account_id:-1, sd?sd->status.char_id:-1, name, var->len);
 		return 0;
 	}
 
-	if( is_string_variable(name) ) {// string variable
+	if( var->var_string ) {// string variable
 		const char *str = (const char*)value;
 
-		switch (prefix) {
-			case '@':
+		switch (var->var_scope) {
+			case SCRIPT_VAR_CHAR_TEMP:
 				pc_setregstr(sd, num, str);
 				return 1;
-			case '$':
+			case SCRIPT_VAR_MAP:
 				return mapreg_setregstr(num, str);
-			case '#':
-				return (name[1] == '#') ?
-					pc_setaccountreg2str(sd, num, str) :
-					pc_setaccountregstr(sd, num, str);
-			case '.':
+			case SCRIPT_VAR_ACCOUNT_GLOBAL:
+				return pc_setaccountreg2str(sd, num, str);
+			case SCRIPT_VAR_ACCOUNT:
+				return pc_setaccountregstr(sd, num, str);
+			case SCRIPT_VAR_NPC:
+			case SCRIPT_VAR_SCOPE:
 				{
-					struct reg_db *n = (ref) ? ref : (name[1] == '@') ? &st->stack->scope : &st->script->local;
+					struct reg_db *n = (ref) ? ref : (var->var_scope == SCRIPT_VAR_SCOPE) ? &st->stack->scope : &st->script->local;
 					if( n ) {
 						if (str[0])  {
-							i64db_put(n->vars, num, aStrdup(str));
+							i64db_put(script_reg_vars(n), num, aStrdup(str));
 							if( script_getvaridx(num) )
 								script_array_update(n, num, false);
 						} else {
-							i64db_remove(n->vars, num);
+							if( n->vars )
+								i64db_remove(n->vars, num);
 							if( script_getvaridx(num) )
 								script_array_update(n, num, true);
 						}
 					}
 				}
 				return 1;
-			case '\'':
+			case SCRIPT_VAR_INSTANCE:
 				{
 					struct reg_db *src = nullptr;
 					if (ref)
@@ -3183,8 +3783,8 @@ int set_reg(struct script_state* st, struct map_session_data* sd, int64 num, con
 	} else {// integer variable
 		int val = (int)__64BPRTSIZE(value);
 
-		if(str_data[script_getvarid(num)].type == C_PARAM) {
-			if( pc_setparam(sd, str_data[script_getvarid(num)].val, val) == 0 ) {
+		if(var->type == C_PARAM) {
+			if( pc_setparam(sd, var->val, val) == 0 ) {
 				if( st != NULL ) {
 					ShowError("script_set_reg: failed to set param '%s' to %d.\n", name, val);
 					script_reportsrc(st);
@@ -3195,33 +3795,35 @@ int set_reg(struct script_state* st, struct map_session_data* sd, int64 num, con
 			return 1;
 		}
 
-		switch (prefix) {
-			case '@':
+		switch (var->var_scope) {
+			case SCRIPT_VAR_CHAR_TEMP:
 				pc_setreg(sd, num, val);
 				return 1;
-			case '$':
+			case SCRIPT_VAR_MAP:
 				return mapreg_setreg(num, val);
-			case '#':
-				return (name[1] == '#') ?
-					pc_setaccountreg2(sd, num, val) :
-					pc_setaccountreg(sd, num, val);
-			case '.':
+			case SCRIPT_VAR_ACCOUNT_GLOBAL:
+				return pc_setaccountreg2(sd, num, val);
+			case SCRIPT_VAR_ACCOUNT:
+				return pc_setaccountreg(sd, num, val);
+			case SCRIPT_VAR_NPC:
+			case SCRIPT_VAR_SCOPE:
 				{
-					struct reg_db *n = (ref) ? ref : (name[1] == '@') ? &st->stack->scope : &st->script->local;
+					struct reg_db *n = (ref) ? ref : (var->var_scope == SCRIPT_VAR_SCOPE) ? &st->stack->scope : &st->script->local;
 					if( n ) {
 						if( val != 0 ) {
-							i64db_iput(n->vars, num, val);
+							i64db_iput(script_reg_vars(n), num, val);
 							if( script_getvaridx(num) )
 								script_array_update(n, num, false);
 						} else {
-							i64db_remove(n->vars, num);
+							if( n->vars )
+								i64db_remove(n->vars, num);
 							if( script_getvaridx(num) )
 								script_array_update(n, num, true);
 						}
 					}
 				}
 				return 1;
-			case '\'':
+			case SCRIPT_VAR_INSTANCE:
 				{
 					struct reg_db *src = nullptr;
 					if (ref)
@@ -3387,6 +3989,55 @@ void stack_expand(struct script_stack* stack)
 			64 * sizeof(stack->stack_data[0]) );
 }
 
+/// Amount of freed script stacks that are kept for reuse
+#define SCRIPT_STACK_POOL_SIZE 256
+/// Stacks with more entries are not kept for reuse
+#define SCRIPT_STACK_POOL_MAXSP 256
+
+/// Stacks of freed script states, reused together with their stack data by the next script states
+static std::vector<struct script_stack*> script_stack_pool;
+
+/// Gets an empty stack from the pool or allocates a new one
+static struct script_stack* script_stack_alloc(void)
+{
+	struct script_stack* stack;
+
+	if( !script_stack_pool.empty() ) {
+		stack = script_stack_pool.back();
+		script_stack_pool.pop_back();
+	} else {
+		stack = ers_alloc(stack_ers, struct script_stack);
+		stack->sp_max = 64;
+		CREATE(stack->stack_data, struct script_data, stack->sp_max);
+	}
+	stack->sp = 0;
+	stack->defsp = 0;
+	stack->scope.vars = NULL; // created on the first write, see script_reg_vars
+	stack->scope.arrays = NULL;
+	return stack;
+}
+
+/// Returns an emptied stack to the pool, stacks that grew very large are freed instead
+static void script_stack_free(struct script_stack* stack)
+{
+	if( script_stack_pool.size() < SCRIPT_STACK_POOL_SIZE && stack->sp_max <= SCRIPT_STACK_POOL_MAXSP ) {
+		script_stack_pool.push_back(stack);
+		return;
+	}
+	aFree(stack->stack_data);
+	ers_free(stack_ers, stack);
+}
+
+/// Frees the pooled stacks
+static void script_stack_pool_clear(void)
+{
+	for( struct script_stack* stack : script_stack_pool ) {
+		aFree(stack->stack_data);
+		ers_free(stack_ers, stack);
+	}
+	script_stack_pool.clear();
+}
+
 /// Pushes a value into the stack
 #define push_val(stack,type,val) push_val2(stack, type, val, NULL)
 
@@ -3543,7 +4194,10 @@ void script_free_code(struct script_code* code)
 	script_free_vars(code->local.vars);
 	if (code->local.arrays)
 		code->local.arrays->destroy(code->local.arrays, script_free_array_db);
+	script_profile_forget(code);
 	aFree(code->script_buf);
+	aFree(code->insns);
+	aFree(code->bonuses);
 	aFree(code);
 }
 
@@ -3559,16 +4213,12 @@ struct script_state* script_alloc_state(struct script_code* rootscript, int pos,
 	struct script_state* st;
 
 	st = ers_alloc(st_ers, struct script_state);
-	st->stack = ers_alloc(stack_ers, struct script_stack);
-	st->stack->sp = 0;
-	st->stack->sp_max = 64;
-	CREATE(st->stack->stack_data, struct script_data, st->stack->sp_max);
-	st->stack->defsp = st->stack->sp;
-	st->stack->scope.vars = i64db_alloc(DB_OPT_RELEASE_DATA);
-	st->stack->scope.arrays = NULL;
+	st->stack = script_stack_alloc();
 	st->state = RUN;
 	st->script = rootscript;
 	st->pos = pos;
+	st->entry_pos = pos;
+	st->timeslice = 0;
 	st->rid = rid;
 	st->oid = oid;
 	st->sleep.timer = INVALID_TIMER;
@@ -3582,9 +4232,6 @@ struct script_state* script_alloc_state(struct script_code* rootscript, int pos,
 		ShowError("Over 65k instances of '%s' script are being run!\n",nd ? nd->name : "unknown");
 	}
 
-	if (!st->script->local.vars)
-		st->script->local.vars = i64db_alloc(DB_OPT_RELEASE_DATA);
-
 	st->id = next_id++;
 	active_scripts++;
 
@@ -3620,8 +4267,7 @@ void script_free_state(struct script_state* st)
 			if (st->stack->scope.arrays)
 				st->stack->scope.arrays->destroy(st->stack->scope.arrays, script_free_array_db);
 			pop_stack(st, 0, st->stack->sp);
-			aFree(st->stack->stack_data);
-			ers_free(stack_ers, st->stack);
+			script_stack_free(st->stack);
 			st->stack = NULL;
 		}
 		if (st->script && st->script->instances != USHRT_MAX && --st->script->instances == 0) {
@@ -3997,13 +4643,209 @@ static void script_check_buildin_argtype(struct script_state* st, int func)
 		}
 	}
 
-	if(invalid)
-	{
-		ShowDebug("Function: %s\n", get_str(func));
-		script_reportsrc(st);
+	if(invalid)
+	{
+		ShowDebug("Function: %s\n", get_str(func));
+		script_reportsrc(st);
+	}
+}
+
+
+/*==========================================
+ * Script profiler
+ *------------------------------------------*/
+
+/// Statistics of the scripts started at a label of a NPC
+struct s_script_profile_entry {
+	uint64 runs; ///< calls of run_script_main, including resumptions
+	uint64 resumes; ///< runs that continued after sleep, dialogs or menus
+	uint64 instructions;
+	uint64 time; ///< microseconds spent in run_script_main
+	uint64 buildin_calls;
+	uint64 buildin_time; ///< microseconds spent in buildin functions
+};
+
+/// Statistics of a buildin function
+struct s_script_profile_buildin {
+	uint64 calls;
+	uint64 time; ///< microseconds
+};
+
+static bool script_profiling = false;
+static time_t script_profile_started;
+static unsigned int script_profile_generation = 0; ///< changes when the statistics are reset, measurements of older generations are dropped
+static std::unordered_map<std::string, struct s_script_profile_entry> script_profile_entries;
+static std::vector<struct s_script_profile_buildin> script_profile_buildins; ///< indexed like buildin_func
+static struct s_script_profile_entry* script_profile_current = nullptr; ///< entry of the running script
+static std::map<std::pair<const struct script_code*, int>, struct s_script_profile_entry*> script_profile_cache; ///< entries by script and start position
+
+static inline uint64 script_profile_now(void)
+{
+	return (uint64)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// Returns the profiler entry of the NPC and label the script was started at.
+static struct s_script_profile_entry* script_profile_entry(struct script_state* st)
+{
+	auto cached = script_profile_cache.find(std::make_pair((const struct script_code*)st->script, st->entry_pos));
+
+	if( cached != script_profile_cache.end() )
+		return cached->second;
+
+	struct npc_data* nd = map_id2nd(st->oid);
+	char label[NAME_LENGTH+16];
+	std::string key;
+
+	if( st->entry_pos == 0 )
+		safestrncpy(label, "(main)", sizeof(label));
+	else
+		safesnprintf(label, sizeof(label), "(pos %d)", st->entry_pos);
+
+	if( nd != nullptr ) {
+		if( nd->subtype == NPCTYPE_SCRIPT ) {
+			for( int i = 0; i < nd->u.scr.label_list_num; i++ ) {
+				if( nd->u.scr.label_list[i].pos == st->entry_pos ) {
+					safestrncpy(label, nd->u.scr.label_list[i].name, sizeof(label));
+					break;
+				}
+			}
+		}
+		key = nd->exname;
+	} else
+		key = "(no npc)";
+	key += "::";
+	key += label;
+
+	struct s_script_profile_entry* entry = &script_profile_entries[key];
+
+	script_profile_cache[std::make_pair((const struct script_code*)st->script, st->entry_pos)] = entry;
+	return entry;
+}
+
+/// Drops the cached profiler entries of a script that is freed.
+static void script_profile_forget(struct script_code* code)
+{
+	auto it = script_profile_cache.lower_bound(std::make_pair((const struct script_code*)code, INT_MIN));
+
+	while( it != script_profile_cache.end() && it->first.first == code )
+		it = script_profile_cache.erase(it);
+}
+
+/// Runs a buildin function and measures it.
+static int script_profile_buildin(struct script_state* st, int func)
+{
+	unsigned int generation = script_profile_generation;
+	uint64 start = script_profile_now();
+	int ret = str_data[func].func(st);
+	uint64 time = script_profile_now() - start;
+	size_t i = (size_t)str_data[func].val;
+
+	if( generation != script_profile_generation || !script_profiling )
+		return ret; // reset while running (by atcommand or a nested script)
+
+	if( i >= script_profile_buildins.size() )
+		script_profile_buildins.resize(i + 1);
+	script_profile_buildins[i].calls++;
+	script_profile_buildins[i].time += time;
+	if( script_profile_current != nullptr ) {
+		script_profile_current->buildin_calls++;
+		script_profile_current->buildin_time += time;
 	}
+	return ret;
+}
+
+/// Starts collecting script statistics, previous statistics are discarded.
+void script_profile_start(void)
+{
+	script_profile_entries.clear();
+	script_profile_cache.clear();
+	script_profile_buildins.clear();
+	script_profile_current = nullptr;
+	script_profile_generation++;
+	script_profile_started = time(NULL);
+	script_profiling = true;
+	ShowStatus("Script profiler started.\n");
+}
+
+/// Stops collecting script statistics, they are kept for script_profile_report.
+void script_profile_stop(void)
+{
+	if( !script_profiling )
+		return;
+	script_profiling = false;
+	script_profile_current = nullptr;
+	script_profile_generation++;
+	ShowStatus("Script profiler stopped.\n");
+}
+
+bool script_profile_isactive(void)
+{
+	return script_profiling;
 }
 
+/// Writes the collected statistics sorted by time to a file and displays the top of the lists.
+/// @param file File for the report, NULL or empty to only display it
+/// @return false if the file could not be written
+bool script_profile_report(const char* file)
+{
+	std::vector<std::pair<const std::string*, const struct s_script_profile_entry*>> entries;
+	std::vector<size_t> buildins;
+	FILE* fp = nullptr;
+	char timestr[32];
+
+	entries.reserve(script_profile_entries.size());
+	for( const auto& it : script_profile_entries )
+		entries.push_back(std::make_pair(&it.first, &it.second));
+	std::sort(entries.begin(), entries.end(), [](const std::pair<const std::string*, const struct s_script_profile_entry*>& a, const std::pair<const std::string*, const struct s_script_profile_entry*>& b) {
+		return a.second->time > b.second->time;
+	});
+	for( size_t i = 0; i < script_profile_buildins.size(); i++ ) {
+		if( script_profile_buildins[i].calls )
+			buildins.push_back(i);
+	}
+	std::sort(buildins.begin(), buildins.end(), [](size_t a, size_t b) {
+		return script_profile_buildins[a].time > script_profile_buildins[b].time;
+	});
+
+	if( file != nullptr && file[0] != '\0' && ( fp = fopen(file, "w") ) == nullptr ) {
+		ShowError("script_profile_report: Could not open '%s' for writing.\n", file);
+		return false;
+	}
+
+	strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", localtime(&script_profile_started));
+	ShowInfo("Script profile since %s%s: %" PRIuPTR " NPC labels, %" PRIuPTR " buildin functions\n", timestr, script_profiling ? "" : " (stopped)", entries.size(), buildins.size());
+	ShowMessage(CL_WHITE "%-40s %10s %8s %12s %10s %10s %10s" CL_RESET "\n", "NPC::label", "runs", "resumes", "instructions", "time(ms)", "buildins", "b.time(ms)");
+	if( fp != nullptr ) {
+		fprintf(fp, "Script profile since %s\n\n", timestr);
+		fprintf(fp, "%-48s %10s %8s %14s %12s %12s %12s\n", "NPC::label", "runs", "resumes", "instructions", "time(ms)", "buildins", "b.time(ms)");
+	}
+	for( size_t i = 0; i < entries.size(); i++ ) {
+		const struct s_script_profile_entry* e = entries[i].second;
+
+		if( i < 10 )
+			ShowMessage("%-40s %10" PRIu64 " %8" PRIu64 " %12" PRIu64 " %10.1f %10" PRIu64 " %10.1f\n", entries[i].first->c_str(), e->runs, e->resumes, e->instructions, e->time / 1000., e->buildin_calls, e->buildin_time / 1000.);
+		if( fp != nullptr )
+			fprintf(fp, "%-48s %10" PRIu64 " %8" PRIu64 " %14" PRIu64 " %12.1f %12" PRIu64 " %12.1f\n", entries[i].first->c_str(), e->runs, e->resumes, e->instructions, e->time / 1000., e->buildin_calls, e->buildin_time / 1000.);
+	}
+
+	ShowMessage(CL_WHITE "%-40s %10s %10s %10s" CL_RESET "\n", "buildin", "calls", "time(ms)", "avg(us)");
+	if( fp != nullptr )
+		fprintf(fp, "\n%-48s %10s %12s %10s\n", "buildin", "calls", "time(ms)", "avg(us)");
+	for( size_t i = 0; i < buildins.size(); i++ ) {
+		const struct s_script_profile_buildin* b = &script_profile_buildins[buildins[i]];
+
+		if( i < 10 )
+			ShowMessage("%-40s %10" PRIu64 " %10.1f %10.1f\n", buildin_func[buildins[i]].name, b->calls, b->time / 1000., (double)b->time / b->calls);
+		if( fp != nullptr )
+			fprintf(fp, "%-48s %10" PRIu64 " %12.1f %10.1f\n", buildin_func[buildins[i]].name, b->calls, b->time / 1000., (double)b->time / b->calls);
+	}
+
+	if( fp != nullptr ) {
+		fclose(fp);
+		ShowStatus("Script profile written to '" CL_WHITE "%s" CL_RESET "'.\n", file);
+	}
+	return true;
+}
 
 /// Executes a buildin command.
 /// Stack: C_NAME(<command>) C_ARG <arg0> <arg1> ... <argN>
@@ -4051,7 +4893,7 @@ int run_func(struct script_state *st)
 		}
 #endif
 
-		if (str_data[func].func(st) == SCRIPT_CMD_FAILURE) //Report error
+		if ((script_profiling ? script_profile_buildin(st, func) : str_data[func].func(st)) == SCRIPT_CMD_FAILURE) //Report error
 			script_reportsrc(st);
 	} else {
 		ShowError("script:run_func: '%s' (id=%d type=%s) has no C function. please report this!!!\n", get_str(func), func, script_op2name(str_data[func].type));
@@ -4078,7 +4920,8 @@ int run_func(struct script_state *st)
 			return 1;
 		}
 		script_free_vars(st->stack->scope.vars);
-		st->stack->scope.arrays->destroy(st->stack->scope.arrays, script_free_array_db);
+		if (st->stack->scope.arrays)
+			st->stack->scope.arrays->destroy(st->stack->scope.arrays, script_free_array_db);
 
 		ri = st->stack->stack_data[st->stack->defsp-1].u.ri;
 		nargs = ri->nargs;
@@ -4107,6 +4950,14 @@ void run_script(struct script_code *rootscript, int pos, int rid, int oid)
 	if( rootscript == NULL || pos < 0 )
 		return;
 
+	// bonus scripts (item, combo, pet) are applied without running them
+	if( rootscript->bonus_count >= 0 && pos == 0 && oid == 0 && !script_profiling ) {
+		struct map_session_data* sd = map_id2sd(rid);
+
+		if( sd != NULL && script_bonus_apply(rootscript, sd) )
+			return;
+	}
+
 	// TODO In jAthena, this function can take over the pending script in the player. [FlavioJS]
 	//      It is unclear how that can be triggered, so it needs the be traced/checked in more detail.
 	// NOTE At the time of this change, this function wasn't capable of taking over the script state because st->scriptroot was never set.
@@ -4282,18 +5133,252 @@ void script_attach_state(struct script_state* st){
 	}
 }
 
+/// Decodes the byte code of the script into fixed-width instructions.
+/// @see run_script_main
+static void script_decode(struct script_code* code)
+{
+	int pos = 0, n = 0;
+
+	// every instruction takes at least one byte, the array is shrunk afterwards
+	CREATE(code->insns, struct script_insn, code->script_size);
+	while( pos < code->script_size ) {
+		struct script_insn* insn = &code->insns[n++];
+
+		insn->pos = pos;
+		insn->op = get_com(code->script_buf, &pos);
+		switch( insn->op ) {
+		case C_INT:
+			insn->value = get_num(code->script_buf, &pos);
+			break;
+		case C_POS:
+		case C_NAME:
+			insn->value = GETVALUE(code->script_buf, pos);
+			pos += 3;
+			break;
+		case C_STR:
+			insn->value = pos;
+			pos += (int)strlen((char*)code->script_buf + pos) + 1;
+			break;
+		default:
+			insn->value = 0;
+			break;
+		}
+	}
+	code->insn_count = n;
+	RECREATE(code->insns, struct script_insn, max(n, 1));
+}
+
+/// Returns the index of the instruction at position pos of the script, or -1 if pos is not the start of an instruction.
+static int script_insn_find(struct script_code* code, int pos)
+{
+	int min = 0, max = code->insn_count - 1;
+
+	while( min <= max ) {
+		int mid = (min + max) / 2;
+
+		if( code->insns[mid].pos < pos )
+			min = mid + 1;
+		else if( code->insns[mid].pos > pos )
+			max = mid - 1;
+		else
+			return mid;
+	}
+	return -1;
+}
+
+/// Compiles scripts that only consist of bonus commands with constant values (like most item scripts) into a list of bonuses.
+/// run_script applies these with pc_bonus* instead of running the script.
+static void script_bonus_compile(struct script_code* code)
+{
+	std::vector<struct script_bonus> bonuses;
+	int i = 0;
+
+	code->bonuses = NULL;
+	code->bonus_count = -1;
+
+	while( i < code->insn_count ) {
+		const struct script_insn* insn = &code->insns[i];
+		struct script_bonus bonus = {};
+		int func, values = 0;
+
+		if( insn->op == C_EOL ) {
+			i++;
+			continue;
+		}
+		if( insn->op == C_NOP && i == code->insn_count - 1 )
+			break; // end of the script
+		if( insn->op != C_NAME || i + 1 >= code->insn_count || insn[1].op != C_ARG )
+			return;
+		ARR_FIND(0, (int)ARRAYLENGTH(buildin_bonus_ref), func, buildin_bonus_ref[func] == insn->value);
+		if( func == (int)ARRAYLENGTH(buildin_bonus_ref) )
+			return;
+
+		// bonus type and values
+		for( i += 2; i < code->insn_count && code->insns[i].op == C_INT; i++ ) {
+			int val = code->insns[i].value;
+
+			if( i + 1 < code->insn_count && code->insns[i + 1].op == C_NEG ) {
+				val = -val;
+				i++;
+			}
+			if( values == 0 )
+				bonus.type = val;
+			else if( values <= (int)ARRAYLENGTH(bonus.val) )
+				bonus.val[values - 1] = val;
+			values++;
+		}
+		if( i + 1 >= code->insn_count || code->insns[i].op != C_FUNC || code->insns[i + 1].op != C_EOL )
+			return;
+		i += 2;
+
+		bonus.count = values - 1;
+		if( bonus.count != func + 1 && !( func == 0 && bonus.count == 0 ) ) // bonus has an optional value
+			return;
+		bonuses.push_back(bonus);
+	}
+
+	code->bonus_count = (int)bonuses.size();
+	if( code->bonus_count > 0 ) {
+		CREATE(code->bonuses, struct script_bonus, code->bonus_count);
+		memcpy(code->bonuses, bonuses.data(), code->bonus_count * sizeof(struct script_bonus));
+	}
+}
+
+/// Fetches the instruction at st->pos and moves st->pos behind it.
+/// Jumps and calls only set st->pos and st->script, the instruction index is looked up again in that case.
+/// @param code Script of the last fetch
+/// @param ip Index of the next instruction in code
+/// @return Instruction or NULL if st->pos is invalid (the script is ended)
+static inline const struct script_insn* script_fetch(struct script_state* st, struct script_code** code, int* ip)
+{
+	const struct script_insn* insn;
+
+	if( st->script != *code ) {
+		*code = st->script;
+		*ip = 0;
+	}
+	if( *ip >= (*code)->insn_count || (*code)->insns[*ip].pos != st->pos ) {
+		if( (*ip = script_insn_find(*code, st->pos)) < 0 ) {
+			ShowError("script:run_script_main: invalid script position %d\n", st->pos);
+			script_reportsrc(st);
+			st->state = END;
+			return NULL;
+		}
+	}
+	insn = &(*code)->insns[(*ip)++];
+	st->pos = ( *ip < (*code)->insn_count ) ? (*code)->insns[*ip].pos : (*code)->script_size;
+	return insn;
+}
+
+/// Instruction budget of run_script_main.
+/// Only a countdown is decremented per instruction, the infinity loop check,
+/// the time slice and the profiler are updated when it runs out or after a buildin.
+struct s_script_steps {
+	int countdown; ///< instructions left until the next update
+	int chunk; ///< length of the current countdown
+	unsigned int executed; ///< instructions executed before the current countdown
+	int cmdcount; ///< instructions left until the infinity loop check triggers
+	bool yield; ///< time slice is used up
+};
+
+/// Adds the instructions of the current countdown and starts the next one.
+/// @return true if the script continues to run
+static bool script_steps_sync(struct script_state* st, struct s_script_steps* steps)
+{
+	int used = steps->chunk - steps->countdown;
+	int next = INT_MAX;
+
+	steps->executed += used;
+	if( !st->freeloop && steps->cmdcount > 0 ) {
+		steps->cmdcount -= used;
+		if( steps->cmdcount <= 0 ) {
+			ShowError("script:run_script_main: infinity loop !\n");
+			script_reportsrc(st);
+			st->state = END;
+		} else
+			next = steps->cmdcount;
+	}
+	if( st->timeslice > 0 && !steps->yield ) {
+		if( steps->executed >= (unsigned int)st->timeslice )
+			steps->yield = true;
+		else
+			next = min(next, (int)((unsigned int)st->timeslice - steps->executed));
+	}
+	steps->chunk = steps->countdown = next;
+	return st->state == RUN;
+}
+
+/// Counts an executed instruction.
+/// @return true if the script continues to run
+static inline bool script_step(struct script_state* st, struct s_script_steps* steps)
+{
+	if( --steps->countdown <= 0 && !script_steps_sync(st, steps) )
+		return false;
+	return st->state == RUN;
+}
+
+#ifdef SCRIPT_THREADED_DISPATCH
+	// every handler jumps directly to the handler of the next instruction
+	#define SCRIPT_DISPATCH(insn) goto *( (insn)->op <= C_SUB_PRE ? dispatch[(insn)->op] : &&op_default );
+	#define SCRIPT_OP(c) op_##c
+	#define SCRIPT_OP_DEFAULT op_default
+	#define SCRIPT_NEXT() \
+		do { \
+			if( !script_step(st, &steps) || (insn = script_fetch(st, &code, &ip)) == NULL ) \
+				goto script_stop; \
+			SCRIPT_DISPATCH(insn) \
+		} while(0)
+#else
+	#define SCRIPT_DISPATCH(insn) switch( (insn)->op ) {
+	#define SCRIPT_OP(c) case c
+	#define SCRIPT_OP_DEFAULT default
+	#define SCRIPT_NEXT() break
+#endif
+
 /*==========================================
  * The main part of the script execution
  *------------------------------------------*/
 void run_script_main(struct script_state *st)
 {
-	int cmdcount = script_config.check_cmdcount;
 	int gotocount = script_config.check_gotocount;
 	TBL_PC *sd;
 	struct script_stack *stack = st->stack;
+	struct script_code *code = NULL;
+	const struct script_insn *insn;
+	int ip = 0;
+	struct s_script_steps steps = {};
+	struct s_script_profile_entry *prof = nullptr, *prof_parent = nullptr;
+	unsigned int prof_generation = 0;
+	uint64 prof_start = 0;
+#ifdef SCRIPT_THREADED_DISPATCH
+	// handlers in the order of enum c_op
+	static const void* const dispatch[] = {
+		&&op_C_NOP, &&op_C_POS, &&op_C_INT, &&op_default, &&op_C_FUNC, &&op_C_STR, &&op_default, &&op_C_ARG,
+		&&op_C_NAME, &&op_C_EOL, &&op_default, &&op_default, &&op_default, &&op_C_REF, &&op_C_OP3,
+		&&op_C_LOR, &&op_C_LAND, &&op_C_LE, &&op_C_LT, &&op_C_GE, &&op_C_GT, &&op_C_EQ, &&op_C_NE,
+		&&op_C_XOR, &&op_C_OR, &&op_C_AND, &&op_C_ADD, &&op_C_SUB, &&op_C_MUL, &&op_C_DIV, &&op_C_MOD,
+		&&op_C_NEG, &&op_C_LNOT, &&op_C_NOT, &&op_C_R_SHIFT, &&op_C_L_SHIFT,
+		&&op_default, &&op_default, &&op_default, &&op_default,
+	};
+	static_assert(ARRAYLENGTH(dispatch) == C_SUB_PRE + 1, "dispatch table does not match enum c_op");
+#endif
 
 	script_attach_state(st);
 
+	steps.cmdcount = script_config.check_cmdcount;
+	script_steps_sync(st, &steps);
+
+	if( script_profiling ) {
+		prof = script_profile_entry(st);
+		prof->runs++;
+		if( st->state == RERUNLINE || st->pos != st->entry_pos )
+			prof->resumes++;
+		prof_parent = script_profile_current;
+		prof_generation = script_profile_generation;
+		script_profile_current = prof;
+		prof_start = script_profile_now();
+	}
+
 	if(st->state == RERUNLINE) {
 		run_func(st);
 		if(st->state == GOTO)
@@ -4301,32 +5386,35 @@ void run_script_main(struct script_state *st)
 	} else if(st->state != END)
 		st->state = RUN;
 
-	while(st->state == RUN) {
-		enum c_op c = get_com(st->script->script_buf,&st->pos);
-		switch(c){
-		case C_EOL:
+	while(st->state == RUN && (insn = script_fetch(st, &code, &ip)) != NULL) {
+		SCRIPT_DISPATCH(insn)
+		SCRIPT_OP(C_EOL):
 			if( stack->defsp > stack->sp )
 				ShowError("script:run_script_main: unexpected stack position (defsp=%d sp=%d). please report this!!!\n", stack->defsp, stack->sp);
 			else
 				pop_stack(st, stack->defsp, stack->sp);// pop unused stack data. (unused return value)
-			break;
-		case C_INT:
-			push_val(stack,C_INT,get_num(st->script->script_buf,&st->pos));
-			break;
-		case C_POS:
-		case C_NAME:
-			push_val(stack,c,GETVALUE(st->script->script_buf,st->pos));
-			st->pos+=3;
-			break;
-		case C_ARG:
-			push_val(stack,c,0);
-			break;
-		case C_STR:
-			push_str(stack,C_CONSTSTR,(char*)(st->script->script_buf+st->pos));
-			while(st->script->script_buf[st->pos++]);
-			break;
-		case C_FUNC:
+			if( steps.yield && st->state == RUN ) {
+				// time slice used up, continue in the next server tick through the sleep timer
+				st->state = STOP;
+				st->sleep.tick = 1;
+			}
+			SCRIPT_NEXT();
+		SCRIPT_OP(C_INT):
+			push_val(stack,C_INT,insn->value);
+			SCRIPT_NEXT();
+		SCRIPT_OP(C_POS):
+		SCRIPT_OP(C_NAME):
+			push_val(stack,insn->op,insn->value);
+			SCRIPT_NEXT();
+		SCRIPT_OP(C_ARG):
+			push_val(stack,C_ARG,0);
+			SCRIPT_NEXT();
+		SCRIPT_OP(C_STR):
+			push_str(stack,C_CONSTSTR,(char*)(code->script_buf+insn->value));
+			SCRIPT_NEXT();
+		SCRIPT_OP(C_FUNC):
 			run_func(st);
+			script_steps_sync(st, &steps); // the buildin may have changed freeloop or timeslice
 			if(st->state==GOTO){
 				st->state = RUN;
 				if( !st->freeloop && gotocount>0 && (--gotocount)<=0 ){
@@ -4335,57 +5423,67 @@ void run_script_main(struct script_state *st)
 					st->state=END;
 				}
 			}
-			break;
+			SCRIPT_NEXT();
 
-		case C_REF:
+		SCRIPT_OP(C_REF):
 			st->op2ref = 1;
-			break;
-
-		case C_NEG:
-		case C_NOT:
-		case C_LNOT:
-			op_1(st ,c);
-			break;
-
-		case C_ADD:
-		case C_SUB:
-		case C_MUL:
-		case C_DIV:
-		case C_MOD:
-		case C_EQ:
-		case C_NE:
-		case C_GT:
-		case C_GE:
-		case C_LT:
-		case C_LE:
-		case C_AND:
-		case C_OR:
-		case C_XOR:
-		case C_LAND:
-		case C_LOR:
-		case C_R_SHIFT:
-		case C_L_SHIFT:
-			op_2(st, c);
-			break;
-
-		case C_OP3:
-			op_3(st, c);
-			break;
-
-		case C_NOP:
+			SCRIPT_NEXT();
+
+		SCRIPT_OP(C_NEG):
+		SCRIPT_OP(C_NOT):
+		SCRIPT_OP(C_LNOT):
+			op_1(st ,insn->op);
+			SCRIPT_NEXT();
+
+		SCRIPT_OP(C_ADD):
+		SCRIPT_OP(C_SUB):
+		SCRIPT_OP(C_MUL):
+		SCRIPT_OP(C_DIV):
+		SCRIPT_OP(C_MOD):
+		SCRIPT_OP(C_EQ):
+		SCRIPT_OP(C_NE):
+		SCRIPT_OP(C_GT):
+		SCRIPT_OP(C_GE):
+		SCRIPT_OP(C_LT):
+		SCRIPT_OP(C_LE):
+		SCRIPT_OP(C_AND):
+		SCRIPT_OP(C_OR):
+		SCRIPT_OP(C_XOR):
+		SCRIPT_OP(C_LAND):
+		SCRIPT_OP(C_LOR):
+		SCRIPT_OP(C_R_SHIFT):
+		SCRIPT_OP(C_L_SHIFT):
+			op_2(st, insn->op);
+			SCRIPT_NEXT();
+
+		SCRIPT_OP(C_OP3):
+			op_3(st, insn->op);
+			SCRIPT_NEXT();
+
+		SCRIPT_OP(C_NOP):
 			st->state=END;
-			break;
+			SCRIPT_NEXT();
 
-		default:
-			ShowError("script:run_script_main:unknown command : %d @ %d\n",c,st->pos);
-			st->state=END;
-			break;
-		}
-		if( !st->freeloop && cmdcount>0 && (--cmdcount)<=0 ){
-			ShowError("script:run_script_main: infinity loop !\n");
-			script_reportsrc(st);
+		SCRIPT_OP_DEFAULT:
+			ShowError("script:run_script_main:unknown command : %d @ %d\n",insn->op,insn->pos);
 			st->state=END;
+			SCRIPT_NEXT();
+#ifndef SCRIPT_THREADED_DISPATCH
 		}
+		script_step(st, &steps);
+#endif
+	}
+#ifdef SCRIPT_THREADED_DISPATCH
+script_stop:
+#endif
+
+	if( prof != nullptr ) {
+		if( prof_generation == script_profile_generation ) {
+			prof->instructions += steps.executed + steps.chunk - steps.countdown;
+			prof->time += script_profile_now() - prof_start;
+			script_profile_current = prof_parent;
+		} else // reset while running
+			script_profile_current = nullptr;
 	}
 
 	if(st->sleep.tick > 0) {
@@ -4473,6 +5571,12 @@ int script_config_read(const char *cfgName)
 		else if(strcmpi(w1,"warn_func_mismatch_argtypes")==0) {
 			script_config.warn_func_mismatch_argtypes = config_switch(w2);
 		}
+		else if(strcmpi(w1,"npc_script_cache")==0) {
+			script_cache_enabled = config_switch(w2) != 0;
+		}
+		else if(strcmpi(w1,"npc_script_cache_file")==0) {
+			safestrncpy(script_cache_file, w2, sizeof(script_cache_file));
+		}
 		else if(strcmpi(w1,"import")==0){
 			script_config_read(w2);
 		}
@@ -4627,7 +5731,13 @@ unsigned int *script_array_cpy_list(struct script_array *sa)
 {
 	if( sa->size > generic_ui_array_size )
 		script_generic_ui_array_expand(sa->size);
-	memcpy(generic_ui_array, sa->members, sizeof(unsigned int)*sa->size);
+	if( sa->members == NULL ) { // dense
+		unsigned int i;
+
+		for(i = 0; i < sa->size; i++)
+			generic_ui_array[i] = i;
+	} else
+		memcpy(generic_ui_array, sa->members, sizeof(unsigned int)*sa->size);
 	return generic_ui_array;
 }
 
@@ -4727,6 +5837,8 @@ void do_final_script() {
 	if( atcmd_binding_count != 0 )
 		aFree(atcmd_binding);
 
+	script_stack_pool_clear();
+	script_cache_clear();
 	ers_destroy(st_ers);
 	ers_destroy(stack_ers);
 	db_destroy(st_db);
@@ -4760,6 +5872,7 @@ void script_reload(void) {
 
 	userfunc_db->clear(userfunc_db, db_script_free_code_sub);
 	db_clear(scriptlabel_db);
+	script_cache_clear();
 
 	// @commands (script based)
 	// Clear bindings
@@ -5268,6 +6381,19 @@ BUILDIN_FUNC(goto)
 	return SCRIPT_CMD_SUCCESS;
 }
 
+/// Sets up the reference of callfunc/callsub arguments to the variables of the caller.
+/// The reference holds a copy of the caller's storage, so the storage has to exist before.
+static struct reg_db* script_reg_ref(struct reg_db* ref, struct reg_db* src)
+{
+	if( ref->vars == NULL ) {
+		ref->vars = script_reg_vars(src);
+		if( !src->arrays )
+			src->arrays = idb_alloc(DB_OPT_BASE);
+		ref->arrays = src->arrays;
+	}
+	return ref;
+}
+
 /*==========================================
  * user-defined function call
  *------------------------------------------*/
@@ -5287,14 +6413,6 @@ BUILDIN_FUNC(callfunc)
 	}
 
 	ref = (struct reg_db *)aCalloc(sizeof(struct reg_db), 2);
-	ref[0].vars = st->stack->scope.vars;
-	if (!st->stack->scope.arrays)
-		st->stack->scope.arrays = idb_alloc(DB_OPT_BASE); // TODO: Can this happen? when?
-	ref[0].arrays = st->stack->scope.arrays;
-	ref[1].vars = st->script->local.vars;
-	if (!st->script->local.arrays)
-		st->script->local.arrays = idb_alloc(DB_OPT_BASE); // TODO: Can this happen? when?
-	ref[1].arrays = st->script->local.arrays;
 
 	for(i = st->start+3, j = 0; i < st->end; i++, j++) {
 		struct script_data* data = push_copy(st->stack,i);
@@ -5303,7 +6421,7 @@ BUILDIN_FUNC(callfunc)
 			const char* name = reference_getname(data);
 
 			if (name[0] == '.')
-				data->ref = (name[1] == '@' ? &ref[0] : &ref[1]);
+				data->ref = script_reg_ref(&ref[name[1] == '@' ? 0 : 1], name[1] == '@' ? &st->stack->scope : &st->script->local);
 		}
 	}
 
@@ -5320,11 +6438,8 @@ BUILDIN_FUNC(callfunc)
 	st->script = scr;
 	st->stack->defsp = st->stack->sp;
 	st->state = GOTO;
-	st->stack->scope.vars = i64db_alloc(DB_OPT_RELEASE_DATA);
-	st->stack->scope.arrays = idb_alloc(DB_OPT_BASE);
-
-	if (!st->script->local.vars)
-		st->script->local.vars = i64db_alloc(DB_OPT_RELEASE_DATA);
+	st->stack->scope.vars = NULL;
+	st->stack->scope.arrays = NULL;
 
 	return SCRIPT_CMD_SUCCESS;
 }
@@ -5347,10 +6462,6 @@ BUILDIN_FUNC(callsub)
 	}
 
 	ref = (struct reg_db *)aCalloc(sizeof(struct reg_db), 1);
-	ref[0].vars = st->stack->scope.vars;
-	if (!st->stack->scope.arrays)
-		st->stack->scope.arrays = idb_alloc(DB_OPT_BASE); // TODO: Can this happen? when?
-	ref[0].arrays = st->stack->scope.arrays;
 
 	for(i = st->start+3, j = 0; i < st->end; i++, j++) {
 		struct script_data* data = push_copy(st->stack,i);
@@ -5359,7 +6470,7 @@ BUILDIN_FUNC(callsub)
 			const char* name = reference_getname(data);
 
 			if (name[0] == '.' && name[1] == '@')
-				data->ref = &ref[0];
+				data->ref = script_reg_ref(&ref[0], &st->stack->scope);
 		}
 	}
 
@@ -5375,8 +6486,8 @@ BUILDIN_FUNC(callsub)
 	st->pos = pos;
 	st->stack->defsp = st->stack->sp;
 	st->state = GOTO;
-	st->stack->scope.vars = i64db_alloc(DB_OPT_RELEASE_DATA);
-	st->stack->scope.arrays = idb_alloc(DB_OPT_BASE);
+	st->stack->scope.vars = NULL;
+	st->stack->scope.arrays = NULL;
 
 	return SCRIPT_CMD_SUCCESS;
 }
@@ -9290,6 +10401,63 @@ BUILDIN_FUNC(statusup2)
 	return SCRIPT_CMD_SUCCESS;
 }
 
+/// Checks if the first value of a bonus is a skill, which can also be passed by name.
+static bool script_bonus_isskill(int type)
+{
+	switch( type ) {
+		case SP_AUTOSPELL:
+		case SP_AUTOSPELL_WHENHIT:
+		case SP_AUTOSPELL_ONSKILL:
+		case SP_SKILL_ATK:
+		case SP_SKILL_HEAL:
+		case SP_SKILL_HEAL2:
+		case SP_ADD_SKILL_BLOW:
+		case SP_CASTRATE:
+		case SP_ADDEFF_ONSKILL:
+		case SP_SKILL_USE_SP_RATE:
+		case SP_SKILL_COOLDOWN:
+		case SP_SKILL_FIXEDCAST:
+		case SP_SKILL_VARIABLECAST:
+		case SP_VARCASTRATE:
+		case SP_FIXCASTRATE:
+		case SP_SKILL_DELAY:
+		case SP_SKILL_USE_SP:
+		case SP_SUB_SKILL:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/// Applies the bonuses of a compiled bonus script like buildin_bonus would.
+/// @return false if a bonus is invalid, the script has to be run then to report it
+static bool script_bonus_apply(const struct script_code* code, struct map_session_data* sd)
+{
+	int i;
+
+	// bonus2 to bonus5 check the skill ID
+	for( i = 0; i < code->bonus_count; i++ ) {
+		const struct script_bonus* bonus = &code->bonuses[i];
+
+		if( bonus->count >= 2 && script_bonus_isskill(bonus->type) && !skill_get_index(bonus->val[0]) )
+			return false;
+	}
+
+	for( i = 0; i < code->bonus_count; i++ ) {
+		const struct script_bonus* bonus = &code->bonuses[i];
+
+		switch( bonus->count ) {
+			case 0: pc_bonus(sd, bonus->type, 0); break;
+			case 1: pc_bonus(sd, bonus->type, bonus->val[0]); break;
+			case 2: pc_bonus2(sd, bonus->type, bonus->val[0], bonus->val[1]); break;
+			case 3: pc_bonus3(sd, bonus->type, bonus->val[0], bonus->val[1], bonus->val[2]); break;
+			case 4: pc_bonus4(sd, bonus->type, bonus->val[0], bonus->val[1], bonus->val[2], bonus->val[3]); break;
+			case 5: pc_bonus5(sd, bonus->type, bonus->val[0], bonus->val[1], bonus->val[2], bonus->val[3], bonus->val[4]); break;
+		}
+	}
+	return true;
+}
+
 /// See 'doc/item_bonus.txt'
 ///
 /// bonus <bonus type>,<val1>;
@@ -9311,47 +10479,25 @@ BUILDIN_FUNC(bonus)
 		return SCRIPT_CMD_SUCCESS; // no player attached
 
 	type = script_getnum(st,2);
-	switch( type ) {
-		case SP_AUTOSPELL:
-		case SP_AUTOSPELL_WHENHIT:
-		case SP_AUTOSPELL_ONSKILL:
-		case SP_SKILL_ATK:
-		case SP_SKILL_HEAL:
-		case SP_SKILL_HEAL2:
-		case SP_ADD_SKILL_BLOW:
-		case SP_CASTRATE:
-		case SP_ADDEFF_ONSKILL:
-		case SP_SKILL_USE_SP_RATE:
-		case SP_SKILL_COOLDOWN:
-		case SP_SKILL_FIXEDCAST:
-		case SP_SKILL_VARIABLECAST:
-		case SP_VARCASTRATE:
-		case SP_FIXCASTRATE:
-		case SP_SKILL_DELAY:
-		case SP_SKILL_USE_SP:
-		case SP_SUB_SKILL:
-			// these bonuses support skill names
-			if (script_isstring(st, 3)) {
-				const char *name = script_getstr(st, 3);
+	if( script_bonus_isskill(type) ) {
+		// these bonuses support skill names
+		if (script_isstring(st, 3)) {
+			const char *name = script_getstr(st, 3);
 
-				if (!(val1 = skill_name2id(name))) {
-					ShowError("buildin_bonus: Invalid skill name %s passed to item bonus. Skipping.\n", name);
-					return SCRIPT_CMD_FAILURE;
-				}
-			} else {
-				val1 = script_getnum(st, 3);
+			if (!(val1 = skill_name2id(name))) {
+				ShowError("buildin_bonus: Invalid skill name %s passed to item bonus. Skipping.\n", name);
+				return SCRIPT_CMD_FAILURE;
+			}
+		} else {
+			val1 = script_getnum(st, 3);
 
-				if (strcmpi(script_getfuncname(st), "bonus") && !skill_get_index(val1)) { // Only check skill ID for bonus2, bonus3, bonus4, or bonus5
-					ShowError("buildin_bonus: Invalid skill ID %d passed to item bonus. Skipping.\n", val1);
-					return SCRIPT_CMD_FAILURE;
-				}
+			if (strcmpi(script_getfuncname(st), "bonus") && !skill_get_index(val1)) { // Only check skill ID for bonus2, bonus3, bonus4, or bonus5
+				ShowError("buildin_bonus: Invalid skill ID %d passed to item bonus. Skipping.\n", val1);
+				return SCRIPT_CMD_FAILURE;
 			}
-			break;
-		default:
-			if (script_hasdata(st, 3))
-				val1 = script_getnum(st, 3);
-			break;
-	}
+		}
+	} else if (script_hasdata(st, 3))
+		val1 = script_getnum(st, 3);
 
 	switch( script_lastdata(st)-2 ) {
 		case 0:
@@ -18745,6 +19891,23 @@ BUILDIN_FUNC(sleep)
 	return SCRIPT_CMD_SUCCESS;
 }
 
+/// Lets the script yield to the server after the given amount of instructions.
+/// It continues in the next server tick with the unit still attached.
+///
+/// timeslice <instructions>;
+BUILDIN_FUNC(timeslice)
+{
+	int instructions = script_getnum(st, 2);
+
+	if (instructions < 0) {
+		ShowError("buildin_timeslice: negative amount('%d') of instructions is not supported\n", instructions);
+		return SCRIPT_CMD_FAILURE;
+	}
+
+	st->timeslice = instructions;
+	return SCRIPT_CMD_SUCCESS;
+}
+
 /// Pauses the execution of the script, keeping the unit attached
 /// Stops the script if no unit is attached
 ///
@@ -24915,6 +26078,7 @@ struct script_function buildin_func[] = {
 // <--- [zBuffer] List of unit control commands
 	BUILDIN_DEF(sleep,"i"),
 	BUILDIN_DEF(sleep2,"i"),
+	BUILDIN_DEF(timeslice,"i"),
 	BUILDIN_DEF(awake,"s"),
 	BUILDIN_DEF(getvariableofnpc,"rs"),
 	BUILDIN_DEF(warpportal,"iisii"),
@@ -279,6 +279,21 @@ struct script_data {
 	struct reg_db *ref;
 };
 
+/// Instruction of the script code, decoded from script_buf when the script is parsed.
+/// run_script_main executes these, so the variable-length operands are not decoded again on every run.
+struct script_insn {
+	int pos; ///< position of the instruction in script_buf
+	int value; ///< operand: number of C_INT, label/name of C_POS/C_NAME, position of the C_STR string
+	enum c_op op;
+};
+
+/// Bonus command with constant values, see script_bonus_compile.
+struct script_bonus {
+	int type;
+	int count; ///< number of values
+	int val[5];
+};
+
 // Moved defsp from script_state to script_stack since
 // it must be saved when script state is RERUNLINE. [Eoe / jA 1094]
 struct script_code {
@@ -286,6 +301,10 @@ struct script_code {
 	unsigned char* script_buf;
 	struct reg_db local;
 	unsigned short instances;
+	struct script_insn* insns; ///< script_buf as fixed-width instructions
+	int insn_count;
+	struct script_bonus* bonuses; ///< the script as list of bonuses, when it only consists of bonus commands with constant values
+	int bonus_count; ///< number of bonuses, -1 if the script has to be run
 };
 
 struct script_stack {
@@ -321,6 +340,8 @@ struct script_state {
 	unsigned mes_active : 1;  // Store if invoking character has a NPC dialog box open.
 	char* funcname; // Stores the current running function name
 	unsigned int id;
+	int entry_pos; // Position the script was started at
+	int timeslice; // Instructions per run before the script yields to the server, 0 = unlimited (see buildin_timeslice)
 };
 
 struct script_reg {
@@ -333,10 +354,14 @@ struct script_regstr {
 	char* data;
 };
 
+/// Members of a script array.
+/// As long as the members are exactly the indexes 0 to size-1 the array is dense and has no member list,
+/// the first gap converts it to a (sparse) member list.
 struct script_array {
 	unsigned int id;       ///< the first 32b of the 64b uid, aka the id
 	unsigned int size;     ///< how many members
-	unsigned int *members; ///< member list
+	unsigned int *members; ///< member list, NULL while the array is dense
+	unsigned int max_members; ///< allocated size of the member list
 };
 
 enum script_parse_options {
@@ -1982,6 +2007,9 @@ void script_warning(const char* src, const char* file, int start_line, const cha
 
 bool is_number(const char *p);
 struct script_code* parse_script(const char* src,const char* file,int line,int options);
+struct script_code* parse_script_cached(const char* src, const char* src_end, const char* file, int line, int options);
+void script_cache_begin(void);
+void script_cache_end(void);
 void run_script(struct script_code *rootscript,int pos,int rid,int oid);
 
 int set_reg(struct script_state* st, struct map_session_data* sd, int64 num, const char* name, const void* value, struct reg_db *ref);
@@ -1996,6 +2024,12 @@ void script_attach_state(struct script_state* st);
 void script_detach_rid(struct script_state* st);
 void run_script_main(struct script_state *st);
 
+#define SCRIPT_PROFILE_FILE "log/script_profile.txt"
+void script_profile_start(void);
+void script_profile_stop(void);
+bool script_profile_isactive(void);
+bool script_profile_report(const char* file);
+
 void script_stop_scriptinstances(struct script_code *code);
 void script_free_code(struct script_code* code);
 void script_free_vars(struct DBMap *storage);
@@ -3,11 +3,13 @@
 
 #include "skill.hpp"
 
+#include <map>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <vector>
 
 #include "../common/cbasetypes.hpp"
 #include "../common/ers.hpp"
@@ -71,7 +73,12 @@ static struct eri *skill_unit_ers = NULL; //For handling skill_unit's [Skotlex]
 static struct eri *skill_timer_ers = NULL; //For handling skill_timerskills [Skotlex]
 static DBMap* bowling_db = NULL; // int mob_id -> struct mob_data*
 
-DBMap* skillunit_db = NULL; // int id -> struct skill_unit*
+/// Skill units of a map, processed by skill_unit_timer
+struct s_skill_unit_map {
+	std::vector<struct skill_unit*> units; ///< Deleted units are set to NULL and removed by the next skill_unit_timer
+	int deleted;
+};
+static std::vector<s_skill_unit_map> skillunit_maps; // skill units by map id, sized to MAX_MAP_PER_SERVER so that references stay valid
 
 /**
  * Skill Unit Persistency during endack routes (mostly for songs see bugreport:4574)
@@ -1955,9 +1962,7 @@ int skill_additional_effect(struct block_list* src, struct block_list *bl, uint1
 				break;
 			}
 
-			for (i = 0; n > 0 && i < SC_MAX; i++) {
-				if (!tsc->data[i])
-					continue;
+			for (i = status_change_next(tsc, 0); n > 0 && i < SC_MAX; i = status_change_next(tsc, i + 1)) {
 				switch (i) {
 					case SC_WEIGHT50:		case SC_WEIGHT90:		case SC_HALLUCINATION:
 					case SC_STRIPWEAPON:	case SC_STRIPSHIELD:	case SC_STRIPARMOR:
@@ -7951,9 +7956,7 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, ui
 			if(!tsc || !tsc->count)
 				break;
 
-			for(i=0;i<SC_MAX;i++) {
-				if (!tsc->data[i])
-					continue;
+			for(i=status_change_next(tsc, 0);i<SC_MAX;i=status_change_next(tsc, i + 1)) {
 				switch (i) {
 					case SC_WEIGHT50:		case SC_WEIGHT90:		case SC_HALLUCINATION:
 					case SC_STRIPWEAPON:	case SC_STRIPSHIELD:	case SC_STRIPARMOR:
@@ -9469,9 +9472,7 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, ui
 
 			if(!tsc || !tsc->count)
 				break;
-			for( i = 0; i < SC_MAX; i++ ) {
-				if (!tsc->data[i])
-					continue;
+			for( i = status_change_next(tsc, 0); i < SC_MAX; i = status_change_next(tsc, i + 1) ) {
 				switch (i) {
 					case SC_WEIGHT50:		case SC_WEIGHT90:		case SC_HALLUCINATION:
 					case SC_STRIPWEAPON:		case SC_STRIPSHIELD:		case SC_STRIPARMOR:
@@ -18080,8 +18081,14 @@ struct skill_unit *skill_initunit(struct skill_unit_group *group, int idx, int x
 	if( map_getcell(map_id2bl(group->src_id)->m, x, y, CELL_CHKMAELSTROM) )
 		return unit;
 
-	if(!unit->alive)
+	if(!unit->alive) {
+		s_skill_unit_map& units = skillunit_maps[group->map];
+
 		group->alive_count++;
+		// Stores new skill unit
+		unit->timer_pos = (int)units.units.size();
+		units.units.push_back(unit);
+	}
 
 	unit->bl.id = map_get_new_object_id();
 	unit->bl.type = BL_SKILL;
@@ -18094,8 +18101,6 @@ struct skill_unit *skill_initunit(struct skill_unit_group *group, int idx, int x
 	unit->val2 = val2;
 	unit->hidden = hidden;
 
-	// Stores new skill unit
-	idb_put(skillunit_db, unit->bl.id, unit);
 	map_addiddb(&unit->bl);
 	if(map_addblock(&unit->bl))
 		return NULL;
@@ -18197,7 +18202,14 @@ int skill_delunit(struct skill_unit* unit)
 	unit->group=NULL;
 	map_delblock(&unit->bl); // don't free yet
 	map_deliddb(&unit->bl);
-	idb_remove(skillunit_db, unit->bl.id);
+	if( unit->bl.m >= 0 && unit->bl.m < (int16)skillunit_maps.size() ) {
+		s_skill_unit_map& units = skillunit_maps[unit->bl.m];
+
+		Assert( unit->timer_pos < (int)units.units.size() && units.units[unit->timer_pos] == unit );
+		units.units[unit->timer_pos] = NULL;
+		units.deleted++;
+	} else
+		Assert( false ); // the unit was created on a map that does not exist
 	if(--group->alive_count==0)
 		skill_delunitgroup(group);
 
@@ -18574,14 +18586,11 @@ int skill_unit_timer_sub_onplace(struct block_list* bl, va_list ap)
 }
 
 /**
- * @see DBApply
- * Sub function of skill_unit_timer for executing each skill unit from skillunit_db
+ * Sub function of skill_unit_timer for executing each skill unit
  */
-static int skill_unit_timer_sub(DBKey key, DBData *data, va_list ap)
+static int skill_unit_timer_sub(struct skill_unit* unit, t_tick tick)
 {
-	struct skill_unit* unit = (struct skill_unit*)db_data2ptr(data);
 	struct skill_unit_group* group = NULL;
-	t_tick tick = va_arg(ap,t_tick);
 	bool dissonance;
 	struct block_list* bl = &unit->bl;
 
@@ -18842,11 +18851,36 @@ static int skill_unit_timer_sub(DBKey key, DBData *data, va_list ap)
 
 /*==========================================
  * Executes on all skill units every SKILLUNITTIMER_INTERVAL miliseconds.
+ * Maps without players are skipped, their units are processed again
+ * once a player enters the map.
  *------------------------------------------*/
 TIMER_FUNC(skill_unit_timer){
 	map_freeblock_lock();
 
-	skillunit_db->foreach(skillunit_db, skill_unit_timer_sub, tick);
+	for( int16 m = 0; m < map_num; m++ ) {
+		s_skill_unit_map& units = skillunit_maps[m];
+		size_t i, count;
+
+		if( units.deleted > 0 ) { // Remove deleted units
+			for( i = 0, count = 0; i < units.units.size(); i++ ) {
+				if( units.units[i] == NULL )
+					continue;
+				units.units[i]->timer_pos = (int)count;
+				units.units[count++] = units.units[i];
+			}
+			units.units.resize(count);
+			units.deleted = 0;
+		}
+		if( units.units.empty() || map_getmapdata(m)->users == 0 )
+			continue;
+
+		// Units created by the others are processed in the next call
+		count = units.units.size();
+		for( i = 0; i < count; i++ ) {
+			if( units.units[i] != NULL )
+				skill_unit_timer_sub(units.units[i], tick);
+		}
+	}
 
 	map_freeblock_unlock();
 	return 0;
@@ -21932,7 +21966,7 @@ void do_init_skill(void)
 	skill_readdb();
 
 	skillunit_group_db = idb_alloc(DB_OPT_BASE);
-	skillunit_db = idb_alloc(DB_OPT_BASE);
+	skillunit_maps.resize(MAX_MAP_PER_SERVER);
 	skillusave_db = idb_alloc(DB_OPT_RELEASE_DATA);
 	bowling_db = idb_alloc(DB_OPT_BASE);
 	skill_unit_ers = ers_new(sizeof(struct skill_unit_group),"skill.cpp::skill_unit_ers",ERS_CACHE_OPTIONS);
@@ -21954,7 +21988,7 @@ void do_final_skill(void)
 {
 	db_destroy(skilldb_name2id);
 	db_destroy(skillunit_group_db);
-	db_destroy(skillunit_db);
+	skillunit_maps.clear();
 	db_destroy(skillusave_db);
 	db_destroy(bowling_db);
 	skill_db_destroy();
@@ -306,6 +306,7 @@ struct skill_unit {
 	short range;
 	unsigned alive : 1;
 	unsigned hidden : 1;
+	int timer_pos; ///< Position in the skill unit list of its map, see skill_unit_timer
 };
 
 #define MAX_SKILLUNITGROUPTICKSET 25
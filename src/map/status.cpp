@@ -8,6 +8,9 @@
 #include <stdlib.h>
 #include <string>
 #include <yaml-cpp/yaml.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #include "../common/cbasetypes.hpp"
 #include "../common/ers.hpp"
@@ -3398,6 +3401,184 @@ bool status_calc_cart_weight(struct map_session_data *sd, enum e_status_calc_wei
 	return true;
 }
 
+/**
+ * Applies the bonuses of status changes that are stored in the player's bonus values (status change layer)
+ * @param sd: Player
+ * @param save: true when called by status_calc_pc_sub, the values without the layer are saved
+ *              false to reset the values to the ones saved by the last status_calc_pc_sub
+ */
+static void status_calc_pc_sc(struct map_session_data* sd, bool save)
+{
+	struct s_pc_sc_layer* layer = &sd->sc_layer;
+	const struct status_change* sc = &sd->sc;
+	int i;
+
+	if( save ) {
+		memcpy(layer->subele, sd->subele, sizeof(layer->subele));
+		memcpy(layer->subrace, sd->subrace, sizeof(layer->subrace));
+		memcpy(layer->right_addrace, sd->right_weapon.addrace, sizeof(layer->right_addrace));
+		memcpy(layer->left_addrace, sd->left_weapon.addrace, sizeof(layer->left_addrace));
+		memcpy(layer->magic_addrace, sd->magic_addrace, sizeof(layer->magic_addrace));
+		memcpy(layer->ignore_mdef_by_race, sd->ignore_mdef_by_race, sizeof(layer->ignore_mdef_by_race));
+		layer->crit_atk_rate = sd->bonus.crit_atk_rate;
+		sd->state.sc_layer_dirty = 0;
+	} else {
+		memcpy(sd->subele, layer->subele, sizeof(layer->subele));
+		memcpy(sd->subrace, layer->subrace, sizeof(layer->subrace));
+		memcpy(sd->right_weapon.addrace, layer->right_addrace, sizeof(layer->right_addrace));
+		memcpy(sd->left_weapon.addrace, layer->left_addrace, sizeof(layer->left_addrace));
+		memcpy(sd->magic_addrace, layer->magic_addrace, sizeof(layer->magic_addrace));
+		memcpy(sd->ignore_mdef_by_race, layer->ignore_mdef_by_race, sizeof(layer->ignore_mdef_by_race));
+		sd->bonus.crit_atk_rate = layer->crit_atk_rate;
+	}
+
+	if( !sc->count )
+		return;
+
+	if(sc->data[SC_SIEGFRIED]) {
+		i = sc->data[SC_SIEGFRIED]->val2;
+		sd->subele[ELE_WATER] += i;
+		sd->subele[ELE_EARTH] += i;
+		sd->subele[ELE_FIRE] += i;
+		sd->subele[ELE_WIND] += i;
+		sd->subele[ELE_POISON] += i;
+		sd->subele[ELE_HOLY] += i;
+		sd->subele[ELE_DARK] += i;
+		sd->subele[ELE_GHOST] += i;
+		sd->subele[ELE_UNDEAD] += i;
+	}
+	if(sc->data[SC_PROVIDENCE]) {
+		sd->subele[ELE_HOLY] += sc->data[SC_PROVIDENCE]->val2;
+		sd->subrace[RC_DEMON] += sc->data[SC_PROVIDENCE]->val2;
+	}
+	if (sc->data[SC_GEFFEN_MAGIC1]) {
+		sd->right_weapon.addrace[RC_PLAYER] += sc->data[SC_GEFFEN_MAGIC1]->val1;
+		sd->right_weapon.addrace[RC_DEMIHUMAN] += sc->data[SC_GEFFEN_MAGIC1]->val1;
+		sd->left_weapon.addrace[RC_PLAYER] += sc->data[SC_GEFFEN_MAGIC1]->val1;
+		sd->left_weapon.addrace[RC_DEMIHUMAN] += sc->data[SC_GEFFEN_MAGIC1]->val1;
+	}
+	if (sc->data[SC_GEFFEN_MAGIC2]) {
+		sd->magic_addrace[RC_PLAYER] += sc->data[SC_GEFFEN_MAGIC2]->val1;
+		sd->magic_addrace[RC_DEMIHUMAN] += sc->data[SC_GEFFEN_MAGIC2]->val1;
+	}
+	if(sc->data[SC_GEFFEN_MAGIC3]) {
+		sd->subrace[RC_PLAYER] += sc->data[SC_GEFFEN_MAGIC3]->val1;
+		sd->subrace[RC_DEMIHUMAN] += sc->data[SC_GEFFEN_MAGIC3]->val1;
+	}
+	if(sc->data[SC_ARMOR_ELEMENT_WATER]) {	// This status change should grant card-type elemental resist.
+		sd->subele[ELE_WATER] += sc->data[SC_ARMOR_ELEMENT_WATER]->val1;
+		sd->subele[ELE_EARTH] += sc->data[SC_ARMOR_ELEMENT_WATER]->val2;
+		sd->subele[ELE_FIRE] += sc->data[SC_ARMOR_ELEMENT_WATER]->val3;
+		sd->subele[ELE_WIND] += sc->data[SC_ARMOR_ELEMENT_WATER]->val4;
+	}
+	if(sc->data[SC_ARMOR_ELEMENT_EARTH]) {	// This status change should grant card-type elemental resist.
+		sd->subele[ELE_WATER] += sc->data[SC_ARMOR_ELEMENT_EARTH]->val1;
+		sd->subele[ELE_EARTH] += sc->data[SC_ARMOR_ELEMENT_EARTH]->val2;
+		sd->subele[ELE_FIRE] += sc->data[SC_ARMOR_ELEMENT_EARTH]->val3;
+		sd->subele[ELE_WIND] += sc->data[SC_ARMOR_ELEMENT_EARTH]->val4;
+	}
+	if(sc->data[SC_ARMOR_ELEMENT_FIRE]) {	// This status change should grant card-type elemental resist.
+		sd->subele[ELE_WATER] += sc->data[SC_ARMOR_ELEMENT_FIRE]->val1;
+		sd->subele[ELE_EARTH] += sc->data[SC_ARMOR_ELEMENT_FIRE]->val2;
+		sd->subele[ELE_FIRE] += sc->data[SC_ARMOR_ELEMENT_FIRE]->val3;
+		sd->subele[ELE_WIND] += sc->data[SC_ARMOR_ELEMENT_FIRE]->val4;
+	}
+	if(sc->data[SC_ARMOR_ELEMENT_WIND]) {	// This status change should grant card-type elemental resist.
+		sd->subele[ELE_WATER] += sc->data[SC_ARMOR_ELEMENT_WIND]->val1;
+		sd->subele[ELE_EARTH] += sc->data[SC_ARMOR_ELEMENT_WIND]->val2;
+		sd->subele[ELE_FIRE] += sc->data[SC_ARMOR_ELEMENT_WIND]->val3;
+		sd->subele[ELE_WIND] += sc->data[SC_ARMOR_ELEMENT_WIND]->val4;
+	}
+	if(sc->data[SC_ARMOR_RESIST]) { // Undead Scroll
+		sd->subele[ELE_WATER] += sc->data[SC_ARMOR_RESIST]->val1;
+		sd->subele[ELE_EARTH] += sc->data[SC_ARMOR_RESIST]->val2;
+		sd->subele[ELE_FIRE] += sc->data[SC_ARMOR_RESIST]->val3;
+		sd->subele[ELE_WIND] += sc->data[SC_ARMOR_RESIST]->val4;
+	}
+	if( sc->data[SC_FIRE_CLOAK_OPTION] ) {
+		i = sc->data[SC_FIRE_CLOAK_OPTION]->val2;
+		sd->subele[ELE_FIRE] += i;
+		sd->subele[ELE_WATER] -= i;
+	}
+	if( sc->data[SC_WATER_DROP_OPTION] ) {
+		i = sc->data[SC_WATER_DROP_OPTION]->val2;
+		sd->subele[ELE_WATER] += i;
+		sd->subele[ELE_WIND] -= i;
+	}
+	if( sc->data[SC_WIND_CURTAIN_OPTION] ) {
+		i = sc->data[SC_WIND_CURTAIN_OPTION]->val2;
+		sd->subele[ELE_WIND] += i;
+		sd->subele[ELE_EARTH] -= i;
+	}
+	if( sc->data[SC_STONE_SHIELD_OPTION] ) {
+		i = sc->data[SC_STONE_SHIELD_OPTION]->val2;
+		sd->subele[ELE_EARTH] += i;
+		sd->subele[ELE_FIRE] -= i;
+	}
+	if (sc->data[SC_MTF_MLEATKED] )
+		sd->subele[ELE_NEUTRAL] += sc->data[SC_MTF_MLEATKED]->val3;
+	if (sc->data[SC_MTF_CRIDAMAGE])
+		sd->bonus.crit_atk_rate += sc->data[SC_MTF_CRIDAMAGE]->val1;
+	if (sc->data[SC_GLASTHEIM_ATK]) {
+		sd->ignore_mdef_by_race[RC_UNDEAD] += sc->data[SC_GLASTHEIM_ATK]->val1;
+		sd->ignore_mdef_by_race[RC_DEMON] += sc->data[SC_GLASTHEIM_ATK]->val1;
+	}
+	if (sc->data[SC_LAUDARAMUS])
+		sd->bonus.crit_atk_rate += 5 * sc->data[SC_LAUDARAMUS]->val1;
+}
+
+/**
+ * Checks if a status change only affects a player's base status through status_calc_pc_sc
+ * @param type: Status change
+ * @return True if the status change layer is enough to recalculate the base status
+ */
+static bool status_calc_pc_sc_only(enum sc_type type)
+{
+	switch( type ) {
+		case SC_SIEGFRIED:
+		case SC_PROVIDENCE:
+		case SC_GEFFEN_MAGIC1:
+		case SC_GEFFEN_MAGIC2:
+		case SC_GEFFEN_MAGIC3:
+		case SC_ARMOR_ELEMENT_WATER:
+		case SC_ARMOR_ELEMENT_EARTH:
+		case SC_ARMOR_ELEMENT_FIRE:
+		case SC_ARMOR_ELEMENT_WIND:
+		case SC_ARMOR_RESIST:
+		case SC_FIRE_CLOAK_OPTION:
+		case SC_WATER_DROP_OPTION:
+		case SC_WIND_CURTAIN_OPTION:
+		case SC_STONE_SHIELD_OPTION:
+		case SC_MTF_MLEATKED:
+		case SC_MTF_CRIDAMAGE:
+		case SC_GLASTHEIM_ATK:
+		case SC_LAUDARAMUS:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/**
+ * Recalculates the status of an object after a status change started or ended
+ * Players only recalculate the status change layer of their base status if the status change is not used elsewhere
+ * @param bl: Object whose status has changed
+ * @param type: Status change
+ * @param flag: Which status has changed on bl
+ * @param opt: See status_calc_bl_
+ */
+static void status_calc_sc_bl(struct block_list* bl, enum sc_type type, enum scb_flag flag, enum e_status_calc_opt opt)
+{
+	struct map_session_data* sd = BL_CAST(BL_PC, bl);
+
+	if( sd != NULL && flag&SCB_BASE && !sd->state.sc_layer_dirty && sd->delayed_damage == 0 && status_calc_pc_sc_only(type) ) {
+		status_calc_pc_sc(sd, false);
+		flag = (enum scb_flag)(flag&~SCB_BASE);
+	}
+
+	status_calc_bl_(bl, flag, opt);
+}
+
 /**
  * Calculates player data from scratch without counting SC adjustments
  * Should be invoked whenever players raise stats, learn passive skills or change equipment
@@ -3417,6 +3598,8 @@ int status_calc_pc_sub(struct map_session_data* sd, enum e_status_calc_opt opt)
 	if (++calculating > 10) // Too many recursive calls!
 		return -1;
 
+	sd->state.sc_layer_dirty = 1;
+
 	// Remember player-specific values that are currently being shown to the client (for refresh purposes)
 	memcpy(b_skill, &sd->status.skill, sizeof(b_skill));
 
@@ -4199,102 +4382,12 @@ int status_calc_pc_sub(struct map_session_data* sd, enum e_status_calc_opt opt)
 		sd->subrace[RC_DRAGON]+=skill;
 	}
 
-	if(sc->count) {
-		if(sc->data[SC_CONCENTRATE]) { // Update the card-bonus data
-			sc->data[SC_CONCENTRATE]->val3 = sd->param_bonus[1]; // Agi
-			sc->data[SC_CONCENTRATE]->val4 = sd->param_bonus[4]; // Dex
-		}
-		if(sc->data[SC_SIEGFRIED]) {
-			i = sc->data[SC_SIEGFRIED]->val2;
-			sd->subele[ELE_WATER] += i;
-			sd->subele[ELE_EARTH] += i;
-			sd->subele[ELE_FIRE] += i;
-			sd->subele[ELE_WIND] += i;
-			sd->subele[ELE_POISON] += i;
-			sd->subele[ELE_HOLY] += i;
-			sd->subele[ELE_DARK] += i;
-			sd->subele[ELE_GHOST] += i;
-			sd->subele[ELE_UNDEAD] += i;
-		}
-		if(sc->data[SC_PROVIDENCE]) {
-			sd->subele[ELE_HOLY] += sc->data[SC_PROVIDENCE]->val2;
-			sd->subrace[RC_DEMON] += sc->data[SC_PROVIDENCE]->val2;
-		}
-        if (sc->data[SC_GEFFEN_MAGIC1]) {
-            sd->right_weapon.addrace[RC_PLAYER] += sc->data[SC_GEFFEN_MAGIC1]->val1;
-            sd->right_weapon.addrace[RC_DEMIHUMAN] += sc->data[SC_GEFFEN_MAGIC1]->val1;
-            sd->left_weapon.addrace[RC_PLAYER] += sc->data[SC_GEFFEN_MAGIC1]->val1;
-            sd->left_weapon.addrace[RC_DEMIHUMAN] += sc->data[SC_GEFFEN_MAGIC1]->val1;
-        }
-        if (sc->data[SC_GEFFEN_MAGIC2]) {
-            sd->magic_addrace[RC_PLAYER] += sc->data[SC_GEFFEN_MAGIC2]->val1;
-            sd->magic_addrace[RC_DEMIHUMAN] += sc->data[SC_GEFFEN_MAGIC2]->val1;
-        }
-        if(sc->data[SC_GEFFEN_MAGIC3]) {
-            sd->subrace[RC_PLAYER] += sc->data[SC_GEFFEN_MAGIC3]->val1;
-            sd->subrace[RC_DEMIHUMAN] += sc->data[SC_GEFFEN_MAGIC3]->val1;
-        }
-		if(sc->data[SC_ARMOR_ELEMENT_WATER]) {	// This status change should grant card-type elemental resist.
-			sd->subele[ELE_WATER] += sc->data[SC_ARMOR_ELEMENT_WATER]->val1;
-			sd->subele[ELE_EARTH] += sc->data[SC_ARMOR_ELEMENT_WATER]->val2;
-			sd->subele[ELE_FIRE] += sc->data[SC_ARMOR_ELEMENT_WATER]->val3;
-			sd->subele[ELE_WIND] += sc->data[SC_ARMOR_ELEMENT_WATER]->val4;
-		}
-		if(sc->data[SC_ARMOR_ELEMENT_EARTH]) {	// This status change should grant card-type elemental resist.
-			sd->subele[ELE_WATER] += sc->data[SC_ARMOR_ELEMENT_EARTH]->val1;
-			sd->subele[ELE_EARTH] += sc->data[SC_ARMOR_ELEMENT_EARTH]->val2;
-			sd->subele[ELE_FIRE] += sc->data[SC_ARMOR_ELEMENT_EARTH]->val3;
-			sd->subele[ELE_WIND] += sc->data[SC_ARMOR_ELEMENT_EARTH]->val4;
-		}
-		if(sc->data[SC_ARMOR_ELEMENT_FIRE]) {	// This status change should grant card-type elemental resist.
-			sd->subele[ELE_WATER] += sc->data[SC_ARMOR_ELEMENT_FIRE]->val1;
-			sd->subele[ELE_EARTH] += sc->data[SC_ARMOR_ELEMENT_FIRE]->val2;
-			sd->subele[ELE_FIRE] += sc->data[SC_ARMOR_ELEMENT_FIRE]->val3;
-			sd->subele[ELE_WIND] += sc->data[SC_ARMOR_ELEMENT_FIRE]->val4;
-		}
-		if(sc->data[SC_ARMOR_ELEMENT_WIND]) {	// This status change should grant card-type elemental resist.
-			sd->subele[ELE_WATER] += sc->data[SC_ARMOR_ELEMENT_WIND]->val1;
-			sd->subele[ELE_EARTH] += sc->data[SC_ARMOR_ELEMENT_WIND]->val2;
-			sd->subele[ELE_FIRE] += sc->data[SC_ARMOR_ELEMENT_WIND]->val3;
-			sd->subele[ELE_WIND] += sc->data[SC_ARMOR_ELEMENT_WIND]->val4;
-		}
-		if(sc->data[SC_ARMOR_RESIST]) { // Undead Scroll
-			sd->subele[ELE_WATER] += sc->data[SC_ARMOR_RESIST]->val1;
-			sd->subele[ELE_EARTH] += sc->data[SC_ARMOR_RESIST]->val2;
-			sd->subele[ELE_FIRE] += sc->data[SC_ARMOR_RESIST]->val3;
-			sd->subele[ELE_WIND] += sc->data[SC_ARMOR_RESIST]->val4;
-		}
-		if( sc->data[SC_FIRE_CLOAK_OPTION] ) {
-			i = sc->data[SC_FIRE_CLOAK_OPTION]->val2;
-			sd->subele[ELE_FIRE] += i;
-			sd->subele[ELE_WATER] -= i;
-		}
-		if( sc->data[SC_WATER_DROP_OPTION] ) {
-			i = sc->data[SC_WATER_DROP_OPTION]->val2;
-			sd->subele[ELE_WATER] += i;
-			sd->subele[ELE_WIND] -= i;
-		}
-		if( sc->data[SC_WIND_CURTAIN_OPTION] ) {
-			i = sc->data[SC_WIND_CURTAIN_OPTION]->val2;
-			sd->subele[ELE_WIND] += i;
-			sd->subele[ELE_EARTH] -= i;
-		}
-		if( sc->data[SC_STONE_SHIELD_OPTION] ) {
-			i = sc->data[SC_STONE_SHIELD_OPTION]->val2;
-			sd->subele[ELE_EARTH] += i;
-			sd->subele[ELE_FIRE] -= i;
-		}
-		if (sc->data[SC_MTF_MLEATKED] )
-			sd->subele[ELE_NEUTRAL] += sc->data[SC_MTF_MLEATKED]->val3;
-		if (sc->data[SC_MTF_CRIDAMAGE])
-			sd->bonus.crit_atk_rate += sc->data[SC_MTF_CRIDAMAGE]->val1;
-		if (sc->data[SC_GLASTHEIM_ATK]) {
-			sd->ignore_mdef_by_race[RC_UNDEAD] += sc->data[SC_GLASTHEIM_ATK]->val1;
-			sd->ignore_mdef_by_race[RC_DEMON] += sc->data[SC_GLASTHEIM_ATK]->val1;
-		}
-		if (sc->data[SC_LAUDARAMUS])
-			sd->bonus.crit_atk_rate += 5 * sc->data[SC_LAUDARAMUS]->val1;
+	if(sc->data[SC_CONCENTRATE]) { // Update the card-bonus data
+		sc->data[SC_CONCENTRATE]->val3 = sd->param_bonus[1]; // Agi
+		sc->data[SC_CONCENTRATE]->val4 = sd->param_bonus[4]; // Dex
 	}
+
+	status_calc_pc_sc(sd, true);
 	status_cpy(&sd->battle_status, base_status);
 
 // ----- CLIENT-SIDE REFRESH -----
@@ -8001,6 +8094,56 @@ void status_change_init(struct block_list *bl)
 	memset(sc, 0, sizeof (struct status_change));
 }
 
+/**
+ * Returns the index of the lowest set bit.
+ * @param bits: Bit set, must not be 0
+ * @return Index of the bit
+ */
+static inline int status_lowest_bit(uint64 bits)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+	unsigned long index;
+
+	_BitScanForward64(&index, bits);
+	return (int)index;
+#elif defined(_MSC_VER)
+	unsigned long index;
+
+	if( _BitScanForward(&index, (unsigned long)bits) )
+		return (int)index;
+	_BitScanForward(&index, (unsigned long)(bits >> 32));
+	return (int)index + 32;
+#else
+	return __builtin_ctzll(bits);
+#endif
+}
+
+/**
+ * Finds the next active status change, used to iterate over the status changes of an object:
+ *   for( i = status_change_next(sc, 0); i < SC_MAX; i = status_change_next(sc, i + 1) )
+ * Status changes can be started and ended while iterating.
+ * @param sc: Status change data
+ * @param type: Status change to start the search at
+ * @return First active status change >= type or SC_MAX if there is none
+ */
+int status_change_next(const struct status_change* sc, int type)
+{
+	int i = type / 64;
+	uint64 bits;
+
+	if( type >= SC_MAX )
+		return SC_MAX;
+
+	bits = sc->active[i] & (~UINT64_C(0) << (type % 64));
+	while( bits == 0 ) {
+		if( ++i >= (int)ARRAYLENGTH(sc->active) )
+			return SC_MAX;
+		bits = sc->active[i];
+	}
+
+	return i * 64 + status_lowest_bit(bits);
+}
+
 /*========================================== [Playtester]
 * Returns the interval for status changes that iterate multiple times
 * through the timer (e.g. those that deal damage in regular intervals)
@@ -11757,6 +11900,7 @@ int status_change_start(struct block_list* src, struct block_list* bl,enum sc_ty
 	} else { // New sc
 		++(sc->count);
 		sce = sc->data[type] = ers_alloc(sc_data_ers, struct status_change_entry);
+		sc->active[type / 64] |= UINT64_C(1) << (type % 64);
 	}
 	sce->val1 = val1;
 	sce->val2 = val2;
@@ -11768,7 +11912,7 @@ int status_change_start(struct block_list* src, struct block_list* bl,enum sc_ty
 		sce->timer = INVALID_TIMER; // Infinite duration
 
 	if (calc_flag)
-		status_calc_bl(bl,calc_flag);
+		status_calc_sc_bl(bl, type, (enum scb_flag)calc_flag, SCO_NONE);
 
 	if ( sc_isnew && StatusChangeStateTable[type] ) // Non-zero
 		status_calc_state(bl,sc,( enum scs_flag ) StatusChangeStateTable[type],true);
@@ -11910,10 +12054,7 @@ int status_change_clear(struct block_list* bl, int type)
 	if (!sc->count)
 		return 0;
 
-	for(i = 0; i < SC_MAX; i++) {
-		if(!sc->data[i])
-			continue;
-
+	for(i = status_change_next(sc, 0); i < SC_MAX; i = status_change_next(sc, i + 1)) {
 		if(type == 0) {
 			switch (i) { // Type 0: PC killed -> Place here statuses that do not dispel on death.
 			case SC_ELEMENTALCHANGE: // Only when its Holy or Dark that it doesn't dispell on death
@@ -12077,6 +12218,7 @@ int status_change_clear(struct block_list* bl, int type)
 				delete_timer(sc->data[i]->timer, status_change_timer);
 			ers_free(sc_data_ers, sc->data[i]);
 			sc->data[i] = NULL;
+			sc->active[i / 64] &= ~(UINT64_C(1) << (i % 64));
 		}
 	}
 
@@ -12190,6 +12332,7 @@ int status_change_end_(struct block_list* bl, enum sc_type type, int tid, const
 		status_calc_state(bl,sc,( enum scs_flag ) StatusChangeStateTable[type],false);
 
 	sc->data[type] = NULL;
+	sc->active[type / 64] &= ~(UINT64_C(1) << (type % 64));
 
 	if (StatusDisplayType[type]&bl->type)
 		status_display_remove(bl,type);
@@ -12851,7 +12994,7 @@ int status_change_end_(struct block_list* bl, enum sc_type type, int tid, const
 			status_calc_bl_(bl, calc_flag, SCO_FORCE);
 			break;
 		default:
-			status_calc_bl(bl, calc_flag);
+			status_calc_sc_bl(bl, type, (enum scb_flag)calc_flag, SCO_NONE);
 			break;
 		}
 	}
@@ -13929,9 +14072,7 @@ void status_change_clear_buffs(struct block_list* bl, uint8 type)
 		for (i = SC_COMMON_MIN; i <= SC_COMMON_MAX; i++)
 			status_change_end(bl, (sc_type)i, INVALID_TIMER);
 
-	for( i = SC_COMMON_MAX+1; i < SC_MAX; i++ ) {
-		if(!sc->data[i])
-			continue;
+	for( i = status_change_next(sc, SC_COMMON_MAX+1); i < SC_MAX; i = status_change_next(sc, i + 1) ) {
 
 		switch (i) {
 			// Stuff that cannot be removed
@@ -14171,8 +14312,8 @@ int status_change_spread(struct block_list *src, struct block_list *bl, bool typ
 	if (status_bl_has_mode(src,MD_STATUS_IMMUNE) || status_bl_has_mode(bl,MD_STATUS_IMMUNE))
 		return 0;
 
-	for( i = SC_COMMON_MIN; i < SC_MAX; i++ ) {
-		if( !sc->data[i] || i == SC_COMMON_MAX )
+	for( i = status_change_next(sc, SC_COMMON_MIN); i < SC_MAX; i = status_change_next(sc, i + 1) ) {
+		if( i == SC_COMMON_MAX )
 			continue;
 		if (sc->data[i]->timer != INVALID_TIMER) {
 			timer = get_timer(sc->data[i]->timer);
@@ -14515,8 +14656,8 @@ void status_change_clear_onChangeMap(struct block_list *bl, struct status_change
 		bool mapIsBG = mapdata->flag[MF_BATTLEGROUND] != 0;
 		bool mapIsTE = mapdata_flag_gvg2_te(mapdata);
 
-		for (i = 0; i < SC_MAX; i++) {
-			if (!sc->data[i] || !SCDisabled[i])
+		for (i = status_change_next(sc, 0); i < SC_MAX; i = status_change_next(sc, i + 1)) {
+			if (!SCDisabled[i])
 				continue;
 
 			if (status_change_isDisabledOnMap_((sc_type)i, mapIsVS, mapIsPVP, mapIsGVG, mapIsBG, mapdata->zone, mapIsTE))
@@ -2356,6 +2356,7 @@ struct status_change {
 #endif
 	unsigned char bs_counter; // Blood Sucker counter
 	struct status_change_entry *data[SC_MAX];
+	uint64 active[(SC_MAX + 63) / 64]; ///< Bitmask of the status changes in data, iterate with status_change_next
 };
 
 // for looking up associated data
@@ -2468,6 +2469,7 @@ int status_change_end_(struct block_list* bl, enum sc_type type, int tid, const
 #define status_change_end(bl,type,tid) status_change_end_(bl,type,tid,__FILE__,__LINE__)
 TIMER_FUNC(status_change_timer);
 int status_change_timer_sub(struct block_list* bl, va_list ap);
+int status_change_next(const struct status_change* sc, int type);
 int status_change_clear(struct block_list* bl, int type);
 void status_change_clear_buffs(struct block_list* bl, uint8 type);
 void status_change_clear_onChangeMap(struct block_list *bl, struct status_change *sc);
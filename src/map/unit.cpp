@@ -3038,6 +3038,7 @@ int unit_remove_map_(struct block_list *bl, clr_type clrtype, const char* file,
 			party_send_dot_remove(sd);// minimap dot fix [Kevin]
 			guild_send_dot_remove(sd);
 			bg_send_dot_remove(sd);
+			map_delmapuser(sd);
 
 			if( map[bl->m].users <= 0 || sd->state.debug_remove_map ) {
 				// This is only place where map users is decreased, if the mobs were removed
@@ -3259,6 +3260,8 @@ int unit_free(struct block_list *bl, clr_type clrtype)
 			if( status_isdead(bl) )
 				pc_setrestartvalue(sd,2);
 
+			map_delmapuser(sd); // in case it never was added to the map blocks
+
 			pc_delinvincibletimer(sd);
 
 			pc_delautobonus(sd, sd->autobonus, false);
@@ -0,0 +1,787 @@
+// Copyright (c) rAthena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+// Replays client sessions recorded by the map-server packet capture
+// (packet_capture in map_athena.conf) as load test.
+// Every client logs in through the login and char-server with an account of
+// the accounts file, enters the map-server with the recorded connect packet
+// and sends the recorded packets of its session with the recorded timing.
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+	#error The replay tool is only supported on POSIX systems
+#endif
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../common/cbasetypes.hpp"
+#include "../common/core.hpp"
+#include "../common/mmo.hpp"
+#include "../common/showmsg.hpp"
+#include "../common/socket.hpp" // RBUF*(), WBUF*()
+#include "../common/strlib.hpp"
+
+#include "../map/clif_capture.hpp"
+
+#ifndef MSG_NOSIGNAL
+	#define MSG_NOSIGNAL 0
+#endif
+
+std::string capture_file = "log/packet_capture.bin";
+std::string accounts_file = "conf/replay_accounts.txt";
+std::string login_ip = "127.0.0.1";
+uint16 login_port = 6900;
+double speed = 1.0;
+int max_clients = 0;
+int ramp_interval = 100;
+int probe_interval = 1000;
+int report_interval = 10;
+int server_pid = 0;
+
+/// Milliseconds since an arbitrary point in time
+static int64 replay_tick( void ){
+	return std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+struct s_replay_packet {
+	uint32 time;
+	size_t offset;
+	uint16 len;
+};
+
+struct s_replay_session {
+	struct s_capture_session positions;
+	std::vector<s_replay_packet> packets; // the first packet is the connect packet
+	std::vector<uint8> data;
+	uint32 end; // time of the disconnect or the last packet
+};
+
+struct s_replay_account {
+	std::string userid;
+	std::string passwd;
+	int slot;
+};
+
+enum e_replay_state {
+	REPLAY_IDLE = 0,
+	REPLAY_LOGIN, // waiting for the login-server to accept the account
+	REPLAY_CHAR_AUTH, // waiting for the char-server to accept the account
+	REPLAY_CHAR_SELECT, // waiting for the map-server address
+	REPLAY_MAP_AUTH, // waiting for the map-server to accept the character
+	REPLAY_RUNNING, // sending the recorded packets
+	REPLAY_DONE,
+	REPLAY_FAILED,
+};
+
+struct s_replay_client {
+	int id;
+	int fd = -1;
+	e_replay_state state = REPLAY_IDLE;
+	struct s_replay_account* account;
+	struct s_replay_session* session;
+
+	uint32 account_id, login_id1, login_id2, char_id;
+	uint8 sex;
+
+	std::vector<uint8> rbuf, wbuf;
+	int64 start; // start of the replayed timeline, or time of the last state change
+	int64 last_recv;
+	size_t next; // next packet of the session to send
+	uint32 crypt_key;
+	bool skip_account_id; // old clients get the raw account id before the first packet
+	bool unframed; // an unknown packet was received, the stream can not be parsed anymore
+	std::deque<int64> probes; // send time of the unanswered latency probes
+	int64 next_probe;
+};
+
+static struct s_capture_header header;
+static std::vector<int16> packet_lengths;
+static std::vector<s_replay_session> sessions;
+static std::vector<s_replay_account> accounts;
+static std::vector<s_replay_client> clients;
+
+struct s_replay_stats {
+	uint64 packets_sent;
+	uint64 bytes_sent;
+	uint64 bytes_received;
+	std::vector<int> latencies; // response times of the probes in ms
+};
+
+static struct s_replay_stats stats, stats_total; // of the current report interval and of the whole run
+static uint64 cpu_last = 0;
+
+static bool replay_read_capture( const char* filename ){
+	FILE* fp = fopen( filename, "rb" );
+	struct s_capture_record record;
+	std::vector<uint32> session_index; // capture session id -> index in sessions
+	size_t count = 0;
+
+	if( fp == nullptr ){
+		ShowError( "Could not open the capture '%s'.\n", filename );
+		return false;
+	}
+
+	if( fread( &header, sizeof( header ), 1, fp ) != 1 || memcmp( header.magic, CAPTURE_MAGIC, sizeof( header.magic ) ) != 0 || header.version != CAPTURE_VERSION ){
+		ShowError( "'%s' is not a packet capture of a supported version.\n", filename );
+		fclose( fp );
+		return false;
+	}
+
+	packet_lengths.resize( header.max_packet_db + 1 );
+
+	if( fread( packet_lengths.data(), sizeof( int16 ), packet_lengths.size(), fp ) != packet_lengths.size() ){
+		ShowError( "The capture '%s' is truncated.\n", filename );
+		fclose( fp );
+		return false;
+	}
+
+	while( fread( &record, sizeof( record ), 1, fp ) == 1 ){
+		uint8 data[UINT16_MAX];
+
+		if( record.len > 0 && fread( data, record.len, 1, fp ) != 1 )
+			break;
+
+		if( record.session >= session_index.size() )
+			session_index.resize( record.session + 1, UINT32_MAX );
+
+		if( record.type == CAPTURE_SESSION ){
+			struct s_replay_session session = {};
+
+			memcpy( &session.positions, data, std::min<size_t>( record.len, sizeof( session.positions ) ) );
+			session_index[record.session] = (uint32)sessions.size();
+			sessions.push_back( session );
+			continue;
+		}
+
+		if( session_index[record.session] == UINT32_MAX )
+			continue;
+
+		struct s_replay_session& session = sessions[session_index[record.session]];
+
+		session.end = record.time;
+
+		if( record.type == CAPTURE_PACKET ){
+			struct s_replay_packet packet;
+
+			packet.time = record.time;
+			packet.offset = session.data.size();
+			packet.len = record.len;
+			session.packets.push_back( packet );
+			session.data.insert( session.data.end(), data, data + record.len );
+			count++;
+		}
+	}
+
+	fclose( fp );
+
+	// sessions without the connect packet can not be replayed
+	sessions.erase( std::remove_if( sessions.begin(), sessions.end(), []( const s_replay_session& session ){
+		return session.packets.empty();
+	} ), sessions.end() );
+
+	ShowStatus( "Loaded '" CL_WHITE "%" PRIuPTR CL_RESET "' sessions with '" CL_WHITE "%" PRIuPTR CL_RESET "' packets (PACKETVER %u) from '" CL_WHITE "%s" CL_RESET "'.\n", sessions.size(), count, header.packetver, filename );
+
+	return !sessions.empty();
+}
+
+static bool replay_read_accounts( const char* filename ){
+	FILE* fp = fopen( filename, "r" );
+	char line[1024], userid[NAME_LENGTH], passwd[NAME_LENGTH];
+	int slot;
+
+	if( fp == nullptr ){
+		ShowError( "Could not open the accounts file '%s'.\n", filename );
+		return false;
+	}
+
+	while( fgets( line, sizeof( line ), fp ) ){
+		if( line[0] == '/' && line[1] == '/' )
+			continue;
+
+		if( sscanf( line, "%23s %23s %d", userid, passwd, &slot ) != 3 )
+			continue;
+
+		accounts.push_back( { userid, passwd, slot } );
+	}
+
+	fclose( fp );
+
+	return !accounts.empty();
+}
+
+static void replay_fail( struct s_replay_client& client, const char* reason ){
+	ShowWarning( "Client %d (%s): %s\n", client.id, client.account->userid.c_str(), reason );
+
+	if( client.fd >= 0 )
+		close( client.fd );
+
+	client.fd = -1;
+	client.state = REPLAY_FAILED;
+}
+
+static bool replay_connect( struct s_replay_client& client, uint32 ip, uint16 port ){
+	struct sockaddr_in addr = {};
+	int yes = 1;
+
+	if( client.fd >= 0 )
+		close( client.fd );
+
+	client.rbuf.clear();
+	client.wbuf.clear();
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl( ip );
+	addr.sin_port = htons( port );
+
+	if( ( client.fd = socket( AF_INET, SOCK_STREAM, 0 ) ) < 0 || connect( client.fd, (struct sockaddr*)&addr, sizeof( addr ) ) != 0 ){
+		replay_fail( client, strerror( errno ) );
+		return false;
+	}
+
+	setsockopt( client.fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof( yes ) );
+	fcntl( client.fd, F_SETFL, fcntl( client.fd, F_GETFL ) | O_NONBLOCK );
+
+	client.start = client.last_recv = replay_tick();
+	return true;
+}
+
+static void replay_send( struct s_replay_client& client, const uint8* data, size_t len ){
+	client.wbuf.insert( client.wbuf.end(), data, data + len );
+	stats.packets_sent++;
+	stats.bytes_sent += len;
+}
+
+/// Sends a packet to the map-server, applying the packet id obfuscation
+static void replay_send_map( struct s_replay_client& client, uint8* data, size_t len ){
+	if( header.crypt_key[0] != 0 ){
+		WBUFW( data, 0 ) ^= ( client.crypt_key >> 16 ) & 0x7FFF;
+		client.crypt_key = client.crypt_key * header.crypt_key[1] + header.crypt_key[2];
+	}
+
+	replay_send( client, data, len );
+}
+
+static void replay_send_probe( struct s_replay_client& client, int64 tick ){
+	uint8 buf[64] = {};
+
+	if( header.tick_cmd == 0 || header.tick_len > sizeof( buf ) )
+		return;
+
+	WBUFW( buf, 0 ) = header.tick_cmd;
+	WBUFL( buf, header.tick_pos ) = (uint32)tick;
+	client.probes.push_back( tick );
+	replay_send_map( client, buf, header.tick_len );
+}
+
+static void replay_login( struct s_replay_client& client ){
+	uint8 buf[55] = {};
+
+	if( !replay_connect( client, ntohl( inet_addr( login_ip.c_str() ) ), login_port ) )
+		return;
+
+	// 0064 <version>.L <username>.24B <password>.24B <clienttype>.B (CA_LOGIN)
+	WBUFW( buf, 0 ) = 0x64;
+	WBUFL( buf, 2 ) = header.packetver;
+	safestrncpy( WBUFCP( buf, 6 ), client.account->userid.c_str(), NAME_LENGTH );
+	safestrncpy( WBUFCP( buf, 30 ), client.account->passwd.c_str(), NAME_LENGTH );
+	replay_send( client, buf, sizeof( buf ) );
+	client.state = REPLAY_LOGIN;
+}
+
+/// Parses the data of a client, returns the number of bytes that were used
+static size_t replay_parse( struct s_replay_client& client, uint8* buf, size_t len ){
+	int64 tick = replay_tick();
+
+	switch( client.state ){
+		case REPLAY_LOGIN: {
+			if( len < 2 )
+				return 0;
+
+			uint16 cmd = RBUFW( buf, 0 );
+
+			// 0069/0ac4 <len>.W <login id1>.L <account id>.L <login id2>.L ... <sex>.B { <char-server> }* (AC_ACCEPT_LOGIN)
+			if( cmd != 0x69 && cmd != 0xac4 ){
+				replay_fail( client, "the login-server refused the account" );
+				return len;
+			}
+
+			if( len < 4 || len < RBUFW( buf, 2 ) )
+				return 0;
+
+			size_t offset = ( cmd == 0x69 ) ? 47 : 64;
+
+			if( RBUFW( buf, 2 ) < offset + 6 ){
+				replay_fail( client, "no char-server is online" );
+				return len;
+			}
+
+			client.login_id1 = RBUFL( buf, 4 );
+			client.account_id = RBUFL( buf, 8 );
+			client.login_id2 = RBUFL( buf, 12 );
+			client.sex = RBUFB( buf, 46 );
+
+			// connect to the first char-server
+			if( !replay_connect( client, ntohl( RBUFL( buf, offset ) ), RBUFW( buf, offset + 4 ) ) )
+				return len;
+
+			uint8 req[17] = {};
+
+			// 0065 <account id>.L <login id1>.L <login id2>.L <unknown>.W <sex>.B (CH_ENTER)
+			WBUFW( req, 0 ) = 0x65;
+			WBUFL( req, 2 ) = client.account_id;
+			WBUFL( req, 6 ) = client.login_id1;
+			WBUFL( req, 10 ) = client.login_id2;
+			WBUFB( req, 16 ) = client.sex;
+			replay_send( client, req, sizeof( req ) );
+			client.state = REPLAY_CHAR_AUTH;
+			return 0;
+		}
+
+		case REPLAY_CHAR_AUTH:
+			// the character list is sent in several packets, which depend on the client version;
+			// the character is selected when the char-server stopped sending.
+			if( len >= 6 && RBUFW( buf, 4 ) == 0x6c ){
+				replay_fail( client, "the char-server refused the account" );
+				return len;
+			}
+			return 0;
+
+		case REPLAY_CHAR_SELECT: {
+			if( len < 2 )
+				return 0;
+
+			uint16 cmd = RBUFW( buf, 0 );
+
+			// 0071/0ac5 <char id>.L <map name>.16B <map ip>.L <map port>.W (HC_NOTIFY_ZONESVR)
+			if( cmd != 0x71 && cmd != 0xac5 ){
+				replay_fail( client, "the char-server refused the character selection" );
+				return len;
+			}
+
+			if( len < 28 )
+				return 0;
+
+			client.char_id = RBUFL( buf, 2 );
+
+			if( !replay_connect( client, ntohl( RBUFL( buf, 22 ) ), RBUFW( buf, 26 ) ) )
+				return len;
+
+			// send the recorded connect packet with the new login
+			struct s_replay_session& session = *client.session;
+			struct s_replay_packet& packet = session.packets[0];
+			std::vector<uint8> connect( session.data.begin() + packet.offset, session.data.begin() + packet.offset + packet.len );
+
+			WBUFL( connect.data(), session.positions.account_id ) = client.account_id;
+			WBUFL( connect.data(), session.positions.char_id ) = client.char_id;
+			WBUFL( connect.data(), session.positions.login_id1 ) = client.login_id1;
+			WBUFL( connect.data(), session.positions.client_tick ) = (uint32)tick;
+			WBUFB( connect.data(), session.positions.sex ) = client.sex;
+
+			client.crypt_key = header.crypt_key[0] * header.crypt_key[1] + header.crypt_key[2];
+			client.skip_account_id = ( header.packetver < 20070521 );
+			replay_send_map( client, connect.data(), connect.size() );
+			client.next = 1;
+			client.state = REPLAY_MAP_AUTH;
+			return 0;
+		}
+
+		case REPLAY_MAP_AUTH:
+		case REPLAY_RUNNING: {
+			size_t used = 0;
+
+			if( client.skip_account_id ){
+				if( len < 4 )
+					return 0;
+
+				client.skip_account_id = false;
+				used = 4;
+			}
+
+			while( !client.unframed && len - used >= 2 ){
+				uint16 cmd = RBUFW( buf, used );
+				int packet_len = ( cmd < packet_lengths.size() ) ? packet_lengths[cmd] : 0;
+
+				if( packet_len == -1 ){
+					if( len - used < 4 )
+						break;
+
+					packet_len = RBUFW( buf, used + 2 );
+				}
+
+				if( packet_len < 2 ){
+					ShowWarning( "Client %d (%s): Received unknown packet 0x%04x, no more latency probes are measured for it.\n", client.id, client.account->userid.c_str(), cmd );
+					client.unframed = true;
+					client.probes.clear();
+					break;
+				}
+
+				if( len - used < (size_t)packet_len )
+					break;
+
+				if( cmd == 0x81 && client.state == REPLAY_MAP_AUTH ){
+					replay_fail( client, "the map-server refused the character" );
+					return len;
+				}
+
+				if( cmd == header.authok_cmd && client.state == REPLAY_MAP_AUTH ){
+					client.state = REPLAY_RUNNING;
+					client.start = tick;
+					client.next_probe = tick + probe_interval;
+				}
+
+				// 007f <server tick>.L (ZC_NOTIFY_TIME)
+				if( cmd == 0x7f && !client.probes.empty() ){
+					stats.latencies.push_back( (int)( tick - client.probes.front() ) );
+					client.probes.pop_front();
+				}
+
+				used += packet_len;
+			}
+
+			return client.unframed ? len : used;
+		}
+
+		default:
+			return len;
+	}
+}
+
+static void replay_recv( struct s_replay_client& client ){
+	uint8 buf[65536];
+	ssize_t len;
+
+	while( client.fd >= 0 && ( len = recv( client.fd, buf, sizeof( buf ), 0 ) ) > 0 ){
+		size_t used;
+
+		stats.bytes_received += len;
+		client.last_recv = replay_tick();
+		client.rbuf.insert( client.rbuf.end(), buf, buf + len );
+
+		while( client.fd >= 0 && !client.rbuf.empty() && ( used = replay_parse( client, client.rbuf.data(), client.rbuf.size() ) ) > 0 )
+			client.rbuf.erase( client.rbuf.begin(), client.rbuf.begin() + std::min( used, client.rbuf.size() ) );
+	}
+
+	if( client.fd >= 0 && ( len == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) ) ){
+		// the login-server closes the connection after the login, the char-server after the character selection
+		if( client.state != REPLAY_LOGIN && client.state != REPLAY_CHAR_SELECT )
+			replay_fail( client, "the server closed the connection" );
+	}
+}
+
+static void replay_flush( struct s_replay_client& client ){
+	if( client.fd < 0 || client.wbuf.empty() )
+		return;
+
+	ssize_t len = send( client.fd, client.wbuf.data(), client.wbuf.size(), MSG_NOSIGNAL );
+
+	if( len > 0 )
+		client.wbuf.erase( client.wbuf.begin(), client.wbuf.begin() + len );
+	else if( len < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+		replay_fail( client, strerror( errno ) );
+}
+
+/// Sends the packets of the session that are due and ends the session after its last packet
+static void replay_update( struct s_replay_client& client, int64 tick ){
+	switch( client.state ){
+		case REPLAY_CHAR_AUTH:
+			// select the character when the char-server stopped sending the character list
+			if( client.rbuf.size() > 4 && tick - client.last_recv >= 200 ){
+				uint8 buf[3];
+
+				// 0066 <slot>.B (CH_SELECT_CHAR)
+				WBUFW( buf, 0 ) = 0x66;
+				WBUFB( buf, 2 ) = client.account->slot;
+				client.rbuf.clear();
+				replay_send( client, buf, sizeof( buf ) );
+				client.state = REPLAY_CHAR_SELECT;
+				client.start = tick;
+			}
+			else if( tick - client.start > 10000 )
+				replay_fail( client, "the char-server did not send the character list" );
+			break;
+
+		case REPLAY_LOGIN:
+		case REPLAY_CHAR_SELECT:
+		case REPLAY_MAP_AUTH:
+			if( tick - client.start > 10000 )
+				replay_fail( client, "timeout while logging in" );
+			break;
+
+		case REPLAY_RUNNING: {
+			struct s_replay_session& session = *client.session;
+			uint32 base = ( session.packets.size() > 1 ) ? session.packets[1].time : session.end;
+
+			while( client.next < session.packets.size() && client.start + ( session.packets[client.next].time - base ) / speed <= tick ){
+				struct s_replay_packet& packet = session.packets[client.next++];
+				std::vector<uint8> data( session.data.begin() + packet.offset, session.data.begin() + packet.offset + packet.len );
+
+				if( !client.unframed && RBUFW( data.data(), 0 ) == header.tick_cmd )
+					client.probes.push_back( tick );
+
+				replay_send_map( client, data.data(), data.size() );
+			}
+
+			if( probe_interval > 0 && !client.unframed && tick >= client.next_probe ){
+				replay_send_probe( client, tick );
+				client.next_probe = tick + probe_interval;
+			}
+
+			if( client.next >= session.packets.size() && client.start + ( session.end - base ) / speed + 1000 <= tick ){
+				replay_flush( client );
+				close( client.fd );
+				client.fd = -1;
+				client.state = REPLAY_DONE;
+			}
+			break;
+		}
+
+		default:
+			break;
+	}
+}
+
+/// Reads the memory and cpu time of the map-server process
+static void replay_server_usage( double& rss, double& cpu, int elapsed ){
+	char path[64], line[1024];
+	FILE* fp;
+
+	rss = cpu = 0;
+
+	if( server_pid <= 0 )
+		return;
+
+	snprintf( path, sizeof( path ), "/proc/%d/status", server_pid );
+
+	if( ( fp = fopen( path, "r" ) ) != nullptr ){
+		while( fgets( line, sizeof( line ), fp ) ){
+			unsigned long kb;
+
+			if( sscanf( line, "VmRSS: %lu", &kb ) == 1 )
+				rss = kb / 1024.;
+		}
+
+		fclose( fp );
+	}
+
+	snprintf( path, sizeof( path ), "/proc/%d/stat", server_pid );
+
+	if( ( fp = fopen( path, "r" ) ) != nullptr ){
+		unsigned long long utime, stime;
+		const char* p;
+
+		// the fields after the process name, utime and stime are the 14th and 15th field
+		if( fgets( line, sizeof( line ), fp ) && ( p = strrchr( line, ')' ) ) != nullptr
+			&& sscanf( p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime ) == 2 ){
+			uint64 total = utime + stime;
+
+			if( cpu_last > 0 && elapsed > 0 )
+				cpu = 100. * ( total - cpu_last ) / sysconf( _SC_CLK_TCK ) / elapsed;
+
+			cpu_last = total;
+		}
+
+		fclose( fp );
+	}
+}
+
+static void replay_report( const char* title, struct s_replay_stats& report, int elapsed ){
+	int states[REPLAY_FAILED + 1] = {};
+	std::vector<int>& samples = report.latencies;
+	double rss, cpu;
+
+	for( auto& client : clients )
+		states[client.state]++;
+
+	replay_server_usage( rss, cpu, elapsed );
+
+	ShowInfo( "%s: " CL_WHITE "%d" CL_RESET " replaying, %d logging in, %d done, %d failed, %d waiting\n", title, states[REPLAY_RUNNING],
+		states[REPLAY_LOGIN] + states[REPLAY_CHAR_AUTH] + states[REPLAY_CHAR_SELECT] + states[REPLAY_MAP_AUTH], states[REPLAY_DONE], states[REPLAY_FAILED], states[REPLAY_IDLE] );
+	ShowMessage( "\tsent     : %" PRIu64 " packets, %.2f KB/s\n", report.packets_sent, report.bytes_sent / 1024. / std::max( elapsed, 1 ) );
+	ShowMessage( "\treceived : %.2f KB/s\n", report.bytes_received / 1024. / std::max( elapsed, 1 ) );
+
+	if( !samples.empty() ){
+		double sum = 0;
+
+		std::sort( samples.begin(), samples.end() );
+
+		for( int sample : samples )
+			sum += sample;
+
+		ShowMessage( "\tresponse : %" PRIuPTR " probes, avg %.1f ms, p50 %d ms, p95 %d ms, p99 %d ms, max %d ms\n", samples.size(), sum / samples.size(),
+			samples[samples.size() / 2], samples[samples.size() * 95 / 100], samples[samples.size() * 99 / 100], samples.back() );
+	}
+
+	if( server_pid > 0 )
+		ShowMessage( "\tmap-server: %.1f MB resident, %.1f%% cpu\n", rss, cpu );
+}
+
+/// Reports the current interval and adds its statistics to the totals
+static void replay_report_interval( int elapsed ){
+	replay_report( "Interval", stats, elapsed );
+
+	stats_total.packets_sent += stats.packets_sent;
+	stats_total.bytes_sent += stats.bytes_sent;
+	stats_total.bytes_received += stats.bytes_received;
+	stats_total.latencies.insert( stats_total.latencies.end(), stats.latencies.begin(), stats.latencies.end() );
+	stats = s_replay_stats();
+}
+
+static void display_usage( void ){
+	ShowInfo( "Usage: %s [options]\n", SERVER_NAME );
+	ShowInfo( "Options:\n" );
+	ShowInfo( "  --capture <file>\tPacket capture of the map-server (default: %s).\n", capture_file.c_str() );
+	ShowInfo( "  --accounts <file>\tAccounts to use, one '<userid> <password> <slot>' per line (default: %s).\n", accounts_file.c_str() );
+	ShowInfo( "  --login <ip:port>\tAddress of the login-server (default: %s:%d).\n", login_ip.c_str(), login_port );
+	ShowInfo( "  --clients <n>\t\tNumber of clients (default: one per account).\n" );
+	ShowInfo( "  --speed <factor>\tReplay speed, 2 replays the sessions twice as fast (default: %.1f).\n", speed );
+	ShowInfo( "  --ramp <ms>\t\tDelay between the logins of two clients (default: %d).\n", ramp_interval );
+	ShowInfo( "  --probe <ms>\t\tInterval of the response time probes of each client, 0 to disable (default: %d).\n", probe_interval );
+	ShowInfo( "  --report <s>\t\tInterval of the reports (default: %d).\n", report_interval );
+	ShowInfo( "  --pid <pid>\t\tProcess id of the map-server, to report its memory and cpu usage.\n" );
+}
+
+// Processes command-line arguments
+static bool process_args( int argc, char* argv[] ){
+	for( int i = 1; i < argc; i++ ){
+		const char* arg = argv[i];
+		const char* value = ( i + 1 < argc ) ? argv[i + 1] : nullptr;
+
+		if( strcmp( arg, "--help" ) == 0 || strcmp( arg, "-h" ) == 0 || value == nullptr ){
+			display_usage();
+			return false;
+		}
+
+		i++;
+
+		if( strcmp( arg, "--capture" ) == 0 )
+			capture_file = value;
+		else if( strcmp( arg, "--accounts" ) == 0 )
+			accounts_file = value;
+		else if( strcmp( arg, "--login" ) == 0 ){
+			const char* port = strchr( value, ':' );
+
+			login_ip = std::string( value, port ? port - value : strlen( value ) );
+			if( port != nullptr )
+				login_port = atoi( port + 1 );
+		}
+		else if( strcmp( arg, "--clients" ) == 0 )
+			max_clients = atoi( value );
+		else if( strcmp( arg, "--speed" ) == 0 )
+			speed = std::max( atof( value ), 0.01 );
+		else if( strcmp( arg, "--ramp" ) == 0 )
+			ramp_interval = std::max( atoi( value ), 0 );
+		else if( strcmp( arg, "--probe" ) == 0 )
+			probe_interval = std::max( atoi( value ), 0 );
+		else if( strcmp( arg, "--report" ) == 0 )
+			report_interval = std::max( atoi( value ), 1 );
+		else if( strcmp( arg, "--pid" ) == 0 )
+			server_pid = atoi( value );
+		else{
+			ShowError( "Unknown option '%s'.\n", arg );
+			display_usage();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int do_init( int argc, char** argv ){
+	if( !process_args( argc, argv ) || !replay_read_capture( capture_file.c_str() ) )
+		return 0;
+
+	if( !replay_read_accounts( accounts_file.c_str() ) ){
+		ShowError( "No accounts found in '%s'.\n", accounts_file.c_str() );
+		return 0;
+	}
+
+	signal( SIGPIPE, SIG_IGN );
+
+	if( max_clients <= 0 || max_clients > (int)accounts.size() )
+		max_clients = (int)accounts.size();
+
+	clients.resize( max_clients );
+
+	for( int i = 0; i < max_clients; i++ ){
+		clients[i].id = i + 1;
+		clients[i].account = &accounts[i];
+		clients[i].session = &sessions[i % sessions.size()];
+	}
+
+	ShowStatus( "Replaying with '" CL_WHITE "%d" CL_RESET "' clients at speed " CL_WHITE "%.2f" CL_RESET ".\n", max_clients, speed );
+
+	int64 begin = replay_tick(), last_report = begin;
+	size_t started = 0;
+	std::vector<struct pollfd> fds;
+	std::vector<s_replay_client*> fd_clients;
+
+	while( true ){
+		int64 tick = replay_tick();
+		bool active = false;
+
+		// start the next client
+		while( started < clients.size() && begin + (int64)started * ramp_interval <= tick )
+			replay_login( clients[started++] );
+
+		fds.clear();
+		fd_clients.clear();
+
+		for( auto& client : clients ){
+			replay_update( client, tick );
+			replay_flush( client );
+
+			if( client.state != REPLAY_DONE && client.state != REPLAY_FAILED )
+				active = true;
+
+			if( client.fd < 0 )
+				continue;
+
+			fds.push_back( { client.fd, (short)( POLLIN | ( client.wbuf.empty() ? 0 : POLLOUT ) ), 0 } );
+			fd_clients.push_back( &client );
+		}
+
+		if( !active && started == clients.size() )
+			break;
+
+		if( poll( fds.data(), fds.size(), 5 ) > 0 ){
+			for( size_t i = 0; i < fds.size(); i++ ){
+				if( fds[i].revents & ( POLLIN | POLLHUP | POLLERR ) )
+					replay_recv( *fd_clients[i] );
+			}
+		}
+
+		if( tick - last_report >= report_interval * 1000 ){
+			replay_report_interval( (int)( ( tick - last_report ) / 1000 ) );
+			last_report = tick;
+		}
+	}
+
+	replay_report_interval( (int)( ( replay_tick() - last_report ) / 1000 ) );
+	ShowStatus( "Replay finished after %d seconds.\n", (int)( ( replay_tick() - begin ) / 1000 ) );
+	cpu_last = 0;
+	replay_report( "Total", stats_total, (int)( ( replay_tick() - begin ) / 1000 ) );
+
+	return 0;
+}
+
+void do_final( void ){
+	for( auto& client : clients ){
+		if( client.fd >= 0 )
+			close( client.fd );
+	}
+}